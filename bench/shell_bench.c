@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "shell.h"
+
+/*
+ * shell_bench: measures the parts of the shell every command goes through.
+ * Usage: shell_bench [-n samples] [-s spawns]            microbenchmarks and spawn latency
+ *        shell_bench --replay script.osh...              commands per second for whole scripts
+ */
+
+#define SAMPLE_BATCH 64     //Calls timed together by microbenchmarks, so the clock itself does not dominate.
+
+/*
+ * Lines typical of interactive use and scripts, without and with variable references.
+ */
+const char* parseLines[] = {
+    "ls -la /usr/local/bin",
+    "git commit -m \"Fix the parser\" --author 'A U Thor <author@example.com>'",
+    "grep -r --include='*.c' \"TODO\" src | sort | uniq -c | sort -rn | head -20",
+    "cc -O2 -Wall -Wextra -Iinclude -o build/shell src/main.c src/shell.c src/parser.c -lpthread",
+    "find . -name '*.o' -newer Makefile -print0 | xargs -0 rm -f",
+    "echo a\\ b \"c  d\" 'e  f' # trailing comment",
+    NULL
+};
+
+const char* expandLines[] = {
+    "echo $HOME/$USER ${LANG}.utf8 \"$PWD\"",
+    "cp $SRC/$NAME.tar.gz ${DEST}/backup-$?.tar.gz",
+    "$CC $CFLAGS -o $OUT $IN",
+    "printf '%s\\n' \"$LONG_VALUE\" $LONG_VALUE",
+    NULL
+};
+
+const char* builtInLines[] = {
+    "echo hello world",
+    "export BENCH_VALUE=42",
+    NULL
+};
+
+/*
+ * Function to read the monotonic clock in nanoseconds.
+ */
+double nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+int compareSamples(const void* a, const void* b) {
+    double difference = *(const double*) a - *(const double*) b;
+    return (difference > 0) - (difference < 0);
+}
+
+/*
+ * Function to print the median, 99th percentile and mean of a set of samples.
+ */
+void report(const char* name, double* samples, int sampleNum, const char* unit, double scale) {
+    double sum = 0;
+    for(int i = 0; i < sampleNum; i++) {
+        sum += samples[i];
+    }
+    qsort(samples, sampleNum, sizeof(double), compareSamples);
+    printf("%-20s %8d %12.1f %12.1f %12.1f  %s\n", name, sampleNum, samples[sampleNum / 2] / scale,
+           samples[(int) (sampleNum * 0.99)] / scale, sum / sampleNum / scale, unit);
+}
+
+/*
+ * Function to time parsing (tokenizing, quote removal and expansion) of a set of lines.
+ * Each sample is the mean time per line over SAMPLE_BATCH lines.
+ */
+void benchParse(const char* name, const char** lines, int sampleNum) {
+    int lineNum = 0;
+    while(lines[lineNum] != NULL) {
+        lineNum++;
+    }
+    size_t* lengths = malloc(lineNum * sizeof(size_t));
+    for(int i = 0; i < lineNum; i++) {
+        lengths[i] = strlen(lines[i]);
+    }
+
+    Pipeline pipeline;
+    double* samples = malloc(sampleNum * sizeof(double));
+    for(int i = 0; i < sampleNum; i++) {
+        double start = nowNs();
+        for(int j = 0; j < SAMPLE_BATCH; j++) {
+            int line = (i * SAMPLE_BATCH + j) % lineNum;
+            arenaReset(&lineArena);
+            parseLine(lines[line], lengths[line], &lineArena, &pipeline);
+        }
+        samples[i] = (nowNs() - start) / SAMPLE_BATCH;
+    }
+    report(name, samples, sampleNum, "ns/line", 1);
+    free(samples);
+    free(lengths);
+}
+
+/*
+ * Function to time looking up and running built-ins, with their output going to /dev/null.
+ * The commands are parsed once beforehand, into an arena of their own.
+ */
+void benchBuiltIns(int sampleNum) {
+    Arena commandArena = {NULL, NULL, 0};
+    Pipeline pipelines[8];
+    int commandNum = 0;
+    for(; builtInLines[commandNum] != NULL; commandNum++) {
+        parseLine(builtInLines[commandNum], strlen(builtInLines[commandNum]), &commandArena, &pipelines[commandNum]);
+    }
+
+    int nullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    double* samples = malloc(sampleNum * sizeof(double));
+    for(int i = 0; i < sampleNum; i++) {
+        arenaReset(&lineArena);
+        double start = nowNs();
+        for(int j = 0; j < SAMPLE_BATCH; j++) {
+            Command* command = &pipelines[(i * SAMPLE_BATCH + j) % commandNum].stages[0];
+            builtIn(findBuiltIn(command->argv[0]), command->argc, command->argv, STDIN_FILENO, nullFd);
+        }
+        samples[i] = (nowNs() - start) / SAMPLE_BATCH;
+    }
+    report("builtin dispatch", samples, sampleNum, "ns/command", 1);
+    free(samples);
+    close(nullFd);
+}
+
+/*
+ * Function to time starting a command and reaping it: spawn, wait for SIGCHLD through the event loop, wait4().
+ */
+void benchSpawn(int sampleNum) {
+    Arena commandArena = {NULL, NULL, 0};
+    Pipeline pipeline;
+    parseLine("true", 4, &commandArena, &pipeline);
+
+    int nullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    double* samples = malloc(sampleNum * sizeof(double));
+    for(int i = 0; i < sampleNum; i++) {
+        double start = nowNs();
+        Job* job = createJob("true", 4, 0);
+        spawnCommand(job, &pipeline.stages[0], STDIN_FILENO, nullFd);
+        waitJob(job);
+        removeJob(job);
+        samples[i] = nowNs() - start;
+    }
+    report("spawn + reap", samples, sampleNum, "us/command", 1000);
+    free(samples);
+    close(nullFd);
+}
+
+/*
+ * Function to run a script with its output discarded and report how many commands per second it ran.
+ * Returns 0 on success, -1 if the script could not be read.
+ */
+int benchReplay(const char* path) {
+    FILE* script = fopen(path, "r");
+    if(script == NULL) {
+        perror(path);
+        return -1;
+    }
+    char* line = NULL;
+    size_t size = 0;
+    long commandNum = 0;
+    while(getline(&line, &size, script) != -1) {
+        const char* text = line + strspn(line, " \t");
+        if(*text != '\n' && *text != '\0' && *text != '#') commandNum++;
+    }
+    free(line);
+    fclose(script);
+
+    fflush(stdout);
+    int savedOut = dup(STDOUT_FILENO);
+    int nullFd = open("/dev/null", O_WRONLY);
+    dup2(nullFd, STDOUT_FILENO);
+    close(nullFd);
+
+    double start = nowNs();
+    int result = runScript(path);
+    double seconds = (nowNs() - start) / 1e9;
+
+    fflush(stdout);
+    dup2(savedOut, STDOUT_FILENO);
+    close(savedOut);
+    if(result == -1) return -1;
+    printf("%-40s %8ld commands %10.3f s %12.1f commands/s\n", path, commandNum, seconds, commandNum / seconds);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int sampleNum = 10000;
+    int spawnNum = 1000;
+
+    initShell();
+    if(argc > 1 && strcmp(argv[1], "--replay") == 0) {
+        int result = EXIT_SUCCESS;
+        for(int i = 2; i < argc; i++) {
+            if(benchReplay(argv[i]) == -1) result = EXIT_FAILURE;
+        }
+        return result;
+    }
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            sampleNum = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            spawnNum = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: shell_bench [-n samples] [-s spawns]\n       shell_bench --replay script...\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if(sampleNum < 1 || spawnNum < 1) {
+        fprintf(stderr, "shell_bench: sample counts must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    //Values for the variables referenced by expandLines.
+    const char* variables[][2] = {
+        {"SRC", "/var/lib/archive"}, {"NAME", "project"}, {"DEST", "/mnt/backup"}, {"CC", "gcc"},
+        {"CFLAGS", "-O2 -g -Wall -Wextra"}, {"OUT", "build/app"}, {"IN", "src/app.c"},
+        {"LONG_VALUE", "a value long enough to be split into many fields when it is expanded outside of quotes, "
+                       "as lists of files or compiler flags kept in variables usually are"},
+    };
+    for(size_t i = 0; i < sizeof(variables) / sizeof(variables[0]); i++) {
+        setVar(&shellVars, variables[i][0], strlen(variables[i][0]), variables[i][1], strlen(variables[i][1]), 0);
+    }
+
+    printf("%-20s %8s %12s %12s %12s\n", "benchmark", "samples", "p50", "p99", "mean");
+    benchParse("tokenize", parseLines, sampleNum);
+    benchParse("expand", expandLines, sampleNum);
+    benchBuiltIns(sampleNum);
+    benchSpawn(spawnNum);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+/*
+ * Binary event log format shared by the shell and oshell-logdump.
+ *
+ * A log file starts with a LogFileHeader followed by fixed size LogRecords.
+ * Records carry CLOCK_MONOTONIC timestamps; every shell session starts with an EVENT_SESSION record whose arg
+ * holds the wall-clock time (in nanoseconds since the epoch) at which it was recorded, which is used to convert the
+ * timestamps of the session's records to wall-clock time when the log is rendered.
+ */
+
+#ifndef OSHELL_EVENTLOG_H
+#define OSHELL_EVENTLOG_H
+
+#include <stdint.h>
+
+#define LOG_MAGIC "OSHLOG\0\0"      //Magic bytes at the start of a log file.
+#define LOG_VERSION 1               //Version of the record layout.
+
+typedef struct LogFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;            //sizeof(LogRecord) of the writer.
+} LogFileHeader;
+
+typedef struct LogRecord {
+    uint64_t timestamp;             //CLOCK_MONOTONIC time in nanoseconds.
+    uint64_t arg;                   //Event specific value.
+    uint32_t session;               //PID of the shell that recorded the event.
+    int32_t pid;                    //PID of the child process concerned, 0 if none.
+    int32_t code;                   //errno value for errors, wait status for terminated children.
+    uint16_t type;                  //One of EventType.
+    uint16_t call;                  //One of EventCall, for errors.
+} LogRecord;
+
+typedef enum EventType {
+    EVENT_SESSION = 1,              //Shell started, arg is the wall-clock time in nanoseconds.
+    EVENT_ERROR,                    //A system call failed, call and code tell which one and why.
+    EVENT_REAP,                     //A child process terminated, code is its wait status.
+    EVENT_DROPPED,                  //Records were lost because the ring buffer was full, arg is how many.
+    EVENT_PLACE,                    //A child process was placed on CPUs, arg is the mask of CPUs 0 to 63 it may run on,
+                                    //code the NUMA node its memory is preferred on (-1 if none).
+    EVENT_TIMEOUT                   //A job passed its deadline, pid is its first process, code the signal it was sent
+                                    //(SIGTERM, then SIGKILL after the grace period), arg the deadline in milliseconds.
+} EventType;
+
+typedef enum EventCall {
+    CALL_NONE = 0,
+    CALL_GETCWD,
+    CALL_CHDIR,
+    CALL_FGETS,
+    CALL_GETLOGIN,
+    CALL_SETENV,
+    CALL_POSIX_SPAWN,
+    CALL_OPEN,
+    CALL_MMAP,
+    CALL_READ,
+    CALL_EPOLL,
+    CALL_SIGNALFD,
+    CALL_SOCKET,
+    CALL_SCHED_SETAFFINITY,
+    CALL_MAX
+} EventCall;
+
+#endif
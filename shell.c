@@ -0,0 +1,9128 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pwd.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <stdarg.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "eventlog.h"
+#include "shell.h"
+
+char workDir[DIR_MAX] = "";
+char home[HOME_MAX] = "/home/";
+
+/*---------------------------------------------Beginning of event log section---------------------------------------------*/
+/*
+ * Events are recorded as fixed size binary records (see eventlog.h) in a lock-free ring buffer and written to the
+ * log file in batches at idle points: before a prompt, when the ring is half full and on exit.
+ * Recording an event only takes a clock_gettime() call and a few atomic operations, so it is safe from signal handlers.
+ * Each slot of the ring carries a sequence number saying whether it is free for a producer or ready for the consumer,
+ * when the ring is full events are counted as dropped instead of waiting for space.
+ * The file is rotated once it grows past LOG_ROTATE_SIZE, keeping LOG_ROTATE_KEEP old files.
+ */
+
+typedef struct LogSlot {
+    uint64_t sequence;
+    LogRecord record;
+} LogSlot;
+
+LogSlot logRing[LOG_RING_SIZE];
+LogRecord logBatch[LOG_RING_SIZE + 1];  //Records taken from the ring to be written, plus a dropped records notice.
+uint64_t logHead = 0;                   //Position of the next record to be recorded.
+uint64_t logTail = 0;                   //Position of the next record to be written.
+uint64_t logDropped = 0;
+char logPath[DIR_MAX] = "";
+uint32_t logSession = 0;                //PID of the shell, recorded in every record.
+int logFd = -1;
+off_t logSize = 0;
+
+/*
+ * Function to record an event in the ring buffer.
+ * Safe to call from signal handlers.
+ */
+void logEvent(EventType type, EventCall call, int code, pid_t pid, uint64_t arg) {
+    uint64_t position = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+    LogSlot* slot = NULL;
+
+    //Claim a slot, retrying if another producer (e.g. a signal handler) claimed it first.
+    while(1) {
+        slot = &logRing[position & (LOG_RING_SIZE - 1)];
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if(sequence == position) {
+            if(__atomic_compare_exchange_n(&logHead, &position, position + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if(sequence < position) {
+            __atomic_fetch_add(&logDropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            position = __atomic_load_n(&logHead, __ATOMIC_RELAXED);
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    slot->record.timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    slot->record.arg = arg;
+    slot->record.session = logSession;
+    slot->record.pid = pid;
+    slot->record.code = code;
+    slot->record.type = type;
+    slot->record.call = call;
+
+    //Publish the record to the consumer.
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Function to move a descriptor the shell keeps open to REDIRECT_FD_MAX or above, out of reach of the descriptors
+ * commands can redirect.
+ * Returns the new descriptor, or fd itself if it is -1 or already high enough.
+ */
+int keepFdHigh(int fd) {
+    if(fd == -1 || fd >= REDIRECT_FD_MAX) return fd;
+    int high = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_FD_MAX);
+    close(fd);
+    return high;
+}
+
+/*
+ * Function to open the log file, writing the file header if it is new, and record the start of the session.
+ */
+void logOpen() {
+    logFd = keepFdHigh(open(logPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644));
+    if(logFd == -1) return;
+
+    struct stat info;
+    logSize = (fstat(logFd, &info) == 0) ? info.st_size : 0;
+    if(logSize == 0) {
+        LogFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+        header.version = LOG_VERSION;
+        header.recordSize = sizeof(LogRecord);
+        if(write(logFd, &header, sizeof(header)) == sizeof(header)) logSize = sizeof(header);
+    }
+
+    struct timespec wallClock;
+    clock_gettime(CLOCK_REALTIME, &wallClock);
+    logEvent(EVENT_SESSION, CALL_NONE, 0, 0, (uint64_t) wallClock.tv_sec * 1000000000 + wallClock.tv_nsec);
+}
+
+/*
+ * Function to rename the log file to <log>.1 (shifting older files up to <log>.LOG_ROTATE_KEEP) and start a new one.
+ */
+void logRotate() {
+    char from[DIR_MAX + 16];
+    char to[DIR_MAX + 16];
+    close(logFd);
+    for(int i = LOG_ROTATE_KEEP - 1; i > 0; i--) {
+        snprintf(from, sizeof(from), "%s.%d", logPath, i);
+        snprintf(to, sizeof(to), "%s.%d", logPath, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", logPath);
+    rename(logPath, to);
+    logOpen();
+}
+
+/*
+ * Function to write every published record of the ring buffer to the log file.
+ * Must not be called from signal handlers.
+ */
+void logFlush() {
+    int recordNum = 0;
+    while(1) {
+        LogSlot* slot = &logRing[logTail & (LOG_RING_SIZE - 1)];
+        if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != logTail + 1) break;
+        logBatch[recordNum++] = slot->record;
+
+        //Hand the slot back to producers for the next lap of the ring.
+        __atomic_store_n(&slot->sequence, logTail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+        logTail++;
+    }
+
+    uint64_t dropped = __atomic_exchange_n(&logDropped, 0, __ATOMIC_RELAXED);
+    if(dropped > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        memset(&logBatch[recordNum], 0, sizeof(LogRecord));
+        logBatch[recordNum].timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+        logBatch[recordNum].session = logSession;
+        logBatch[recordNum].type = EVENT_DROPPED;
+        logBatch[recordNum].arg = dropped;
+        recordNum++;
+    }
+    if(recordNum == 0 || logFd == -1) return;
+
+    ssize_t written = write(logFd, logBatch, recordNum * sizeof(LogRecord));
+    if(written > 0) logSize += written;
+    if(logSize >= LOG_ROTATE_SIZE) logRotate();
+}
+
+/*
+ * Function to check whether records are waiting to be written.
+ */
+int logHasRecords() {
+    return __atomic_load_n(&logHead, __ATOMIC_RELAXED) != logTail || __atomic_load_n(&logDropped, __ATOMIC_RELAXED) != 0;
+}
+
+/*
+ * Function to write the ring buffer to the log file once it is at least half full.
+ */
+void logFlushIfFull() {
+    if(__atomic_load_n(&logHead, __ATOMIC_RELAXED) - logTail >= LOG_RING_SIZE / 2) logFlush();
+}
+
+/*
+ * Function to initialize the ring buffer and open the log file in the current directory.
+ */
+void logInit(const char* fileName) {
+    for(uint64_t i = 0; i < LOG_RING_SIZE; i++) {
+        logRing[i].sequence = i;
+    }
+    logSession = getpid();
+    //Keep an absolute path, so rotation still finds the file after the working directory changes.
+    if(getcwd(logPath, DIR_MAX - strlen(fileName) - 1) != NULL) {
+        strcat(logPath, "/");
+    } else {
+        logPath[0] = '\0';
+    }
+    strcat(logPath, fileName);
+    logOpen();
+    atexit(logFlush);
+}
+
+/*---------------------------------------------End of event log section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of error handling section---------------------------------------------*/
+/*
+ * The following functions handle errors resulting from pre-defined system calls,
+ * if a function returns -1 its corresponding error handler is called to tell the user and record the failing call
+ * and the error code in the event log.
+ * The error messages for each code (taken from the man pages) are rendered by oshell-logdump.
+ */
+
+//Handler for getcwd()
+void handleCWDError() {
+    printf("ERROR: Could not obtain working directory, see log for details.\n");
+    logEvent(EVENT_ERROR, CALL_GETCWD, errno, 0, 0);
+}
+
+//Handler for chdir()
+void handleChDirError() {
+    printf("ERROR: Cannot change directory, see log for more details.\n");
+    logEvent(EVENT_ERROR, CALL_CHDIR, errno, 0, 0);
+}
+
+//Handler for read()
+void handleReadError() {
+    printf("ERROR: Cannot take input, see log for more details\n");
+    logEvent(EVENT_ERROR, CALL_READ, errno, 0, 0);
+}
+
+//Handler for epoll_create1(), epoll_ctl() and epoll_wait()
+void handleEpollError() {
+    printf("ERROR: Cannot wait for events, see log for more details\n");
+    logEvent(EVENT_ERROR, CALL_EPOLL, errno, 0, 0);
+}
+
+//Handler for signalfd()
+void handleSignalFdError() {
+    printf("ERROR: Cannot receive signals, see log for more details\n");
+    logEvent(EVENT_ERROR, CALL_SIGNALFD, errno, 0, 0);
+}
+
+//Handler for getlogin()
+void handleGetLoginError() {
+    printf("ERROR: Cannot get user details, see log for more details\n");
+    logEvent(EVENT_ERROR, CALL_GETLOGIN, errno, 0, 0);
+}
+
+//Handler for posix_spawn()
+void handleExecError() {
+    printf("ERROR: Cannot run executable, see log for more details\n");
+    logEvent(EVENT_ERROR, CALL_POSIX_SPAWN, errno, 0, 0);
+}
+
+//Handler for open()
+void handleOpenError(const char* path) {
+    printf("ERROR: Cannot open %s, see log for more details\n", path);
+    logEvent(EVENT_ERROR, CALL_OPEN, errno, 0, 0);
+}
+
+//Handler for mmap()
+void handleMmapError() {
+    printf("ERROR: Cannot map file into memory, see log for more details\n");
+    logEvent(EVENT_ERROR, CALL_MMAP, errno, 0, 0);
+}
+
+//Handler for sched_setaffinity()
+void handleAffinityError() {
+    printf("ERROR: Cannot place command on its CPUs, see log for more details\n");
+    logEvent(EVENT_ERROR, CALL_SCHED_SETAFFINITY, errno, 0, 0);
+}
+
+//Handler for socket(), bind() and listen()
+void handleSocketError(const char* path) {
+    printf("ERROR: Cannot listen on %s, see log for more details\n", path);
+    logEvent(EVENT_ERROR, CALL_SOCKET, errno, 0, 0);
+}
+
+/*---------------------------------------------End of error handling section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of metrics section---------------------------------------------*/
+/*
+ * Latencies of the shell's hot paths are recorded in HDR-style histograms: a value falls in one of
+ * 2^HISTOGRAM_SUB_BITS linear buckets within its power of two, so any value from a tick to hours is recorded with a
+ * bounded relative error by an increment. Values are taken in ticks of the time stamp counter where there is one,
+ * which is read in a few cycles instead of a clock_gettime() call, and converted to seconds when they are reported.
+ * The stats built-in summarizes the histograms. A snapshot in Prometheus text format is written to the file named by
+ * $OSHELL_METRICS_FILE when the shell exits and when it receives SIGUSR1.
+ */
+
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((65 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB)
+
+typedef enum Metric {
+    METRIC_PARSE,
+    METRIC_EXPAND,
+    METRIC_SPAWN,
+    METRIC_CHILD,
+    METRIC_REAP,
+    METRIC_MAX
+} Metric;
+
+typedef struct Histogram {
+    const char* name;           //Name of the Prometheus metric.
+    const char* help;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+Histogram histograms[METRIC_MAX] = {
+    {"oshell_parse_duration_seconds", "Time taken to parse a command line, variable expansion included."},
+    {"oshell_expand_duration_seconds", "Time spent expanding variables, per command line with variables."},
+    {"oshell_spawn_duration_seconds", "Time taken to start a process with posix_spawn() or fork()."},
+    {"oshell_child_duration_seconds", "Wall time of child processes, from their start to their reaping."},
+    {"oshell_reap_delay_seconds", "Time from the event loop waking up on SIGCHLD to the child being reaped."},
+};
+
+uint64_t lineCount = 0;         //Command lines run.
+uint64_t spawnCount = 0;        //Processes the shell tried to start.
+uint64_t spawnFailures = 0;     //Processes that could not be started, executables not found included.
+
+uint64_t loopWakeTicks = 0;     //Time the event loop last woke up.
+uint64_t tickOrigin = 0;        //Ticks and nanoseconds at start-up, to convert ticks to time.
+uint64_t tickOriginNs = 0;
+
+/*
+ * Function to read the monotonic clock in nanoseconds.
+ */
+uint64_t monotonicNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Function to read the tick counter latencies are measured with.
+ */
+uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonicNs();
+#endif
+}
+
+/*
+ * Function to compute the length of a tick in seconds, from the ticks and time elapsed since start-up.
+ */
+double tickSeconds() {
+    uint64_t ticks = readTicks() - tickOrigin;
+    uint64_t ns = monotonicNs() - tickOriginNs;
+    return (ticks > 0 && ns > 0) ? ns / 1e9 / ticks : 1e-9;
+}
+
+/*
+ * Function to record a latency, in ticks.
+ */
+void recordLatency(Metric metric, uint64_t ticks) {
+    Histogram* histogram = &histograms[metric];
+    size_t bucket = ticks;
+    if(ticks >= HISTOGRAM_SUB) {
+        int shift = 63 - __builtin_clzll(ticks) - HISTOGRAM_SUB_BITS;
+        bucket = (size_t) (shift + 1) * HISTOGRAM_SUB + (ticks >> shift) - HISTOGRAM_SUB;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum += ticks;
+    if(ticks > histogram->max) histogram->max = ticks;
+}
+
+/*
+ * Function to compute the largest value that falls in a bucket of a histogram, in ticks.
+ */
+uint64_t bucketLimit(size_t bucket) {
+    if(bucket < HISTOGRAM_SUB) return bucket;
+    int shift = bucket / HISTOGRAM_SUB - 1;
+    uint64_t low = (uint64_t) (HISTOGRAM_SUB + bucket % HISTOGRAM_SUB) << shift;
+    return low + ((1ULL << shift) - 1);
+}
+
+/*
+ * Function to find the value below which a share of the values of a histogram fall, in ticks.
+ */
+uint64_t histogramPercentile(Histogram* histogram, double share) {
+    uint64_t rank = (uint64_t) (share * histogram->count);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if(seen > rank) return (bucketLimit(i) < histogram->max) ? bucketLimit(i) : histogram->max;
+    }
+    return histogram->max;
+}
+
+/*
+ * Function to write a duration with a unit suited to its size.
+ */
+void formatDuration(double seconds, char* buffer, size_t size) {
+    if(seconds < 1e-6) {
+        snprintf(buffer, size, "%.0fns", seconds * 1e9);
+    } else if(seconds < 1e-3) {
+        snprintf(buffer, size, "%.1fus", seconds * 1e6);
+    } else if(seconds < 1) {
+        snprintf(buffer, size, "%.2fms", seconds * 1e3);
+    } else {
+        snprintf(buffer, size, "%.2fs", seconds);
+    }
+}
+
+/*
+ * Function to print a summary of the histograms and counters (for the stats built-in).
+ */
+void printMetrics(int outFd) {
+    double tick = tickSeconds();
+    dprintf(outFd, "%-32s %10s %10s %10s %10s %10s %10s\n", "metric", "count", "mean", "p50", "p90", "p99", "max");
+    for(int i = 0; i < METRIC_MAX; i++) {
+        Histogram* histogram = &histograms[i];
+        double values[5] = {0};
+        if(histogram->count > 0) {
+            values[0] = (double) histogram->sum / histogram->count;
+            values[1] = histogramPercentile(histogram, 0.5);
+            values[2] = histogramPercentile(histogram, 0.9);
+            values[3] = histogramPercentile(histogram, 0.99);
+            values[4] = histogram->max;
+        }
+        char texts[5][16];
+        for(int j = 0; j < 5; j++) {
+            formatDuration(values[j] * tick, texts[j], sizeof(texts[j]));
+        }
+        dprintf(outFd, "%-32s %10lu %10s %10s %10s %10s %10s\n", histogram->name, (unsigned long) histogram->count,
+                texts[0], texts[1], texts[2], texts[3], texts[4]);
+    }
+    dprintf(outFd, "lines %lu, spawns %lu, spawn failures %lu (%.1f%%)\n", (unsigned long) lineCount,
+            (unsigned long) spawnCount, (unsigned long) spawnFailures,
+            (spawnCount > 0) ? 100.0 * spawnFailures / spawnCount : 0.0);
+}
+
+/*
+ * Function to clear the histograms and counters.
+ */
+void resetMetrics() {
+    for(int i = 0; i < METRIC_MAX; i++) {
+        histograms[i].count = 0;
+        histograms[i].sum = 0;
+        histograms[i].max = 0;
+        memset(histograms[i].buckets, 0, sizeof(histograms[i].buckets));
+    }
+    lineCount = 0;
+    spawnCount = 0;
+    spawnFailures = 0;
+}
+
+/*
+ * Function to write a histogram in Prometheus text format, with buckets at 1, 2.5 and 5 times each power of ten from
+ * a microsecond to a hundred seconds.
+ */
+void writeHistogram(FILE* file, Histogram* histogram, double tick) {
+    fprintf(file, "# HELP %s %s\n# TYPE %s histogram\n", histogram->name, histogram->help, histogram->name);
+    uint64_t cumulative = 0;
+    size_t bucket = 0;
+    for(double decade = 1e-6; decade < 1e3; decade *= 10) {
+        const double steps[3] = {1, 2.5, 5};
+        for(int i = 0; i < 3 && decade * steps[i] <= 100; i++) {
+            double limit = decade * steps[i];
+            while(bucket < HISTOGRAM_BUCKETS && bucketLimit(bucket) * tick <= limit) {
+                cumulative += histogram->buckets[bucket++];
+            }
+            fprintf(file, "%s_bucket{le=\"%g\"} %lu\n", histogram->name, limit, (unsigned long) cumulative);
+        }
+    }
+    fprintf(file, "%s_bucket{le=\"+Inf\"} %lu\n", histogram->name, (unsigned long) histogram->count);
+    fprintf(file, "%s_sum %.9f\n%s_count %lu\n", histogram->name, histogram->sum * tick, histogram->name,
+            (unsigned long) histogram->count);
+}
+
+/*
+ * Function to write a snapshot of the metrics in Prometheus text format to $OSHELL_METRICS_FILE, if it is set.
+ * The snapshot is written to a temporary file renamed over the previous one, so a scraper never reads it half written.
+ */
+void writeMetrics() {
+    const char* path = getVarValue(&shellVars, "OSHELL_METRICS_FILE");
+    if(path == NULL || path[0] == '\0') return;
+
+    char tempPath[DIR_MAX + 16];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path);
+    int fd = mkostemp(tempPath, O_CLOEXEC);
+    if(fd == -1) {
+        handleOpenError(tempPath);
+        return;
+    }
+    fchmod(fd, 0644);
+    FILE* file = fdopen(fd, "w");
+    double tick = tickSeconds();
+    for(int i = 0; i < METRIC_MAX; i++) {
+        writeHistogram(file, &histograms[i], tick);
+    }
+    fprintf(file, "# HELP oshell_lines_total Command lines run.\n# TYPE oshell_lines_total counter\n"
+                  "oshell_lines_total %lu\n", (unsigned long) lineCount);
+    fprintf(file, "# HELP oshell_spawns_total Processes the shell tried to start.\n# TYPE oshell_spawns_total counter\n"
+                  "oshell_spawns_total %lu\n", (unsigned long) spawnCount);
+    fprintf(file, "# HELP oshell_spawn_failures_total Processes that could not be started.\n"
+                  "# TYPE oshell_spawn_failures_total counter\noshell_spawn_failures_total %lu\n",
+            (unsigned long) spawnFailures);
+    if(fclose(file) != 0 || rename(tempPath, path) == -1) {
+        handleOpenError(path);
+        unlink(tempPath);
+    }
+}
+
+/*
+ * Function to start measuring time, and have the metrics written when the shell exits.
+ */
+void initMetrics() {
+    tickOrigin = readTicks();
+    tickOriginNs = monotonicNs();
+    atexit(writeMetrics);
+}
+
+/*---------------------------------------------End of metrics section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of event loop section---------------------------------------------*/
+/*
+ * The shell waits for everything (input on stdin, terminated children, and later any other descriptor) in one epoll
+ * loop. Each watched descriptor has a handler called when it becomes ready; signals are received as readable
+ * descriptors through signalfd() instead of asynchronous handlers.
+ * When nothing happens for LOG_IDLE_MS the buffered log records are written out.
+ */
+
+typedef void (*EventHandler)(int fd, uint32_t events, void* data);
+
+typedef struct EventSource {
+    EventHandler handler;
+    void* data;
+} EventSource;
+
+int epollFd = -1;
+int signalFd = -1;
+sigset_t shellSignals;          //Signals blocked in the shell and read from signalFd instead.
+EventSource* eventSources = NULL;   //Indexed by file descriptor.
+int eventSourceMax = 0;
+
+/*
+ * Function to start watching a file descriptor.
+ * Returns 0 on success, -1 on error (with errno set, e.g. EPERM for regular files, which are always ready).
+ */
+int eventLoopAdd(int fd, uint32_t events, EventHandler handler, void* data) {
+    if(fd >= eventSourceMax) {
+        int newMax = (fd + 1 > 2 * eventSourceMax) ? fd + 1 : 2 * eventSourceMax;
+        eventSources = realloc(eventSources, newMax * sizeof(EventSource));
+        memset(eventSources + eventSourceMax, 0, (newMax - eventSourceMax) * sizeof(EventSource));
+        eventSourceMax = newMax;
+    }
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    if(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) return -1;
+    eventSources[fd].handler = handler;
+    eventSources[fd].data = data;
+    return 0;
+}
+
+/*
+ * Function to change the events watched on a file descriptor (also re-arms EPOLLONESHOT descriptors).
+ */
+void eventLoopModify(int fd, uint32_t events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    if(epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == -1) handleEpollError();
+}
+
+/*
+ * Function to stop watching a file descriptor, must be called before it is closed.
+ */
+void eventLoopRemove(int fd) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+    eventSources[fd].handler = NULL;
+    eventSources[fd].data = NULL;
+}
+
+/*
+ * Function to wait for events and call the handlers of the ready descriptors.
+ * Waits for at most timeoutMs milliseconds, or indefinitely if timeoutMs is -1.
+ */
+void eventLoopWait(int timeoutMs) {
+    struct epoll_event events[EVENT_BATCH];
+    int logPending = logHasRecords();
+    if(logPending && (timeoutMs < 0 || timeoutMs > LOG_IDLE_MS)) timeoutMs = LOG_IDLE_MS;
+
+    int eventNum = epoll_wait(epollFd, events, EVENT_BATCH, timeoutMs);
+    loopWakeTicks = readTicks();
+    if(eventNum == -1) {
+        if(errno != EINTR) handleEpollError();
+        return;
+    }
+    if(eventNum == 0 && logPending) logFlush();
+
+    for(int i = 0; i < eventNum; i++) {
+        int fd = events[i].data.fd;
+        //A handler earlier in the batch may have removed this descriptor.
+        if(eventSources[fd].handler != NULL) {
+            eventSources[fd].handler(fd, events[i].events, eventSources[fd].data);
+        }
+    }
+}
+
+/*---------------------------------------------End of event loop section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of timer wheel section---------------------------------------------*/
+/*
+ * Deadlines are kept in a hierarchical timer wheel driven by a single timerfd, so that adding, cancelling and expiring
+ * a timer costs O(1) however many are pending. Time is counted in ticks of TIMER_TICK_MS. Level 0 has a slot for each
+ * of the next 64 ticks, a slot of level 1 spans 64 ticks, of level 2 64 * 64 ticks, and so on: a timer goes to the
+ * lowest level whose span reaches its expiry, and when the wheel gets to a slot of a higher level its timers are placed
+ * again into the levels below. A bit per slot says which slots hold timers, so the next tick at which anything happens
+ * is found with a bit scan per level, and the timerfd is armed for that tick only: the shell is not woken at each tick.
+ */
+
+Timer* timerSlots[TIMER_LEVELS][64];
+uint64_t timerMasks[TIMER_LEVELS];  //Bit n set if slot n of the level holds timers.
+uint64_t timerNow = 0;              //Tick the wheel was advanced to, whose timers have expired.
+uint64_t timerArmed = UINT64_MAX;   //Tick the timerfd is armed for, UINT64_MAX if it is not armed.
+int timerFd = -1;
+int timerNum = 0;
+
+/*
+ * Function to read the monotonic clock in ticks.
+ */
+uint64_t currentTick() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000) / TIMER_TICK_MS;
+}
+
+/*
+ * Function to put a timer in the slot its expiry falls in, at the earliest at tick earliest.
+ * Timers beyond the span of the last level wait in its farthest slot, and are placed again when it is reached.
+ */
+void placeTimer(Timer* timer, uint64_t earliest) {
+    uint64_t expiry = (timer->expiry > earliest) ? timer->expiry : earliest;
+    uint64_t span = (uint64_t) 1 << (6 * TIMER_LEVELS);
+    if(expiry - timerNow >= span) expiry = timerNow + span - 1;
+    int level = 0;
+    while(expiry - timerNow >= (uint64_t) 1 << (6 * (level + 1))) {
+        level++;
+    }
+    int slot = (expiry >> (6 * level)) & 63;
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->previous = NULL;
+    timer->next = timerSlots[level][slot];
+    if(timer->next != NULL) timer->next->previous = timer;
+    timerSlots[level][slot] = timer;
+    timerMasks[level] |= (uint64_t) 1 << slot;
+}
+
+/*
+ * Function to take a timer out of its slot.
+ */
+void unlinkTimer(Timer* timer) {
+    if(timer->previous != NULL) {
+        timer->previous->next = timer->next;
+    } else {
+        timerSlots[timer->level][timer->slot] = timer->next;
+        if(timer->next == NULL) timerMasks[timer->level] &= ~((uint64_t) 1 << timer->slot);
+    }
+    if(timer->next != NULL) timer->next->previous = timer->previous;
+}
+
+/*
+ * Function to find the next tick at which timers expire or a slot of a higher level must be placed again.
+ * Returns the tick, UINT64_MAX if no timer is pending.
+ */
+uint64_t nextTimerTick() {
+    uint64_t next = UINT64_MAX;
+    for(int level = 0; level < TIMER_LEVELS; level++) {
+        if(timerMasks[level] == 0) continue;
+        //Rotate the slots so that bit 0 is the one after the current slot of the level.
+        int shift = 6 * level;
+        int rotation = ((timerNow >> shift) + 1) & 63;
+        uint64_t mask = timerMasks[level];
+        uint64_t rotated = (rotation == 0) ? mask : (mask >> rotation) | (mask << (64 - rotation));
+        uint64_t distance = __builtin_ctzll(rotated) + 1;
+        uint64_t tick = (level == 0) ? timerNow + distance : ((timerNow >> shift) + distance) << shift;
+        if(tick < next) next = tick;
+    }
+    return next;
+}
+
+/*
+ * Function to arm the timerfd for the next tick at which something happens, if it changed.
+ */
+void armTimers() {
+    uint64_t next = nextTimerTick();
+    if(next == timerArmed) return;
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if(next != UINT64_MAX) {
+        uint64_t ms = next * TIMER_TICK_MS;
+        spec.it_value.tv_sec = ms / 1000;
+        spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+    }
+    timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL);
+    timerArmed = next;
+}
+
+/*
+ * Function to advance the wheel to a tick, expiring the timers on the way. Ticks at which nothing happens are skipped.
+ * Expired timers are taken out of the wheel before their callback is called, which may start timers again.
+ */
+void advanceTimers(uint64_t target) {
+    uint64_t tick = 0;
+    while((tick = nextTimerTick()) <= target) {
+        timerNow = tick;
+        //Higher levels first, so that timers placed into a level that is due at this tick too are placed again.
+        for(int level = TIMER_LEVELS - 1; level > 0; level--) {
+            if((tick & (((uint64_t) 1 << (6 * level)) - 1)) != 0) continue;
+            int slot = (tick >> (6 * level)) & 63;
+            Timer* timer = timerSlots[level][slot];
+            timerSlots[level][slot] = NULL;
+            timerMasks[level] &= ~((uint64_t) 1 << slot);
+            while(timer != NULL) {
+                Timer* next = timer->next;
+                placeTimer(timer, tick);
+                timer = next;
+            }
+        }
+        Timer** slot = &timerSlots[0][tick & 63];
+        while(*slot != NULL) {
+            Timer* timer = *slot;
+            unlinkTimer(timer);
+            timer->pending = 0;
+            timerNum--;
+            timer->callback(timer, timer->data);
+        }
+    }
+    if(target > timerNow) timerNow = target;
+}
+
+/*
+ * Function called by the event loop when the timerfd expires.
+ */
+void handleTimers(int fd, uint32_t events, void* data) {
+    uint64_t expirations = 0;
+    if(read(fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) return;
+    timerArmed = UINT64_MAX;
+    advanceTimers(currentTick());
+    armTimers();
+}
+
+/*
+ * Function to stop a timer if it is pending.
+ * The timerfd stays armed, waking the shell up once for nothing at worst.
+ */
+void cancelTimer(Timer* timer) {
+    if(!timer->pending) return;
+    unlinkTimer(timer);
+    timer->pending = 0;
+    timerNum--;
+}
+
+/*
+ * Function to start a timer calling callback with data once delayMs milliseconds have passed, which is restarted if
+ * it is pending. Creates the timerfd the first time.
+ */
+void startTimer(Timer* timer, uint64_t delayMs, TimerCallback callback, void* data) {
+    if(timerFd == -1) {
+        timerFd = keepFdHigh(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+        if(timerFd == -1 || eventLoopAdd(timerFd, EPOLLIN, handleTimers, NULL) == -1) {
+            handleEpollError();
+            if(timerFd != -1) close(timerFd);
+            timerFd = -1;
+            return;
+        }
+    }
+    cancelTimer(timer);
+
+    //The wheel may be moved forward to the current tick as long as nothing was due before it.
+    uint64_t now = currentTick();
+    uint64_t next = nextTimerTick();
+    uint64_t reached = (next > now) ? now : next - 1;
+    if(reached > timerNow) timerNow = reached;
+
+    struct timespec clock;
+    clock_gettime(CLOCK_MONOTONIC, &clock);
+    uint64_t ms = (uint64_t) clock.tv_sec * 1000 + clock.tv_nsec / 1000000 + delayMs;
+    timer->expiry = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    timer->callback = callback;
+    timer->data = data;
+    timer->pending = 1;
+    timerNum++;
+    placeTimer(timer, timerNow + 1);
+    armTimers();
+}
+
+/*
+ * Function to drop every timer, in a forked copy of the shell whose timers belong to the shell.
+ */
+void resetTimers() {
+    for(int level = 0; level < TIMER_LEVELS; level++) {
+        for(int slot = 0; slot < 64; slot++) {
+            for(Timer* timer = timerSlots[level][slot]; timer != NULL; timer = timer->next) {
+                timer->pending = 0;
+            }
+            timerSlots[level][slot] = NULL;
+        }
+        timerMasks[level] = 0;
+    }
+    timerNum = 0;
+    timerArmed = UINT64_MAX;
+    if(timerFd != -1) close(timerFd);
+    timerFd = -1;
+}
+
+/*---------------------------------------------End of timer wheel section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of variable store section---------------------------------------------*/
+/*
+ * Shell and exported variables live in an open-addressing hash table, so expanding a reference costs one hash and
+ * usually one probe instead of a scan of the environment.
+ * Each variable is stored as a single "NAME=value" string, the form it takes in the environment of a command, and the
+ * envp array handed to posix_spawn() is made of pointers to these strings. It is only rebuilt when an exported
+ * variable changes, so starting a command does not copy the environment.
+ */
+
+VarTable shellVars;
+
+/*
+ * Function to compute the FNV-1a hash of length bytes.
+ */
+unsigned int hashBytes(const char* bytes, size_t length) {
+    unsigned int hash = 2166136261u;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Function to find the slot of a variable, or the empty slot where it would be added.
+ */
+Variable* findVarSlot(VarTable* table, const char* name, size_t nameLength, unsigned int hash) {
+    size_t mask = table->capacity - 1;
+    for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+        Variable* slot = &table->slots[i];
+        if(slot->entry == NULL) return slot;
+        if(slot->hash == hash && slot->nameLength == nameLength && memcmp(slot->entry, name, nameLength) == 0) {
+            return slot;
+        }
+    }
+}
+
+/*
+ * Function to double the capacity of a table, keeping it at most 3/4 full.
+ */
+void growVarTable(VarTable* table) {
+    Variable* oldSlots = table->slots;
+    size_t oldCapacity = table->capacity;
+    table->capacity = (oldCapacity == 0) ? 64 : 2 * oldCapacity;
+    table->slots = calloc(table->capacity, sizeof(Variable));
+    for(size_t i = 0; i < oldCapacity; i++) {
+        if(oldSlots[i].entry != NULL) {
+            *findVarSlot(table, oldSlots[i].entry, oldSlots[i].nameLength, oldSlots[i].hash) = oldSlots[i];
+        }
+    }
+    free(oldSlots);
+}
+
+/*
+ * Function to set a variable, adding it if it does not exist.
+ * An existing variable stays exported, a new one is exported if export is non-zero.
+ * Returns the variable.
+ */
+Variable* setVar(VarTable* table, const char* name, size_t nameLength, const char* value, size_t valueLength, int export) {
+    if(4 * (table->count + 1) > 3 * table->capacity) growVarTable(table);
+    unsigned int hash = hashBytes(name, nameLength);
+    Variable* variable = findVarSlot(table, name, nameLength, hash);
+    if(variable->entry == NULL) {
+        variable->nameLength = nameLength;
+        variable->hash = hash;
+        variable->exported = 0;
+        table->count++;
+    }
+    char* entry = malloc(nameLength + valueLength + 2);
+    memcpy(entry, name, nameLength);
+    entry[nameLength] = '=';
+    memcpy(entry + nameLength + 1, value, valueLength);
+    entry[nameLength + valueLength + 1] = '\0';
+    free(variable->entry);
+    variable->entry = entry;
+    if(export) variable->exported = 1;
+    if(variable->exported) table->envpStale = 1;
+    return variable;
+}
+
+/*
+ * Function to get a variable.
+ * Returns the variable, NULL if it is not set.
+ */
+Variable* getVar(VarTable* table, const char* name, size_t nameLength) {
+    if(table->count == 0) return NULL;
+    Variable* variable = findVarSlot(table, name, nameLength, hashBytes(name, nameLength));
+    return (variable->entry != NULL) ? variable : NULL;
+}
+
+/*
+ * Function to get the value of a variable.
+ * Returns the value, NULL if the variable is not set.
+ */
+const char* getVarValue(VarTable* table, const char* name) {
+    size_t nameLength = strlen(name);
+    Variable* variable = getVar(table, name, nameLength);
+    return (variable != NULL) ? variable->entry + nameLength + 1 : NULL;
+}
+
+/*
+ * Function to mark a variable as exported, an unset variable is exported with an empty value.
+ */
+void exportVar(VarTable* table, const char* name, size_t nameLength) {
+    Variable* variable = getVar(table, name, nameLength);
+    if(variable == NULL) {
+        setVar(table, name, nameLength, "", 0, 1);
+    } else if(!variable->exported) {
+        variable->exported = 1;
+        table->envpStale = 1;
+    }
+}
+
+/*
+ * Function to get the environment for commands, rebuilding it if exported variables changed since the last call.
+ * The array stays valid until the next change.
+ */
+char** varEnvironment(VarTable* table) {
+    if(!table->envpStale && table->envp != NULL) return table->envp;
+    if(table->envpSize < table->count + 1) {
+        table->envpSize = table->capacity;
+        table->envp = realloc(table->envp, table->envpSize * sizeof(char*));
+    }
+    size_t envNum = 0;
+    for(size_t i = 0; i < table->capacity; i++) {
+        if(table->slots[i].entry != NULL && table->slots[i].exported) table->envp[envNum++] = table->slots[i].entry;
+    }
+    table->envp[envNum] = NULL;
+    table->envpStale = 0;
+    return table->envp;
+}
+
+/*
+ * Function to fill a table with the variables of an environment, all of them exported.
+ */
+void loadVarTable(VarTable* table, char** environment) {
+    for(char** entry = environment; *entry != NULL; entry++) {
+        char* separator = strchr(*entry, '=');
+        if(separator == NULL) continue;
+        setVar(table, *entry, separator - *entry, separator + 1, strlen(separator + 1), 1);
+    }
+}
+
+/*
+ * Function to free every variable of a table, leaving it empty.
+ */
+void freeVarTable(VarTable* table) {
+    for(size_t i = 0; i < table->capacity; i++) {
+        free(table->slots[i].entry);
+    }
+    free(table->slots);
+    free(table->envp);
+    memset(table, 0, sizeof(VarTable));
+}
+
+/*
+ * Function to check whether a word is a variable assignment (NAME=value).
+ * Returns the length of the name, 0 if the word is not an assignment.
+ */
+size_t assignmentNameLength(const char* word) {
+    if(!isalpha((unsigned char) word[0]) && word[0] != '_') return 0;
+    size_t length = 1;
+    while(isalnum((unsigned char) word[length]) || word[length] == '_') {
+        length++;
+    }
+    return (word[length] == '=') ? length : 0;
+}
+
+/*---------------------------------------------End of variable store section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of command hash section---------------------------------------------*/
+/*
+ * The following functions maintain a table mapping command names to the absolute path they resolve to in $PATH,
+ * so a command is searched for once and then launched directly (same idea as bash's hash builtin).
+ * An entry remembers which PATH directory it was found in, and is only trusted while that directory and every
+ * directory searched before it keep their modification time, since a new file in an earlier directory would shadow it.
+ */
+
+typedef struct HashEntry {
+    char* name;
+    char* path;
+    int dirIndex;               //Index in pathDirs of the directory the command was found in.
+    unsigned long hits;
+    struct HashEntry* next;
+} HashEntry;
+
+typedef struct PathDir {
+    char* path;
+    struct timespec mtime;
+} PathDir;
+
+HashEntry* commandHash[HASH_BUCKETS];
+PathDir* pathDirs = NULL;
+int pathDirNum = -1;            //-1 until $PATH has been split into pathDirs.
+unsigned long hashHits = 0;
+unsigned long hashMisses = 0;
+
+/*
+ * Function to split $PATH into pathDirs and record the modification time of every directory.
+ */
+void loadPathDirs() {
+    const char* pathVar = getVarValue(&shellVars, "PATH");
+    if(pathVar == NULL) pathVar = "/bin:/usr/bin";
+
+    //Count components to size the array.
+    pathDirNum = 1;
+    for(const char* c = pathVar; *c != '\0'; c++) {
+        if(*c == ':') pathDirNum++;
+    }
+    pathDirs = malloc(pathDirNum * sizeof(PathDir));
+
+    const char* start = pathVar;
+    for(int i = 0; i < pathDirNum; i++) {
+        const char* end = strchr(start, ':');
+        size_t length = (end == NULL) ? strlen(start) : (size_t) (end - start);
+
+        //An empty component means the current directory.
+        if(length == 0) {
+            pathDirs[i].path = strdup(".");
+        } else {
+            pathDirs[i].path = strndup(start, length);
+        }
+
+        struct stat info;
+        if(stat(pathDirs[i].path, &info) == 0) {
+            pathDirs[i].mtime = info.st_mtim;
+        } else {
+            pathDirs[i].mtime.tv_sec = 0;
+            pathDirs[i].mtime.tv_nsec = 0;
+        }
+        start = end + 1;
+    }
+}
+
+/*
+ * Function to empty the command hash table, called when $PATH changes or a PATH directory is modified.
+ */
+void clearCommandHash() {
+    for(int i = 0; i < HASH_BUCKETS; i++) {
+        HashEntry* entry = commandHash[i];
+        while(entry != NULL) {
+            HashEntry* next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        commandHash[i] = NULL;
+    }
+    for(int i = 0; i < pathDirNum; i++) {
+        free(pathDirs[i].path);
+    }
+    free(pathDirs);
+    pathDirs = NULL;
+    pathDirNum = -1;
+}
+
+/*
+ * Function to check whether any of the first dirNum PATH directories was modified since it was loaded.
+ * Returns 1 if a directory changed, 0 else.
+ */
+int pathDirsChanged(int dirNum) {
+    struct stat info;
+    for(int i = 0; i < dirNum; i++) {
+        if(stat(pathDirs[i].path, &info) == -1) {
+            info.st_mtim.tv_sec = 0;
+            info.st_mtim.tv_nsec = 0;
+        }
+        if(info.st_mtim.tv_sec != pathDirs[i].mtime.tv_sec || info.st_mtim.tv_nsec != pathDirs[i].mtime.tv_nsec) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function to resolve a command name to the path of its executable.
+ * Names containing a '/' are returned unchanged.
+ * Returns NULL if the command cannot be found in $PATH.
+ */
+const char* lookupCommand(const char* name) {
+    if(strchr(name, '/') != NULL) return name;
+    if(pathDirNum == -1) loadPathDirs();
+
+    unsigned int bucket = hashBytes(name, strlen(name)) % HASH_BUCKETS;
+    for(HashEntry* entry = commandHash[bucket]; entry != NULL; entry = entry->next) {
+        if(strcmp(entry->name, name) == 0) {
+            if(!pathDirsChanged(entry->dirIndex + 1)) {
+                hashHits++;
+                entry->hits++;
+                return entry->path;
+            }
+            //A directory changed, start again from an empty table.
+            clearCommandHash();
+            loadPathDirs();
+            break;
+        }
+    }
+
+    //Not cached, search every PATH directory in order.
+    hashMisses++;
+    for(int i = 0; i < pathDirNum; i++) {
+        char* path = malloc(strlen(pathDirs[i].path) + strlen(name) + 2);
+        sprintf(path, "%s/%s", pathDirs[i].path, name);
+
+        struct stat info;
+        if(stat(path, &info) == 0 && S_ISREG(info.st_mode) && access(path, X_OK) == 0) {
+            HashEntry* entry = malloc(sizeof(HashEntry));
+            entry->name = strdup(name);
+            entry->path = path;
+            entry->dirIndex = i;
+            entry->hits = 0;
+            entry->next = commandHash[bucket];
+            commandHash[bucket] = entry;
+            return path;
+        }
+        free(path);
+    }
+    return NULL;
+}
+
+/*---------------------------------------------End of command hash section---------------------------------------------*/
+
+/*
+ * Function to log the termination of a child process.
+ */
+void writeReapingMsg(pid_t childID, int status) {
+    logEvent(EVENT_REAP, CALL_NONE, status, childID, 0);
+}
+
+/*---------------------------------------------Beginning of CPU placement section---------------------------------------------*/
+/*
+ * Background jobs can be placed on CPUs by a policy set with "set -o placement=...": "roundrobin" gives each process
+ * the next CPU the shell may run on, "leastloaded" the CPU that was least busy according to /proc/stat, and "node:N"
+ * the CPUs of NUMA node N with its memory preferred. A command prefixed with "@cpu=LIST" (such as "@cpu=0,4-7") runs
+ * on the CPUs listed, in the foreground or the background.
+ * posix_spawn() has no attribute for affinity, so the shell moves itself to the chosen CPUs while it starts the
+ * process, which inherits them, and moves back right after. The CPUs are recorded in the job and the event log.
+ */
+
+typedef enum PlacementPolicy {
+    PLACE_NONE,
+    PLACE_ROUND_ROBIN,
+    PLACE_LEAST_LOADED,
+    PLACE_NODE
+} PlacementPolicy;
+
+typedef struct Placement {
+    cpu_set_t saved;            //CPUs the shell runs on, restored once the process is created.
+    cpu_set_t cpus;             //CPUs chosen for the process.
+    int node;                   //NUMA node its memory is preferred on, -1 if none.
+} Placement;
+
+PlacementPolicy placementPolicy = PLACE_NONE;
+int placementNode = 0;          //NUMA node of the node policy.
+int nextCpu = 0;                //Next CPU tried by the round robin policy.
+
+//Per CPU time counters of the last sample of /proc/stat, and the load measured between the last two samples.
+unsigned long long cpuBusy[CPU_SETSIZE];
+unsigned long long cpuTotal[CPU_SETSIZE];
+double cpuLoad[CPU_SETSIZE];
+struct timespec lastCpuSample;
+
+/*
+ * Function to parse a CPU list ("0,2,4-7", as used by taskset and sysfs) into a CPU set.
+ * Returns 0 on success, -1 if the list is malformed or names a CPU beyond CPU_SETSIZE.
+ */
+int parseCpuList(const char* list, cpu_set_t* set) {
+    CPU_ZERO(set);
+    const char* cursor = list;
+    while(*cursor != '\0' && *cursor != '\n') {
+        char* end;
+        long first = strtol(cursor, &end, 10);
+        long last = first;
+        if(end == cursor || first < 0) return -1;
+        if(*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if(end == cursor || last < first) return -1;
+        }
+        if(last >= CPU_SETSIZE) return -1;
+        for(long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        cursor = end;
+        if(*cursor == ',') {
+            cursor++;
+        } else if(*cursor != '\0' && *cursor != '\n') {
+            return -1;
+        }
+    }
+    return (CPU_COUNT(set) > 0) ? 0 : -1;
+}
+
+/*
+ * Function to write a CPU set as a CPU list, with ranges for consecutive CPUs.
+ */
+void formatCpuList(const cpu_set_t* set, char* buffer, size_t size) {
+    size_t used = 0;
+    buffer[0] = '\0';
+    for(int cpu = 0; cpu < CPU_SETSIZE && used < size; cpu++) {
+        if(!CPU_ISSET(cpu, set)) continue;
+        int last = cpu;
+        while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) {
+            last++;
+        }
+        const char* separator = (used > 0) ? "," : "";
+        if(last == cpu) {
+            used += snprintf(buffer + used, size - used, "%s%d", separator, cpu);
+        } else {
+            used += snprintf(buffer + used, size - used, "%s%d-%d", separator, cpu, last);
+        }
+        cpu = last;
+    }
+}
+
+/*
+ * Function to sample the CPU time counters of /proc/stat, at most every LOAD_SAMPLE_MS, and update the load of
+ * each CPU: the share of its time spent busy since the previous sample.
+ */
+void sampleCpuLoad() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long elapsed = (now.tv_sec - lastCpuSample.tv_sec) * 1000LL + (now.tv_nsec - lastCpuSample.tv_nsec) / 1000000;
+    if(lastCpuSample.tv_sec != 0 && elapsed < LOAD_SAMPLE_MS) return;
+    lastCpuSample = now;
+
+    FILE* stat = fopen("/proc/stat", "re");
+    if(stat == NULL) return;
+    char line[512];
+    while(fgets(line, sizeof(line), stat) != NULL) {
+        unsigned int cpu;
+        unsigned long long user, nice, system, idle, ioWait, irq, softIrq, steal;
+        if(strncmp(line, "cpu", 3) != 0) break;
+        if(sscanf(line, "cpu%u %llu %llu %llu %llu %llu %llu %llu %llu", &cpu, &user, &nice, &system, &idle, &ioWait,
+                  &irq, &softIrq, &steal) != 9 || cpu >= CPU_SETSIZE) continue;
+        unsigned long long busy = user + nice + system + irq + softIrq + steal;
+        unsigned long long total = busy + idle + ioWait;
+        if(total > cpuTotal[cpu]) {
+            cpuLoad[cpu] = (double) (busy - cpuBusy[cpu]) / (total - cpuTotal[cpu]);
+        }
+        cpuBusy[cpu] = busy;
+        cpuTotal[cpu] = total;
+    }
+    fclose(stat);
+}
+
+/*
+ * Function to choose the CPUs a process of a job runs on, from its @cpu= prefix or for a background job the
+ * placement policy, among the CPUs the shell may use.
+ * Returns 1 if the process must be placed on the CPUs stored in set, 0 if it is left to the scheduler.
+ */
+int choosePlacement(Job* job, Command* command, const cpu_set_t* allowed, cpu_set_t* set) {
+    if(command->cpus != NULL) {
+        *set = *command->cpus;
+        return 1;
+    }
+    if(!job->background || placementPolicy == PLACE_NONE) return 0;
+
+    CPU_ZERO(set);
+    if(placementPolicy == PLACE_NODE) {
+        char path[64];
+        char list[1024];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", placementNode);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if(fd == -1) return 0;
+        ssize_t count = read(fd, list, sizeof(list) - 1);
+        close(fd);
+        if(count <= 0) return 0;
+        list[count] = '\0';
+        if(parseCpuList(list, set) == -1) return 0;
+        CPU_AND(set, set, allowed);
+        return CPU_COUNT(set) > 0;
+    }
+
+    int chosen = -1;
+    if(placementPolicy == PLACE_ROUND_ROBIN) {
+        for(int i = 0; i < CPU_SETSIZE && chosen == -1; i++) {
+            int cpu = (nextCpu + i) % CPU_SETSIZE;
+            if(CPU_ISSET(cpu, allowed)) chosen = cpu;
+        }
+        nextCpu = chosen + 1;
+    } else {
+        sampleCpuLoad();
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(CPU_ISSET(cpu, allowed) && (chosen == -1 || cpuLoad[cpu] < cpuLoad[chosen])) chosen = cpu;
+        }
+        //Count the process in until the next sample sees it, so that jobs started together spread out.
+        if(chosen != -1) cpuLoad[chosen] += 1.0;
+    }
+    if(chosen == -1) return 0;
+    CPU_SET(chosen, set);
+    return 1;
+}
+
+/*
+ * Function to move the shell to the CPUs chosen for a process of a job, before the process is created.
+ * Returns 1 if the shell was moved, 0 if the process is left to the scheduler or could not be placed.
+ */
+int beginPlacement(Job* job, Command* command, Placement* placement) {
+    placement->node = -1;
+    if(command->cpus == NULL && (!job->background || placementPolicy == PLACE_NONE)) return 0;
+    if(sched_getaffinity(0, sizeof(cpu_set_t), &placement->saved) == -1) return 0;
+    if(!choosePlacement(job, command, &placement->saved, &placement->cpus)) return 0;
+    if(sched_setaffinity(0, sizeof(cpu_set_t), &placement->cpus) == -1) {
+        handleAffinityError();
+        return 0;
+    }
+
+    //Memory of a job placed on a node is allocated on that node while it has room.
+    if(command->cpus == NULL && placementPolicy == PLACE_NODE) {
+        unsigned long nodeMask = 1UL << placementNode;
+        if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8 + 1) == 0) {
+            placement->node = placementNode;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Function to move the shell back to its CPUs and memory policy once a placed process was created (childID, -1 if it
+ * could not be), and record the placement in the job and the event log.
+ */
+void endPlacement(Job* job, Placement* placement, pid_t childID) {
+    sched_setaffinity(0, sizeof(cpu_set_t), &placement->saved);
+    if(placement->node != -1) syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+    if(childID == -1) return;
+    CPU_OR(&job->cpus, &job->cpus, &placement->cpus);
+
+    //The record holds CPUs 0 to 63 as a bit mask.
+    uint64_t mask = 0;
+    for(int cpu = 0; cpu < 64; cpu++) {
+        if(CPU_ISSET(cpu, &placement->cpus)) mask |= 1ULL << cpu;
+    }
+    logEvent(EVENT_PLACE, CALL_NONE, placement->node, childID, mask);
+}
+
+/*
+ * Function to set the placement policy from its name: "none", "roundrobin", "leastloaded" or "node:N".
+ * Returns 0 on success, -1 if the name is not a policy or there is no such node.
+ */
+int setPlacementPolicy(const char* name) {
+    if(strcmp(name, "none") == 0) {
+        placementPolicy = PLACE_NONE;
+    } else if(strcmp(name, "roundrobin") == 0) {
+        placementPolicy = PLACE_ROUND_ROBIN;
+    } else if(strcmp(name, "leastloaded") == 0) {
+        placementPolicy = PLACE_LEAST_LOADED;
+    } else if(strncmp(name, "node:", 5) == 0 && isdigit((unsigned char) name[5])) {
+        char* end;
+        long node = strtol(name + 5, &end, 10);
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%ld", node);
+        if(*end != '\0' || node >= 64 || access(path, F_OK) == -1) return -1;
+        placementPolicy = PLACE_NODE;
+        placementNode = node;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Function to write the name of the placement policy.
+ */
+void formatPlacementPolicy(char* buffer, size_t size) {
+    const char* names[] = {"none", "roundrobin", "leastloaded", "node"};
+    if(placementPolicy == PLACE_NODE) {
+        snprintf(buffer, size, "node:%d", placementNode);
+    } else {
+        snprintf(buffer, size, "%s", names[placementPolicy]);
+    }
+}
+
+/*---------------------------------------------End of CPU placement section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of job table section---------------------------------------------*/
+/*
+ * Every external command or pipeline the shell starts is a job. The job table records when a job started, its command
+ * line, its state and the resource usage of its processes, collected by wait4() as they are reaped, and is what the
+ * jobs, wait, fg and bg built-ins and the time keyword work on.
+ * In an interactive shell each job runs in its own process group and the terminal is handed to the foreground job.
+ * A job may have a deadline, given by the timeout prefix or the shell's default ("set -o timeout=DURATION"), kept in
+ * the timer wheel: once it passes the job is sent SIGTERM, then SIGKILL if it still runs after a grace period, and
+ * both are recorded in the event log.
+ * The output of background jobs can be captured ("set -o capture=on", the default in an interactive shell) instead of
+ * written over the prompt: such a job writes to a pipe that the event loop drains into a ring buffer of the job's log,
+ * which the joblog built-in shows, so a job never waits on a slow terminal. Rings grow up to JOB_OUTPUT_MAX bytes while
+ * all of them fit in CAPTURE_MEMORY_MAX, making room by freeing the logs of older finished jobs. Output that no longer
+ * fits goes to a spill file in the directory set with "set -o capturedir=DIR", if any.
+ */
+
+Job* jobs = NULL;               //Job table, most recent job first.
+int jobControl = 0;             //Non-zero in an interactive shell, where jobs get their own process group.
+pid_t shellPgid = 0;
+int lastStatus = 0;             //Exit status of the last command.
+int positionalNum = 0;          //Number of positional parameters ($1, $2...), the arguments of the running function.
+int interrupted = 0;            //Set when ^C is typed while the shell itself is in the foreground.
+int terminated = 0;             //Set when a server receives SIGTERM.
+int serving = 0;                //Non-zero in a server, which runs built-ins that may block in a copy of itself.
+int jobScope = 0;               //Connection whose line a server is running, only its jobs can be referred to.
+long defaultTimeoutMs = 0;      //Deadline of jobs started without the timeout prefix, 0 for none.
+JobLog* jobLogs = NULL;         //Captured output of background jobs, most recent first.
+int captureJobs = 0;            //Non-zero if the output of background jobs is captured.
+size_t captureMemory = 0;       //Size of the rings of all the logs.
+char captureDir[DIR_MAX] = "";  //Directory of the spill files, empty for none.
+
+/*
+ * Function to add a job for a command line to the table, its processes are added by addJobProcess().
+ * Jobs are numbered after the newest job and the newest kept output, so a number is not reused while joblog still
+ * refers to it.
+ */
+Job* createJob(const char* command, size_t length, int background) {
+    Job* job = calloc(1, sizeof(Job));
+    job->id = (jobs != NULL) ? jobs->id + 1 : 1;
+    if(jobLogs != NULL && jobLogs->id >= job->id) job->id = jobLogs->id + 1;
+    job->scope = jobScope;
+    job->state = JOB_RUNNING;
+    job->background = background;
+    job->graceMs = TIMEOUT_GRACE_MS;
+    job->timeoutMs = -1;
+    job->command = strndup(command, length);
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    job->next = jobs;
+    jobs = job;
+    return job;
+}
+
+/*
+ * Function to parse a duration for timeout and "set -o timeout": a number of seconds, possibly fractional, with an
+ * optional s, m, h or d suffix. A duration other than 0 is at least a tick of the timer wheel, so it is never taken
+ * for 0, which means no deadline.
+ * Returns the duration in milliseconds, -1 if it is malformed.
+ */
+long parseDuration(const char* text) {
+    char* end = NULL;
+    errno = 0;
+    double duration = strtod(text, &end);
+    //Also false for "nan".
+    if(end == text || errno != 0 || !(duration >= 0)) return -1;
+    if(*end == 'm') {
+        duration *= 60;
+    } else if(*end == 'h') {
+        duration *= 60 * 60;
+    } else if(*end == 'd') {
+        duration *= 24 * 60 * 60;
+    } else if(*end != 's' && *end != '\0') {
+        return -1;
+    }
+    if(*end != '\0' && end[1] != '\0') return -1;
+    //Longer than any deadline the timer wheel keeps, or "inf".
+    if(duration > 1e9) return -1;
+    long ms = (long) (duration * 1000 + 0.5);
+    return (duration > 0 && ms < TIMER_TICK_MS) ? TIMER_TICK_MS : ms;
+}
+
+/*
+ * Function to send a signal to the processes of a job that were not reaped yet.
+ */
+void signalJob(Job* job, int signal) {
+    //Commands started by parallel share the shell's process group.
+    if(job->pgid != 0 && job->pgid != shellPgid) {
+        kill(-job->pgid, signal);
+        return;
+    }
+    for(int i = 0; i < job->pidNum; i++) {
+        if(!(job->reaped & (1u << i))) kill(job->pids[i], signal);
+    }
+}
+
+/*
+ * Function called by the timer wheel when a job passes its deadline, and again at the end of its grace period.
+ */
+void jobDeadlinePassed(Timer* timer, void* data) {
+    Job* job = data;
+    int signal = (job->deadlineSignal == 0) ? SIGTERM : SIGKILL;
+    job->deadlineSignal = signal;
+    logEvent(EVENT_TIMEOUT, CALL_NONE, signal, job->pids[0], (job->timeoutMs > 0) ? job->timeoutMs : defaultTimeoutMs);
+    signalJob(job, signal);
+    if(signal == SIGTERM) {
+        //A stopped job could not act on SIGTERM.
+        if(job->state == JOB_STOPPED) signalJob(job, SIGCONT);
+        if(job->graceMs > 0) startTimer(&job->deadline, job->graceMs, jobDeadlinePassed, job);
+    }
+}
+
+/*
+ * Function to give a job a deadline, timeoutMs milliseconds from now, after which it gets graceMs more to terminate.
+ */
+void setJobDeadline(Job* job, long timeoutMs, long graceMs) {
+    job->timeoutMs = timeoutMs;
+    job->graceMs = graceMs;
+    startTimer(&job->deadline, timeoutMs, jobDeadlinePassed, job);
+}
+
+/*
+ * Function to record a process started for a job at startTicks (read before it was spawned, so that its duration
+ * includes its start), the first process of a job leads its process group.
+ * The shell's default deadline starts with the first process of a job that has no deadline of its own.
+ */
+void addJobProcess(Job* job, pid_t childID, uint64_t startTicks) {
+    job->startTicks[job->pidNum] = startTicks;
+    job->pids[job->pidNum++] = childID;
+    job->runningNum++;
+    if(jobControl && job->pgid == 0) job->pgid = childID;
+    if(job->pidNum == 1 && job->timeoutMs == -1 && defaultTimeoutMs > 0) {
+        startTimer(&job->deadline, defaultTimeoutMs, jobDeadlinePassed, job);
+    }
+}
+
+/*
+ * Function to remove a job from the table.
+ */
+void removeJob(Job* job) {
+    for(Job** link = &jobs; *link != NULL; link = &(*link)->next) {
+        if(*link == job) {
+            *link = job->next;
+            cancelTimer(&job->deadline);
+            free(job->command);
+            free(job);
+            return;
+        }
+    }
+}
+
+/*
+ * Function to find a job from a job specification: "%n" for job n, "%%" or "%+" (or NULL) for the most recent job,
+ * or the PID of one of its processes. Only jobs of the current scope are found.
+ * Returns NULL if there is no such job.
+ */
+Job* findJob(const char* spec) {
+    if(spec == NULL || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        for(Job* job = jobs; job != NULL; job = job->next) {
+            if(job->scope == jobScope) return job;
+        }
+        return NULL;
+    }
+    if(spec[0] == '%') {
+        int id = atoi(spec + 1);
+        for(Job* job = jobs; job != NULL; job = job->next) {
+            if(job->id == id && job->scope == jobScope) return job;
+        }
+        return NULL;
+    }
+    pid_t pid = atoi(spec);
+    for(Job* job = jobs; job != NULL; job = job->next) {
+        if(job->scope != jobScope) continue;
+        for(int i = 0; i < job->pidNum; i++) {
+            if(job->pids[i] == pid) return job;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Function to free the memory of a job log and stop draining its pipe.
+ */
+void freeJobLog(JobLog* log) {
+    if(log->fd != -1) {
+        eventLoopRemove(log->fd);
+        close(log->fd);
+    }
+    if(log->spillFd != -1) close(log->spillFd);
+    if(log->spillPath != NULL) {
+        unlink(log->spillPath);
+        free(log->spillPath);
+    }
+    captureMemory -= log->capacity;
+    free(log->ring);
+    free(log->command);
+    free(log);
+}
+
+/*
+ * Function to find the log of job n, or the most recent log for id 0.
+ */
+JobLog* findJobLog(int id) {
+    for(JobLog* log = jobLogs; log != NULL; log = log->next) {
+        if(id == 0 || log->id == id) return log;
+    }
+    return NULL;
+}
+
+/*
+ * Function to take a log out of the list and free it.
+ */
+void dropJobLog(JobLog* log) {
+    for(JobLog** link = &jobLogs; *link != NULL; link = &(*link)->next) {
+        if(*link == log) {
+            *link = log->next;
+            freeJobLog(log);
+            return;
+        }
+    }
+}
+
+/*
+ * Function to make room for size more bytes of captured output of a log under CAPTURE_MEMORY_MAX, by freeing the logs
+ * of the oldest jobs whose output is complete. Only logs of jobs older than the one of log are freed, so newer jobs
+ * keep their output, and a loop over the logs stays valid past the one it drains.
+ * Returns 1 if there is room, 0 else.
+ */
+int reserveCapture(size_t size, JobLog* log) {
+    while(captureMemory + size > CAPTURE_MEMORY_MAX) {
+        JobLog* oldest = NULL;
+        for(JobLog* older = log->next; older != NULL; older = older->next) {
+            if(older->fd == -1 && older->capacity > 0) oldest = older;
+        }
+        if(oldest == NULL) return 0;
+        dropJobLog(oldest);
+    }
+    return 1;
+}
+
+/*
+ * Function to write bytes about to be dropped from a log to its spill file, which is created the first time.
+ * Without a spill directory ("set -o capturedir=DIR") they are only counted.
+ */
+void spillJobOutput(JobLog* log, const char* data, size_t size) {
+    if(size == 0) return;
+    if(log->spillFd == -1 && captureDir[0] != '\0' && log->spilled == 0 && log->dropped == 0) {
+        //The file gets a name of its own (mkostemps() creates it with O_EXCL), so a file or link already in the
+        //directory is never written through. A path too long for the buffer gets no spill file, the bytes are counted
+        //as dropped.
+        char path[DIR_MAX];
+        int length = snprintf(path, sizeof(path), "%s/oshell-%d-job%d-XXXXXX.log", captureDir, getpid(), log->id);
+        if(length < (int) sizeof(path)) {
+            log->spillFd = keepFdHigh(mkostemps(path, 4, O_CLOEXEC));
+        } else {
+            errno = ENAMETOOLONG;
+        }
+        if(log->spillFd == -1) {
+            handleOpenError(path);
+        } else {
+            log->spillPath = strdup(path);
+        }
+    }
+    if(log->spillFd != -1 && write(log->spillFd, data, size) == (ssize_t) size) {
+        log->spilled += size;
+    } else {
+        log->dropped += size;
+    }
+}
+
+/*
+ * Function to add output of a job to the end of its ring. The ring doubles from JOB_OUTPUT_INITIAL bytes up to
+ * JOB_OUTPUT_MAX while the global limit allows, after which the oldest bytes make way for new ones.
+ */
+void appendJobOutput(JobLog* log, const char* data, size_t size) {
+    while(log->length + size > log->capacity && log->capacity < JOB_OUTPUT_MAX) {
+        size_t capacity = (log->capacity == 0) ? JOB_OUTPUT_INITIAL : 2 * log->capacity;
+        if(!reserveCapture(capacity - log->capacity, log)) break;
+        char* ring = malloc(capacity);
+        size_t first = (log->length < log->capacity - log->start) ? log->length : log->capacity - log->start;
+        memcpy(ring, log->ring + log->start, first);
+        memcpy(ring + first, log->ring, log->length - first);
+        free(log->ring);
+        captureMemory += capacity - log->capacity;
+        log->ring = ring;
+        log->capacity = capacity;
+        log->start = 0;
+    }
+
+    //Bytes that do not fit go to the spill file in the order they were written: the oldest of the ring first.
+    if(size > log->capacity) {
+        size_t first = (log->length < log->capacity - log->start) ? log->length : log->capacity - log->start;
+        spillJobOutput(log, log->ring + log->start, first);
+        spillJobOutput(log, log->ring, log->length - first);
+        log->length = 0;
+        spillJobOutput(log, data, size - log->capacity);
+        data += size - log->capacity;
+        size = log->capacity;
+    } else if(log->length + size > log->capacity) {
+        size_t excess = log->length + size - log->capacity;
+        size_t first = (excess < log->capacity - log->start) ? excess : log->capacity - log->start;
+        spillJobOutput(log, log->ring + log->start, first);
+        spillJobOutput(log, log->ring, excess - first);
+        log->start = (log->start + excess) % log->capacity;
+        log->length -= excess;
+    }
+    if(size == 0) return;
+
+    size_t end = (log->start + log->length) % log->capacity;
+    size_t first = (size < log->capacity - end) ? size : log->capacity - end;
+    memcpy(log->ring + end, data, first);
+    memcpy(log->ring, data + first, size - first);
+    log->length += size;
+}
+
+/*
+ * Function to move the output a captured job wrote into its log, at most rounds reads of it, showing it as well while
+ * the job is in the foreground. The pipe is closed once every process of the job closed its end.
+ */
+void readJobOutput(JobLog* log, int rounds) {
+    char chunk[16384];
+    for(int i = 0; i < rounds && log->fd != -1; i++) {
+        ssize_t size = read(log->fd, chunk, sizeof(chunk));
+        if(size > 0) {
+            log->total += size;
+            appendJobOutput(log, chunk, size);
+            if(log->followFd != -1 && write(log->followFd, chunk, size) == -1) log->followFd = -1;
+            continue;
+        }
+        if(size == -1 && (errno == EAGAIN || errno == EINTR)) return;
+        eventLoopRemove(log->fd);
+        close(log->fd);
+        log->fd = -1;
+    }
+}
+
+/*
+ * Function called by the event loop when a captured job wrote output. A bounded amount is read per call, so that a
+ * chatty job cannot hold up the other events.
+ */
+void drainJobOutput(int fd, uint32_t events, void* data) {
+    readJobOutput(data, 16);
+}
+
+/*
+ * Function to point the shell's standard output and error output to a new pipe while a background job starts, so
+ * that the job's output is captured instead of written over the prompt. savedFds receives the original descriptors.
+ * Returns the read end of the pipe, -1 if output is not captured.
+ */
+int beginCapture(int* savedFds) {
+    int fds[2];
+    if(!captureJobs || pipe2(fds, O_CLOEXEC) == -1) return -1;
+    fds[0] = keepFdHigh(fds[0]);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+    fflush(stdout);
+    savedFds[0] = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, REDIRECT_FD_MAX);
+    savedFds[1] = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, REDIRECT_FD_MAX);
+    dup2(fds[1], STDOUT_FILENO);
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[1]);
+    return fds[0];
+}
+
+/*
+ * Function to give the shell its output back once a background job started, and to start draining the pipe of the
+ * job into a new log.
+ */
+void endCapture(int readFd, int* savedFds, Job* job) {
+    if(readFd == -1) return;
+    fflush(stdout);
+    dup2(savedFds[0], STDOUT_FILENO);
+    dup2(savedFds[1], STDERR_FILENO);
+    close(savedFds[0]);
+    close(savedFds[1]);
+    if(job == NULL) {
+        //Nothing started, only the shell's own messages are in the pipe.
+        char chunk[4096];
+        ssize_t size = 0;
+        while((size = read(readFd, chunk, sizeof(chunk))) > 0) {
+            if(write(STDOUT_FILENO, chunk, size) == -1) break;
+        }
+        close(readFd);
+        return;
+    }
+
+    JobLog* log = calloc(1, sizeof(JobLog));
+    log->id = job->id;
+    log->command = strdup(job->command);
+    log->fd = readFd;
+    log->spillFd = -1;
+    log->followFd = -1;
+    log->next = jobLogs;
+    jobLogs = log;
+    if(eventLoopAdd(readFd, EPOLLIN, drainJobOutput, log) == -1) {
+        handleEpollError();
+        close(readFd);
+        log->fd = -1;
+    }
+}
+
+/*
+ * Function to write the output captured for a job: the part spilled to a file, then the ring.
+ * Returns 0 on success, -1 if it could not be written.
+ */
+int writeJobLog(JobLog* log, int outFd) {
+    int result = 0;
+
+    //A job that terminated may have left output in the pipe that the event loop did not get to yet.
+    readJobOutput(log, INT_MAX);
+    if(log->dropped > 0) {
+        dprintf(outFd, "joblog: first %llu bytes of job %d were dropped\n", (unsigned long long) log->dropped, log->id);
+    }
+    if(log->spillFd != -1) {
+        char chunk[16384];
+        ssize_t size = 0;
+        fflush(stdout);
+        for(off_t offset = 0; (size = pread(log->spillFd, chunk, sizeof(chunk), offset)) > 0; offset += size) {
+            if(write(outFd, chunk, size) != size) {
+                result = -1;
+                break;
+            }
+        }
+    }
+    size_t first = (log->length < log->capacity - log->start) ? log->length : log->capacity - log->start;
+    struct iovec parts[2] = {{log->ring + log->start, first}, {log->ring, log->length - first}};
+    if(log->length > 0 && writev(outFd, parts, 2) != (ssize_t) log->length) result = -1;
+    return result;
+}
+
+/*
+ * Function to drop every log, in a forked copy of the shell whose background jobs belong to the shell.
+ */
+void resetJobLogs() {
+    while(jobLogs != NULL) {
+        JobLog* next = jobLogs->next;
+        if(jobLogs->fd != -1) close(jobLogs->fd);
+        jobLogs->fd = -1;
+        //The spill files stay with the shell, the copy only closes them.
+        free(jobLogs->spillPath);
+        jobLogs->spillPath = NULL;
+        freeJobLog(jobLogs);
+        jobLogs = next;
+    }
+    captureJobs = 0;
+}
+
+/*
+ * Function to update the job of a child after wait4() reported a change of state.
+ */
+void updateJob(pid_t childID, int status, struct rusage* usage) {
+    Job* job = NULL;
+    int process = 0;
+    for(Job* candidate = jobs; candidate != NULL && job == NULL; candidate = candidate->next) {
+        for(int i = 0; i < candidate->pidNum; i++) {
+            if(candidate->pids[i] == childID) {
+                job = candidate;
+                process = i;
+            }
+        }
+    }
+    if(job == NULL) return;
+
+    if(WIFSTOPPED(status)) {
+        job->state = JOB_STOPPED;
+        return;
+    }
+    if(WIFCONTINUED(status)) {
+        job->state = JOB_RUNNING;
+        return;
+    }
+
+    recordLatency(METRIC_CHILD, readTicks() - job->startTicks[process]);
+    timeradd(&job->usage.ru_utime, &usage->ru_utime, &job->usage.ru_utime);
+    timeradd(&job->usage.ru_stime, &usage->ru_stime, &job->usage.ru_stime);
+    if(usage->ru_maxrss > job->usage.ru_maxrss) job->usage.ru_maxrss = usage->ru_maxrss;
+    job->usage.ru_minflt += usage->ru_minflt;
+    job->usage.ru_majflt += usage->ru_majflt;
+    job->usage.ru_nvcsw += usage->ru_nvcsw;
+    job->usage.ru_nivcsw += usage->ru_nivcsw;
+
+    if(childID == job->pids[job->pidNum - 1]) job->status = status;
+    job->reaped |= 1u << process;
+    if(--job->runningNum == 0) {
+        job->state = JOB_DONE;
+        clock_gettime(CLOCK_MONOTONIC, &job->end);
+        cancelTimer(&job->deadline);
+        if(job->onDone != NULL) job->onDone(job, job->callbackData);
+    }
+}
+
+/*
+ * Function to convert the wait status of a job into an exit status (128 + signal number if it was killed).
+ * A job that passed its deadline has status 124, like with timeout(1), unless it had to be killed with SIGKILL.
+ */
+int jobExitStatus(Job* job) {
+    if(job->state == JOB_STOPPED) return 128 + SIGTSTP;
+    if(job->deadlineSignal != 0 && !(WIFSIGNALED(job->status) && WTERMSIG(job->status) == SIGKILL)) return 124;
+    if(WIFSIGNALED(job->status)) return 128 + WTERMSIG(job->status);
+    return WEXITSTATUS(job->status);
+}
+
+/*
+ * Function to compute the number of seconds a job has been running, or ran for.
+ */
+double jobElapsed(Job* job) {
+    struct timespec end = job->end;
+    if(job->state != JOB_DONE) clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - job->start.tv_sec) + (end.tv_nsec - job->start.tv_nsec) / 1e9;
+}
+
+/*
+ * Function to print a job with its state and resource usage.
+ */
+void printJob(Job* job, int outFd) {
+    const char* state = "Running";
+    char doneState[32];
+    if(job->state == JOB_STOPPED) {
+        state = "Stopped";
+    } else if(job->state == JOB_DONE) {
+        if(job->deadlineSignal != 0) {
+            snprintf(doneState, sizeof(doneState), "Timed out (%s)", sigabbrev_np(job->deadlineSignal));
+        } else if(WIFSIGNALED(job->status)) {
+            snprintf(doneState, sizeof(doneState), "Killed (%s)", sigabbrev_np(WTERMSIG(job->status)));
+        } else if(WEXITSTATUS(job->status) != 0) {
+            snprintf(doneState, sizeof(doneState), "Exit %d", WEXITSTATUS(job->status));
+        } else {
+            snprintf(doneState, sizeof(doneState), "Done");
+        }
+        state = doneState;
+    }
+    dprintf(outFd, "[%d]  %-12s %-40s %8.2fs elapsed", job->id, state, job->command, jobElapsed(job));
+    if(CPU_COUNT(&job->cpus) > 0) {
+        char cpus[256];
+        formatCpuList(&job->cpus, cpus, sizeof(cpus));
+        dprintf(outFd, "  cpus %s", cpus);
+    }
+    if(job->runningNum < job->pidNum) {
+        //Resource usage is only known for processes that were reaped.
+        dprintf(outFd, "  %ld.%02lds user  %ld.%02lds sys  %ld KB maxrss  %ld/%ld csw",
+                (long) job->usage.ru_utime.tv_sec, (long) job->usage.ru_utime.tv_usec / 10000,
+                (long) job->usage.ru_stime.tv_sec, (long) job->usage.ru_stime.tv_usec / 10000,
+                job->usage.ru_maxrss, job->usage.ru_nvcsw, job->usage.ru_nivcsw);
+    }
+    dprintf(outFd, "\n");
+}
+
+/*
+ * Function to print and remove every background job that finished since the last prompt.
+ */
+void notifyJobs() {
+    Job* job = jobs;
+    while(job != NULL) {
+        Job* next = job->next;
+        if(job->background && job->state == JOB_DONE && job->onDone == NULL) {
+            JobLog* log = findJobLog(job->id);
+            if(log != NULL) readJobOutput(log, INT_MAX);
+            printJob(job, STDOUT_FILENO);
+            if(log != NULL && log->total > 0) {
+                printf("     %llu bytes of output, see joblog %%%d\n", (unsigned long long) log->total, job->id);
+            }
+            removeJob(job);
+        }
+        job = next;
+    }
+}
+
+/*
+ * Function to wait until a job is no longer running, handling other events in the meantime.
+ * A foreground job is given the terminal while it runs.
+ * Returns the exit status of the job.
+ */
+int waitJob(Job* job) {
+    if(jobControl && !job->background) tcsetpgrp(STDIN_FILENO, job->pgid);
+    while(job->state == JOB_RUNNING) {
+        eventLoopWait(-1);
+    }
+    if(jobControl && !job->background) {
+        tcsetpgrp(STDIN_FILENO, shellPgid);
+        if(job->state == JOB_STOPPED) {
+            job->background = 1;
+            printf("\n");
+            printJob(job, STDOUT_FILENO);
+        } else if(WIFSIGNALED(job->status) && WTERMSIG(job->status) == SIGINT) {
+            //The ^C echoed by the terminal is not followed by a newline.
+            printf("\n");
+        }
+    }
+    return jobExitStatus(job);
+}
+
+/*
+ * Function to resume a stopped job.
+ */
+void continueJob(Job* job) {
+    if(job->state != JOB_STOPPED) return;
+    signalJob(job, SIGCONT);
+    job->state = JOB_RUNNING;
+}
+
+/*---------------------------------------------End of job table section---------------------------------------------*/
+
+/*
+ * Function to handle signals read from the signal descriptor: reap children on SIGCHLD, note ^C on SIGINT and a
+ * request to stop serving on SIGTERM.
+ * Signals of several children may be merged into one, so every child that changed state is collected.
+ */
+void handleSignals(int fd, uint32_t events, void* data) {
+    struct signalfd_siginfo info[8];
+    struct rusage usage;
+    pid_t pid = 0;
+    int status = 0;
+    ssize_t size = 0;
+
+    //Empty the descriptor.
+    while((size = read(fd, info, sizeof(info))) > 0) {
+        for(size_t i = 0; i < size / sizeof(info[0]); i++) {
+            if(info[i].ssi_signo == SIGINT) interrupted = 1;
+            if(info[i].ssi_signo == SIGTERM) terminated = 1;
+            if(info[i].ssi_signo == SIGUSR1) writeMetrics();
+        }
+    }
+
+    // Loop for all terminating, stopped and continued children.
+    while((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        if(WIFEXITED(status) || WIFSIGNALED(status)) {
+            recordLatency(METRIC_REAP, readTicks() - loopWakeTicks);
+            writeReapingMsg(pid, status);
+        }
+        updateJob(pid, status, &usage);
+    }
+}
+
+/*
+ * Function to take control of the terminal in an interactive shell.
+ * The shell gets its own process group and ignores the job control signals, which its jobs get back, except SIGINT
+ * which it receives through the event loop.
+ */
+void initJobControl() {
+    if(!isatty(STDIN_FILENO)) return;
+
+    //Wait until the shell is in the foreground, if it was started in the background.
+    while(tcgetpgrp(STDIN_FILENO) != (shellPgid = getpgrp())) {
+        kill(-shellPgid, SIGTTIN);
+    }
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    //^C typed while the shell itself is in the foreground (e.g. running sleep) is read from the signal descriptor.
+    sigaddset(&shellSignals, SIGINT);
+    sigprocmask(SIG_BLOCK, &shellSignals, NULL);
+    signalfd(signalFd, &shellSignals, 0);
+
+    shellPgid = getpid();
+    if(getpgrp() != shellPgid && setpgid(0, shellPgid) == -1) return;
+    tcsetpgrp(STDIN_FILENO, shellPgid);
+    jobControl = 1;
+    captureJobs = 1;
+}
+
+/*
+ * Function to block SIGCHLD and receive it through the event loop instead.
+ */
+void initEventLoop() {
+    epollFd = keepFdHigh(epoll_create1(EPOLL_CLOEXEC));
+    if(epollFd == -1) {
+        handleEpollError();
+        exit(EXIT_FAILURE);
+    }
+
+    sigemptyset(&shellSignals);
+    sigaddset(&shellSignals, SIGCHLD);
+    sigaddset(&shellSignals, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &shellSignals, NULL);
+    signalFd = keepFdHigh(signalfd(-1, &shellSignals, SFD_NONBLOCK | SFD_CLOEXEC));
+    if(signalFd == -1) {
+        handleSignalFdError();
+        exit(EXIT_FAILURE);
+    }
+    if(eventLoopAdd(signalFd, EPOLLIN, handleSignals, NULL) == -1) {
+        handleEpollError();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Function to give a forked copy of the shell an event loop of its own. The epoll instance is shared across fork(),
+ * and waiting on it from the child could take the readiness of the shell's signal descriptor away from the shell.
+ * The deadlines of the shell's jobs are not the child's to enforce, nor their output its to capture.
+ */
+void resetEventLoop() {
+    close(epollFd);
+    close(signalFd);
+    memset(eventSources, 0, eventSourceMax * sizeof(EventSource));
+    resetTimers();
+    resetJobLogs();
+    initEventLoop();
+}
+
+/*
+ * Function to initialize directories on shell launch.
+ */
+void initEnvironment() {
+    loadVarTable(&shellVars, environ);
+
+    char* activeUser = getlogin();
+
+    //Without a controlling terminal (batch runs) there is no login name, use the name of the user ID instead.
+    if(activeUser == NULL) {
+        struct passwd* userEntry = getpwuid(getuid());
+        if(userEntry == NULL) {
+            handleGetLoginError();
+            exit(EXIT_FAILURE);
+        }
+        activeUser = userEntry->pw_name;
+    }
+    strcat(home, activeUser);
+    strcat(home, "/");
+    if(getcwd(workDir, DIR_MAX) == NULL) {
+        handleCWDError();
+        exit(EXIT_FAILURE);
+    }
+    strcat(workDir, "/");
+    if(chdir(workDir) == -1) {
+        handleChDirError();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Function to write the prompt, with the working directory in which the home directory is replaced by '~'.
+ * Returns the length of the prompt.
+ */
+int formatPrompt(char* prompt, size_t size) {
+    char* tilde = strstr(workDir, home);
+    if(tilde != NULL) return snprintf(prompt, size, "OShell:~%s>> ", workDir + strlen(home) - 1);
+    return snprintf(prompt, size, "OShell:%s>> ", workDir);
+}
+
+/*
+ * Input read from stdin, the line last returned by takeInput() is at the start of the buffer until the next call.
+ */
+char* inputBuffer = NULL;
+size_t inputSize = 0;
+size_t inputBuffered = 0;
+size_t inputTaken = 0;          //Length of the line last returned, with its newline.
+int inputEnded = 0;
+int stdinReady = 0;
+int stdinWatched = 0;
+char* commandBuffer = NULL;     //Lines of an incomplete command joined by takeCommand().
+size_t commandSize = 0;
+
+/*
+ * Function called by the event loop when stdin has input.
+ */
+void handleStdinReady(int fd, uint32_t events, void* data) {
+    stdinReady = 1;
+}
+
+/*
+ * Function to start watching stdin, it is only armed (EPOLLONESHOT) while the shell waits for input.
+ * Regular files cannot be watched, they are always ready.
+ */
+void watchStdin() {
+    stdinWatched = (eventLoopAdd(STDIN_FILENO, EPOLLIN | EPOLLONESHOT, handleStdinReady, NULL) == 0);
+}
+
+/*
+ * Function to wait for input on stdin, handling other events (e.g. terminated children) in the meantime.
+ */
+void waitInput() {
+    if(!stdinWatched) return;
+    if(!stdinReady) eventLoopModify(STDIN_FILENO, EPOLLIN | EPOLLONESHOT);
+    while(!stdinReady) {
+        eventLoopWait(-1);
+    }
+}
+
+/*---------------------------------------------Beginning of history section---------------------------------------------*/
+/*
+ * Lines entered in the interactive shell are kept in a history file shared by all the sessions of a user. A line is
+ * added with a single write() to the file opened with O_APPEND, so lines of concurrent sessions never interleave,
+ * and the file is only ever appended to. Each session maps the file into memory and, before every prompt, extends the
+ * mapping to the lines added since, by itself or by other sessions, which recall then sees too.
+ * Reverse search (^R) goes through a trigram index: entries are grouped in blocks of HISTORY_BLOCK, and each trigram
+ * maps to the list of blocks containing it, stored as varint-encoded differences. A search intersects the lists of
+ * the trigrams of the query and only scans the entries of the blocks left, so it stays instant with millions of
+ * entries. Queries shorter than a trigram scan backwards from the newest entry.
+ * The index is built while the shell waits for keys, so a large history does not delay the first prompt.
+ */
+
+typedef struct Trigram {
+    uint32_t key;               //The three bytes, 0 for an empty slot (entries have no NUL bytes).
+    uint32_t lastBlock;         //Last block added to the list, blocks are added in increasing order.
+    uint32_t size;              //Bytes used in blocks.
+    uint32_t capacity;
+    unsigned char* blocks;      //Differences between successive blocks, 7 bits per byte, high bit set if more follow.
+} Trigram;
+
+int historyFd = -1;
+char* historyMap = NULL;
+size_t historyMapSize = 0;
+size_t historyEnd = 0;          //Bytes of the file up to the end of the last entry.
+size_t* historyEntries = NULL;  //Offset of each entry in the file, oldest first.
+size_t historyEntryNum = 0;
+size_t historyEntryCapacity = 0;
+size_t historyIndexedNum = 0;   //Number of entries in the trigram index.
+Trigram* trigrams = NULL;       //Linear probing, capacity is a power of 2.
+size_t trigramCapacity = 0;
+size_t trigramCount = 0;
+
+/*
+ * Function to get an entry of the history and its length (without its newline).
+ */
+const char* historyEntry(size_t index, size_t* length) {
+    size_t end = (index + 1 < historyEntryNum) ? historyEntries[index + 1] : historyEnd;
+    *length = end - historyEntries[index] - 1;
+    return historyMap + historyEntries[index];
+}
+
+/*
+ * Function to find the slot of a trigram in the index.
+ */
+Trigram* findTrigram(uint32_t key) {
+    size_t slot = (key * 2654435761u) & (trigramCapacity - 1);
+    while(trigrams[slot].key != 0 && trigrams[slot].key != key) {
+        slot = (slot + 1) & (trigramCapacity - 1);
+    }
+    return &trigrams[slot];
+}
+
+/*
+ * Function to double the capacity of the trigram index.
+ */
+void growTrigrams() {
+    Trigram* oldTrigrams = trigrams;
+    size_t oldCapacity = trigramCapacity;
+    trigramCapacity = (oldCapacity == 0) ? 4096 : 2 * oldCapacity;
+    trigrams = calloc(trigramCapacity, sizeof(Trigram));
+    for(size_t i = 0; i < oldCapacity; i++) {
+        if(oldTrigrams[i].key != 0) *findTrigram(oldTrigrams[i].key) = oldTrigrams[i];
+    }
+    free(oldTrigrams);
+}
+
+/*
+ * Function to add an entry to the trigram index.
+ */
+void indexHistoryEntry(const char* entry, size_t length, uint32_t block) {
+    for(size_t i = 0; i + 3 <= length; i++) {
+        uint32_t key = (unsigned char) entry[i] << 16 | (unsigned char) entry[i + 1] << 8 | (unsigned char) entry[i + 2];
+        if(2 * (trigramCount + 1) > trigramCapacity) growTrigrams();
+        Trigram* trigram = findTrigram(key);
+        if(trigram->key == 0) {
+            trigram->key = key;
+            trigramCount++;
+        } else if(trigram->lastBlock == block) {
+            continue;
+        }
+        if(trigram->capacity - trigram->size < 5) {
+            trigram->capacity = (trigram->capacity == 0) ? 8 : 2 * trigram->capacity;
+            trigram->blocks = realloc(trigram->blocks, trigram->capacity);
+        }
+        uint32_t delta = block - trigram->lastBlock;
+        while(delta >= 0x80) {
+            trigram->blocks[trigram->size++] = (delta & 0x7f) | 0x80;
+            delta >>= 7;
+        }
+        trigram->blocks[trigram->size++] = delta;
+        trigram->lastBlock = block;
+    }
+}
+
+/*
+ * Function to add up to count entries not indexed yet to the trigram index.
+ */
+void indexHistory(size_t count) {
+    while(count-- > 0 && historyIndexedNum < historyEntryNum) {
+        size_t length = 0;
+        const char* entry = historyEntry(historyIndexedNum, &length);
+        indexHistoryEntry(entry, length, historyIndexedNum / HISTORY_BLOCK);
+        historyIndexedNum++;
+    }
+}
+
+/*
+ * Function to map the lines added to the history file since the last call and add them to the entries.
+ * A line still being written by another session (without its newline yet) is left for the next call.
+ */
+void refreshHistory() {
+    struct stat info;
+    if(historyFd == -1 || fstat(historyFd, &info) == -1 || (size_t) info.st_size <= historyMapSize) return;
+
+    size_t size = info.st_size;
+    char* map = (historyMap == NULL) ? mmap(NULL, size, PROT_READ, MAP_SHARED, historyFd, 0)
+                                     : mremap(historyMap, historyMapSize, size, MREMAP_MAYMOVE);
+    if(map == MAP_FAILED) {
+        handleMmapError();
+        return;
+    }
+    historyMap = map;
+    historyMapSize = size;
+
+    char* end = NULL;
+    while((end = memchr(historyMap + historyEnd, '\n', historyMapSize - historyEnd)) != NULL) {
+        if(historyEntryNum == historyEntryCapacity) {
+            historyEntryCapacity = (historyEntryCapacity == 0) ? 1024 : 2 * historyEntryCapacity;
+            historyEntries = realloc(historyEntries, historyEntryCapacity * sizeof(size_t));
+        }
+        historyEntries[historyEntryNum++] = historyEnd;
+        historyEnd = end + 1 - historyMap;
+    }
+}
+
+/*
+ * Function to open the history file: $HISTFILE, or HISTORY_FILE in the home directory.
+ */
+void openHistory() {
+    char path[DIR_MAX];
+    const char* file = getVarValue(&shellVars, "HISTFILE");
+    const char* homeDir = getVarValue(&shellVars, "HOME");
+    if(file != NULL) {
+        snprintf(path, sizeof(path), "%s", file);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s", (homeDir != NULL) ? homeDir : home, HISTORY_FILE);
+    }
+    historyFd = keepFdHigh(open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600));
+    if(historyFd == -1) {
+        handleOpenError(path);
+        return;
+    }
+    refreshHistory();
+}
+
+/*
+ * Function to add a line to the history, unless it is blank, starts with a space or repeats the last entry.
+ */
+void addHistory(const char* line, size_t length) {
+    if(historyFd == -1 || length == 0 || line[0] == ' ' || strspn(line, " \t") == length) return;
+    if(historyEntryNum > 0) {
+        size_t lastLength = 0;
+        const char* last = historyEntry(historyEntryNum - 1, &lastLength);
+        if(lastLength == length && memcmp(last, line, length) == 0) return;
+    }
+    //One call, so that the line and its newline are never separated by a line of another session.
+    struct iovec parts[2] = {{(void*) line, length}, {"\n", 1}};
+    writev(historyFd, parts, 2);
+}
+
+/*
+ * Function to decode the block list of a trigram into blocks, which must have room for every block of the history.
+ * Returns the number of blocks.
+ */
+size_t decodeTrigram(Trigram* trigram, uint32_t* blocks) {
+    size_t blockNum = 0;
+    uint32_t block = 0;
+    for(uint32_t i = 0; i < trigram->size; ) {
+        uint32_t delta = 0;
+        int shift = 0;
+        do {
+            delta |= (uint32_t) (trigram->blocks[i] & 0x7f) << shift;
+            shift += 7;
+        } while(trigram->blocks[i++] & 0x80);
+        block += delta;
+        blocks[blockNum++] = block;
+    }
+    return blockNum;
+}
+
+/*
+ * Function to find the newest entry before entry number before that contains query.
+ * Returns the number of the entry, -1 if there is none.
+ */
+long searchHistory(const char* query, size_t length, long before) {
+    if(length == 0) return -1;
+    if(length < 3) {
+        for(long i = before - 1; i >= 0; i--) {
+            size_t entryLength = 0;
+            const char* entry = historyEntry(i, &entryLength);
+            if(memmem(entry, entryLength, query, length) != NULL) return i;
+        }
+        return -1;
+    }
+
+    //Blocks containing every trigram of the query, the candidates, are the intersection of their lists.
+    indexHistory(historyEntryNum);
+    size_t blockCount = historyEntryNum / HISTORY_BLOCK + 1;
+    uint32_t* candidates = malloc(blockCount * sizeof(uint32_t));
+    uint32_t* blocks = malloc(blockCount * sizeof(uint32_t));
+    size_t candidateNum = 0;
+    for(size_t i = 0; i + 3 <= length; i++) {
+        uint32_t key = (unsigned char) query[i] << 16 | (unsigned char) query[i + 1] << 8 | (unsigned char) query[i + 2];
+        Trigram* trigram = (trigramCapacity > 0) ? findTrigram(key) : NULL;
+        if(trigram == NULL || trigram->key == 0) {
+            candidateNum = 0;
+            break;
+        }
+        if(i == 0) {
+            candidateNum = decodeTrigram(trigram, candidates);
+            continue;
+        }
+        size_t blockNum = decodeTrigram(trigram, blocks);
+        size_t kept = 0;
+        for(size_t j = 0, k = 0; j < candidateNum && k < blockNum; ) {
+            if(candidates[j] < blocks[k]) {
+                j++;
+            } else if(candidates[j] > blocks[k]) {
+                k++;
+            } else {
+                candidates[kept++] = candidates[j];
+                j++;
+                k++;
+            }
+        }
+        candidateNum = kept;
+        if(candidateNum == 0) break;
+    }
+
+    long found = -1;
+    for(long i = (long) candidateNum - 1; i >= 0 && found == -1; i--) {
+        long first = (long) candidates[i] * HISTORY_BLOCK;
+        long last = first + HISTORY_BLOCK - 1;
+        if(last >= before) last = before - 1;
+        for(long entryIndex = last; entryIndex >= first; entryIndex--) {
+            size_t entryLength = 0;
+            const char* entry = historyEntry(entryIndex, &entryLength);
+            if(memmem(entry, entryLength, query, length) != NULL) {
+                found = entryIndex;
+                break;
+            }
+        }
+    }
+    free(candidates);
+    free(blocks);
+    return found;
+}
+
+/*---------------------------------------------End of history section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of completion section---------------------------------------------*/
+/*
+ * Tab completion looks names up in an in-memory index of directories: those of $PATH, for command names, and the
+ * directories recently visited with cd or completed in, for paths. Each indexed directory is read once and then kept
+ * current by inotify, which reports the files created, deleted, renamed or changed in it, so no directory is read
+ * again while keys are typed, which matters on network file systems. A directory inotify cannot watch is checked
+ * with a single stat() when it is used, and read again only if it changed.
+ * The index follows $PATH as it is assigned or exported, keeping the directories that stay in it, and the visited
+ * directories that are not in $PATH are limited to the COMPLETE_DIR_MAX most recently used.
+ */
+
+#define NAME_DIRECTORY 1
+#define NAME_EXECUTABLE 2
+
+typedef struct IndexedName {
+    char* name;
+    int flags;                  //NAME_DIRECTORY and NAME_EXECUTABLE.
+} IndexedName;
+
+typedef struct DirIndex {
+    char* path;                 //Absolute, ending with a '/'.
+    int watch;                  //inotify watch descriptor, -1 if the directory is not watched.
+    struct timespec mtime;      //Modification time when read, to check directories that are not watched.
+    int inPath;                 //Non-zero for directories of $PATH, which are never dropped.
+    unsigned long lastUsed;
+    IndexedName* names;         //Sorted by name.
+    size_t nameNum;
+    size_t nameCapacity;
+    struct DirIndex* next;
+} DirIndex;
+
+int completionEnabled = 0;
+int inotifyFd = -1;
+DirIndex* dirIndexes = NULL;
+char* indexedPath = NULL;       //Value of $PATH the index follows.
+unsigned long indexClock = 0;   //Incremented each time a directory is used, for lastUsed.
+
+/*
+ * Function to get the flags of a file of a directory.
+ */
+int nameFlags(int dirFd, const char* name) {
+    struct stat info;
+    if(fstatat(dirFd, name, &info, 0) == -1) return 0;
+    if(S_ISDIR(info.st_mode)) return NAME_DIRECTORY;
+    return (S_ISREG(info.st_mode) && faccessat(dirFd, name, X_OK, 0) == 0) ? NAME_EXECUTABLE : 0;
+}
+
+/*
+ * Function to find the position of a name in the sorted names of a directory, or where it would be inserted.
+ */
+size_t findName(DirIndex* dir, const char* name) {
+    size_t low = 0;
+    size_t high = dir->nameNum;
+    while(low < high) {
+        size_t middle = (low + high) / 2;
+        if(strcmp(dir->names[middle].name, name) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/*
+ * Function to add a name to an indexed directory, or update its flags if it is already there.
+ */
+void addName(DirIndex* dir, const char* name, int flags) {
+    size_t position = findName(dir, name);
+    if(position < dir->nameNum && strcmp(dir->names[position].name, name) == 0) {
+        dir->names[position].flags = flags;
+        return;
+    }
+    if(dir->nameNum == dir->nameCapacity) {
+        dir->nameCapacity = (dir->nameCapacity == 0) ? 64 : 2 * dir->nameCapacity;
+        dir->names = realloc(dir->names, dir->nameCapacity * sizeof(IndexedName));
+    }
+    memmove(dir->names + position + 1, dir->names + position, (dir->nameNum - position) * sizeof(IndexedName));
+    dir->names[position].name = strdup(name);
+    dir->names[position].flags = flags;
+    dir->nameNum++;
+}
+
+/*
+ * Function to remove a name from an indexed directory.
+ */
+void removeName(DirIndex* dir, const char* name) {
+    size_t position = findName(dir, name);
+    if(position == dir->nameNum || strcmp(dir->names[position].name, name) != 0) return;
+    free(dir->names[position].name);
+    memmove(dir->names + position, dir->names + position + 1, (dir->nameNum - position - 1) * sizeof(IndexedName));
+    dir->nameNum--;
+}
+
+int compareNames(const void* a, const void* b) {
+    return strcmp(((const IndexedName*) a)->name, ((const IndexedName*) b)->name);
+}
+
+/*
+ * Function to read the names of an indexed directory, replacing those it had.
+ */
+void readDirIndex(DirIndex* dir) {
+    for(size_t i = 0; i < dir->nameNum; i++) {
+        free(dir->names[i].name);
+    }
+    dir->nameNum = 0;
+    DIR* stream = opendir(dir->path);
+    if(stream == NULL) return;
+    struct stat info;
+    if(fstat(dirfd(stream), &info) == 0) dir->mtime = info.st_mtim;
+
+    struct dirent* entry = NULL;
+    while((entry = readdir(stream)) != NULL) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if(dir->nameNum == dir->nameCapacity) {
+            dir->nameCapacity = (dir->nameCapacity == 0) ? 64 : 2 * dir->nameCapacity;
+            dir->names = realloc(dir->names, dir->nameCapacity * sizeof(IndexedName));
+        }
+        dir->names[dir->nameNum].name = strdup(entry->d_name);
+        dir->names[dir->nameNum].flags = nameFlags(dirfd(stream), entry->d_name);
+        dir->nameNum++;
+    }
+    closedir(stream);
+    qsort(dir->names, dir->nameNum, sizeof(IndexedName), compareNames);
+}
+
+/*
+ * Function to remove a directory from the index.
+ */
+void dropDirIndex(DirIndex* dir) {
+    for(DirIndex** link = &dirIndexes; *link != NULL; link = &(*link)->next) {
+        if(*link == dir) {
+            *link = dir->next;
+            break;
+        }
+    }
+    if(dir->watch != -1) inotify_rm_watch(inotifyFd, dir->watch);
+    for(size_t i = 0; i < dir->nameNum; i++) {
+        free(dir->names[i].name);
+    }
+    free(dir->names);
+    free(dir->path);
+    free(dir);
+}
+
+/*
+ * Function to get the index of a directory (an absolute path ending with a '/'), reading and watching it if it is not
+ * indexed yet. The least recently used visited directory is dropped when there are more than COMPLETE_DIR_MAX.
+ * Returns the index, NULL if the directory cannot be read.
+ */
+DirIndex* indexDirectory(const char* path) {
+    DirIndex* dir = dirIndexes;
+    while(dir != NULL && strcmp(dir->path, path) != 0) {
+        dir = dir->next;
+    }
+    if(dir != NULL) {
+        dir->lastUsed = ++indexClock;
+        //Without a watch a directory is only checked when it is used.
+        struct stat info;
+        if(dir->watch == -1 && stat(path, &info) == 0 &&
+           (info.st_mtim.tv_sec != dir->mtime.tv_sec || info.st_mtim.tv_nsec != dir->mtime.tv_nsec)) {
+            readDirIndex(dir);
+        }
+        return dir;
+    }
+
+    struct stat info;
+    if(stat(path, &info) == -1 || !S_ISDIR(info.st_mode)) return NULL;
+    dir = calloc(1, sizeof(DirIndex));
+    dir->path = strdup(path);
+    dir->lastUsed = ++indexClock;
+    //The watch is added before the directory is read, so that no change falls in between.
+    dir->watch = inotify_add_watch(inotifyFd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+                                   IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    readDirIndex(dir);
+    dir->next = dirIndexes;
+    dirIndexes = dir;
+
+    size_t visitedNum = 0;
+    DirIndex* oldest = NULL;
+    //Directories of $PATH are not counted, nor dropped, even while $PATH is being updated.
+    for(DirIndex* candidate = dirIndexes; candidate != NULL; candidate = candidate->next) {
+        if(candidate->inPath) continue;
+        visitedNum++;
+        if(oldest == NULL || candidate->lastUsed < oldest->lastUsed) oldest = candidate;
+    }
+    if(visitedNum > COMPLETE_DIR_MAX) dropDirIndex(oldest);
+    return dir;
+}
+
+/*
+ * Function to index a directory the shell moved to, so that completing in it does not have to read it.
+ */
+void visitDirectory(const char* path) {
+    if(completionEnabled) indexDirectory(path);
+}
+
+/*
+ * Function to make the index follow $PATH: directories that left it become ordinary visited directories, those that
+ * joined it are read, and those that stayed are kept as they are.
+ */
+void updateCompletionPath() {
+    if(!completionEnabled) return;
+    const char* pathVar = getVarValue(&shellVars, "PATH");
+    if(pathVar == NULL) pathVar = "";
+    if(indexedPath != NULL && strcmp(indexedPath, pathVar) == 0) return;
+    free(indexedPath);
+    indexedPath = strdup(pathVar);
+
+    //Directories found in the new $PATH are marked 2 until the old ones are known.
+    const char* start = pathVar;
+    while(*start != '\0') {
+        const char* end = strchrnul(start, ':');
+        char path[DIR_MAX];
+        //Relative directories of $PATH depend on the working directory, they are not indexed.
+        if(end - start > 0 && *start == '/' && end - start + 2 < DIR_MAX) {
+            memcpy(path, start, end - start);
+            path[end - start] = '\0';
+            if(path[end - start - 1] != '/') strcat(path, "/");
+            DirIndex* dir = indexDirectory(path);
+            if(dir != NULL) dir->inPath = 2;
+        }
+        start = (*end == ':') ? end + 1 : end;
+    }
+    for(DirIndex* dir = dirIndexes; dir != NULL; dir = dir->next) {
+        dir->inPath = (dir->inPath == 2);
+    }
+}
+
+/*
+ * Function to apply the changes inotify reports in watched directories.
+ */
+void handleInotify(int fd, uint32_t events, void* data) {
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t size = 0;
+    while((size = read(fd, buffer, sizeof(buffer))) > 0) {
+        for(char* position = buffer; position < buffer + size; ) {
+            struct inotify_event* event = (struct inotify_event*) position;
+            position += sizeof(struct inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                //Changes were lost, every directory is read again.
+                for(DirIndex* dir = dirIndexes; dir != NULL; dir = dir->next) {
+                    readDirIndex(dir);
+                }
+                continue;
+            }
+            DirIndex* dir = dirIndexes;
+            while(dir != NULL && dir->watch != event->wd) {
+                dir = dir->next;
+            }
+            if(dir == NULL) continue;
+
+            if(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                //The directory is gone, or no longer at its path. A directory of $PATH is looked for again when
+                //$PATH is next followed.
+                if(event->mask & IN_IGNORED) dir->watch = -1;
+                if(dir->inPath) {
+                    free(indexedPath);
+                    indexedPath = NULL;
+                }
+                dropDirIndex(dir);
+            } else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                removeName(dir, event->name);
+            } else if(event->mask & (IN_CREATE | IN_MOVED_TO | IN_ATTRIB)) {
+                int dirFd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if(dirFd == -1) continue;
+                if(faccessat(dirFd, event->name, F_OK, AT_SYMLINK_NOFOLLOW) == 0) {
+                    addName(dir, event->name, nameFlags(dirFd, event->name));
+                }
+                close(dirFd);
+            }
+        }
+    }
+}
+
+/*
+ * Function to set up the completion index, in an interactive shell with the line editor.
+ */
+void initCompletion() {
+    inotifyFd = keepFdHigh(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    if(inotifyFd == -1 || eventLoopAdd(inotifyFd, EPOLLIN, handleInotify, NULL) == -1) {
+        if(inotifyFd != -1) close(inotifyFd);
+        inotifyFd = -1;
+    }
+    completionEnabled = 1;
+    updateCompletionPath();
+    visitDirectory(workDir);
+}
+
+/*
+ * Function to add the names of an indexed directory starting with prefix to a list of matches.
+ * Only executables are added when commands is non-zero, and hidden files only for a prefix starting with '.'.
+ * Directories are added with a '/' after their name.
+ */
+void collectNames(DirIndex* dir, const char* prefix, size_t prefixLength, int commands, char*** matches,
+                  size_t* matchNum, size_t* matchCapacity) {
+    for(size_t i = findName(dir, prefix); i < dir->nameNum; i++) {
+        IndexedName* name = &dir->names[i];
+        if(strncmp(name->name, prefix, prefixLength) != 0) break;
+        if(commands && !(name->flags & NAME_EXECUTABLE)) continue;
+        if(name->name[0] == '.' && prefix[0] != '.') continue;
+        if(*matchNum == *matchCapacity) {
+            *matchCapacity = (*matchCapacity == 0) ? 16 : 2 * *matchCapacity;
+            *matches = realloc(*matches, *matchCapacity * sizeof(char*));
+        }
+        size_t length = strlen(name->name);
+        char* match = malloc(length + 2);
+        memcpy(match, name->name, length);
+        match[length] = (name->flags & NAME_DIRECTORY) ? '/' : '\0';
+        match[length + 1] = '\0';
+        (*matches)[(*matchNum)++] = match;
+    }
+}
+
+int compareMatches(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/*
+ * Function to find the completions of a word: variable names for "$prefix", commands (built-ins and executables of
+ * $PATH) for the first word of a command without a '/', paths else. Completions replace the last path component
+ * (after the '$' for variables), which is what *replaceStore is set to the length of.
+ * Returns the sorted completions without duplicates, *matchNumStore of them, each to be freed.
+ */
+char** findCompletions(const char* word, size_t length, int command, size_t* replaceStore, size_t* matchNumStore) {
+    char** matches = NULL;
+    size_t matchNum = 0;
+    size_t matchCapacity = 0;
+    char prefix[DIR_MAX];
+
+    if(length > 0 && word[0] == '$') {
+        size_t prefixLength = length - 1;
+        for(size_t i = 0; i < shellVars.capacity; i++) {
+            Variable* variable = &shellVars.slots[i];
+            if(variable->entry == NULL || variable->nameLength < prefixLength) continue;
+            if(strncmp(variable->entry, word + 1, prefixLength) != 0) continue;
+            if(matchNum == matchCapacity) {
+                matchCapacity = (matchCapacity == 0) ? 16 : 2 * matchCapacity;
+                matches = realloc(matches, matchCapacity * sizeof(char*));
+            }
+            matches[matchNum++] = strndup(variable->entry, variable->nameLength);
+        }
+        *replaceStore = prefixLength;
+    } else if(command && memchr(word, '/', length) == NULL) {
+        if(length >= sizeof(prefix)) length = sizeof(prefix) - 1;
+        memcpy(prefix, word, length);
+        prefix[length] = '\0';
+        updateCompletionPath();
+        for(DirIndex* dir = dirIndexes; dir != NULL; dir = dir->next) {
+            if(dir->inPath) collectNames(dir, prefix, length, 1, &matches, &matchNum, &matchCapacity);
+        }
+        for(size_t i = 0; i < builtInNum; i++) {
+            if(strncmp(builtIns[i].name, prefix, length) != 0) continue;
+            if(matchNum == matchCapacity) {
+                matchCapacity = (matchCapacity == 0) ? 16 : 2 * matchCapacity;
+                matches = realloc(matches, matchCapacity * sizeof(char*));
+            }
+            matches[matchNum++] = strdup(builtIns[i].name);
+        }
+        *replaceStore = length;
+    } else {
+        //Split the word into the directory, made absolute, and the start of the name.
+        const char* slash = NULL;
+        for(size_t i = 0; i < length; i++) {
+            if(word[i] == '/') slash = word + i;
+        }
+        size_t dirLength = (slash != NULL) ? (size_t) (slash - word + 1) : 0;
+        size_t nameLength = length - dirLength;
+        char dirPath[DIR_MAX];
+        int written = 0;
+        if(dirLength > 0 && word[0] == '/') {
+            written = snprintf(dirPath, sizeof(dirPath), "%.*s", (int) dirLength, word);
+        } else if(dirLength >= 2 && word[0] == '~' && word[1] == '/') {
+            written = snprintf(dirPath, sizeof(dirPath), "%s%.*s", home, (int) dirLength - 2, word + 2);
+        } else {
+            written = snprintf(dirPath, sizeof(dirPath), "%s%.*s", workDir, (int) dirLength, word);
+        }
+        *replaceStore = nameLength;
+        if(written < 0 || (size_t) written >= sizeof(dirPath) || nameLength >= sizeof(prefix)) {
+            *matchNumStore = 0;
+            return NULL;
+        }
+        memcpy(prefix, word + dirLength, nameLength);
+        prefix[nameLength] = '\0';
+        DirIndex* dir = indexDirectory(dirPath);
+        if(dir != NULL) collectNames(dir, prefix, nameLength, 0, &matches, &matchNum, &matchCapacity);
+    }
+
+    if(matchNum > 1) qsort(matches, matchNum, sizeof(char*), compareMatches);
+    size_t kept = 0;
+    for(size_t i = 0; i < matchNum; i++) {
+        if(kept > 0 && strcmp(matches[kept - 1], matches[i]) == 0) {
+            free(matches[i]);
+        } else {
+            matches[kept++] = matches[i];
+        }
+    }
+    *matchNumStore = kept;
+    return matches;
+}
+
+/*---------------------------------------------End of completion section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of line editor section---------------------------------------------*/
+/*
+ * On a terminal, lines are read by a line editor with the terminal in raw mode: the cursor moves with the arrow keys,
+ * ^A/^E, Home and End, ^K, ^U and ^W delete to the end, to the start and the previous word, Up/Down (^P/^N) recall
+ * history, ^R searches it and Tab completes the word before the cursor. The line is redrawn whole after each key, scrolled sideways when it is wider than the
+ * terminal. Keys are read through the event loop, so jobs are still reaped while the shell waits for them.
+ */
+
+enum {
+    KEY_NONE = 256,
+    KEY_ESCAPE,
+    KEY_UP,
+    KEY_DOWN,
+    KEY_LEFT,
+    KEY_RIGHT,
+    KEY_HOME,
+    KEY_END,
+    KEY_DELETE
+};
+
+int editorEnabled = 0;
+struct termios cookedMode;      //Terminal settings outside of the editor.
+char* editBuffer = NULL;
+size_t editSize = 0;
+size_t editLength = 0;
+size_t editCursor = 0;
+char* savedEdit = NULL;         //Line being written when history recall started.
+char* refreshBuffer = NULL;
+size_t refreshSize = 0;
+unsigned char keyBuffer[64];    //Bytes read from the terminal and not handled yet.
+int keyBuffered = 0;
+int keyTaken = 0;
+
+/*
+ * Function to read one byte typed on the terminal, waiting for at most timeoutMs milliseconds (-1 for no limit).
+ * Returns the byte, -1 at the end of the input or if nothing was typed in time.
+ */
+int readByte(int timeoutMs) {
+    if(keyTaken == keyBuffered) {
+        keyTaken = keyBuffered = 0;
+        if(timeoutMs >= 0) {
+            struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+            if(poll(&input, 1, timeoutMs) <= 0) return -1;
+        } else {
+            struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+            while(historyIndexedNum < historyEntryNum && poll(&input, 1, 0) == 0) {
+                indexHistory(INDEX_CHUNK);
+            }
+            waitInput();
+        }
+        ssize_t result = read(STDIN_FILENO, keyBuffer, sizeof(keyBuffer));
+        stdinReady = 0;
+        if(result <= 0) return (result == -1 && (errno == EINTR || errno == EAGAIN)) ? KEY_NONE : -1;
+        keyBuffered = result;
+    }
+    return keyBuffer[keyTaken++];
+}
+
+/*
+ * Function to read a key, decoding the escape sequences of the cursor and editing keys.
+ * Returns the byte of an ordinary key, one of the KEY_ codes else, -1 at the end of the input.
+ */
+int readKey() {
+    int byte = readByte(-1);
+    if(byte != 27) return byte;
+
+    //A lone escape is not followed by the rest of a sequence.
+    int next = readByte(ESCAPE_WAIT_MS);
+    if(next == -1) return KEY_ESCAPE;
+    if(next != '[' && next != 'O') return KEY_NONE;
+    int code = readByte(ESCAPE_WAIT_MS);
+    int number = 0;
+    while(code >= '0' && code <= '9') {
+        number = 10 * number + code - '0';
+        code = readByte(ESCAPE_WAIT_MS);
+    }
+    switch(code) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        case '~':
+            if(number == 1 || number == 7) return KEY_HOME;
+            if(number == 4 || number == 8) return KEY_END;
+            if(number == 3) return KEY_DELETE;
+            return KEY_NONE;
+        default: return KEY_NONE;
+    }
+}
+
+/*
+ * Function to get the number of columns a part of a line takes, counting every UTF-8 character as one.
+ */
+size_t textColumns(const char* text, size_t length) {
+    size_t columns = 0;
+    for(size_t i = 0; i < length; i++) {
+        if(((unsigned char) text[i] & 0xc0) != 0x80) columns++;
+    }
+    return columns;
+}
+
+/*
+ * Function to redraw the line being edited after a prompt, with the cursor at byte cursor of the line.
+ * The part of the line shown is scrolled so that the cursor stays on the screen.
+ */
+void refreshLine(const char* prompt, size_t promptLength, const char* line, size_t length, size_t cursor) {
+    struct winsize window;
+    size_t columns = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_col > 0) ? window.ws_col : 80;
+    size_t promptColumns = textColumns(prompt, promptLength);
+    size_t room = (columns > promptColumns + 1) ? columns - promptColumns - 1 : 1;
+
+    size_t start = 0;
+    while(textColumns(line + start, cursor - start) > room) {
+        do {
+            start++;
+        } while(((unsigned char) line[start] & 0xc0) == 0x80);
+    }
+    size_t end = cursor;
+    while(end < length && textColumns(line + start, end - start) < room) {
+        do {
+            end++;
+        } while(end < length && ((unsigned char) line[end] & 0xc0) == 0x80);
+    }
+
+    //The whole line is drawn with a single write, so that it does not flicker.
+    size_t size = promptLength + (end - start) + 32;
+    if(size > refreshSize) {
+        refreshSize = 2 * size;
+        refreshBuffer = realloc(refreshBuffer, refreshSize);
+    }
+    size_t used = 0;
+    refreshBuffer[used++] = '\r';
+    memcpy(refreshBuffer + used, prompt, promptLength);
+    used += promptLength;
+    memcpy(refreshBuffer + used, line + start, end - start);
+    used += end - start;
+    used += sprintf(refreshBuffer + used, "\x1b[K\r");
+    size_t cursorColumn = promptColumns + textColumns(line + start, cursor - start);
+    if(cursorColumn > 0) used += sprintf(refreshBuffer + used, "\x1b[%zuC", cursorColumn);
+    write(STDOUT_FILENO, refreshBuffer, used);
+}
+
+/*
+ * Function to replace the line being edited, with the cursor at its end.
+ */
+void setEditLine(const char* line, size_t length) {
+    if(length + 1 > editSize) {
+        editSize = 2 * (length + 1);
+        editBuffer = realloc(editBuffer, editSize);
+    }
+    memmove(editBuffer, line, length);
+    editLength = length;
+    editCursor = length;
+}
+
+/*
+ * Function to insert bytes at the cursor.
+ */
+void insertEdit(const char* bytes, size_t count) {
+    if(editLength + count + 1 > editSize) {
+        editSize = 2 * (editLength + count + 1);
+        editBuffer = realloc(editBuffer, editSize);
+    }
+    memmove(editBuffer + editCursor + count, editBuffer + editCursor, editLength - editCursor);
+    memcpy(editBuffer + editCursor, bytes, count);
+    editLength += count;
+    editCursor += count;
+}
+
+/*
+ * Function to delete the bytes from start to end of the line being edited, leaving the cursor at start.
+ */
+void deleteEdit(size_t start, size_t end) {
+    memmove(editBuffer + start, editBuffer + end, editLength - end);
+    editLength -= end - start;
+    editCursor = start;
+}
+
+/*
+ * Function to get the position of the UTF-8 character before or after a position of the line being edited.
+ */
+size_t previousChar(size_t position) {
+    if(position == 0) return 0;
+    do {
+        position--;
+    } while(position > 0 && ((unsigned char) editBuffer[position] & 0xc0) == 0x80);
+    return position;
+}
+
+size_t nextChar(size_t position) {
+    if(position == editLength) return position;
+    do {
+        position++;
+    } while(position < editLength && ((unsigned char) editBuffer[position] & 0xc0) == 0x80);
+    return position;
+}
+
+/*
+ * Function to list completions below the line being edited, in columns.
+ */
+void listCompletions(char** matches, size_t matchNum) {
+    struct winsize window;
+    size_t columns = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_col > 0) ? window.ws_col : 80;
+    size_t shown = (matchNum > COMPLETE_LIST_MAX) ? COMPLETE_LIST_MAX : matchNum;
+    size_t width = 0;
+    for(size_t i = 0; i < shown; i++) {
+        if(strlen(matches[i]) > width) width = strlen(matches[i]);
+    }
+    width += 2;
+    size_t perRow = (columns / width > 0) ? columns / width : 1;
+    size_t rows = (shown + perRow - 1) / perRow;
+
+    //Terminal output is not translated in raw mode, lines end with "\r\n".
+    dprintf(STDOUT_FILENO, "\r\n");
+    for(size_t row = 0; row < rows; row++) {
+        for(size_t i = row; i < shown; i += rows) {
+            dprintf(STDOUT_FILENO, "%-*s", (i + rows < shown) ? (int) width : 0, matches[i]);
+        }
+        dprintf(STDOUT_FILENO, "\r\n");
+    }
+    if(shown < matchNum) dprintf(STDOUT_FILENO, "(%zu more)\r\n", matchNum - shown);
+}
+
+/*
+ * Function to complete the word before the cursor (Tab). A single completion is inserted whole, followed by a space
+ * unless it is a directory; several are extended to their longest common start, and listed when that adds nothing.
+ */
+void completeEdit() {
+    size_t start = editCursor;
+    while(start > 0 && strchr(" \t|&<>=:", editBuffer[start - 1]) == NULL) {
+        start--;
+    }
+    //The word names a command when only blanks separate it from the start of the line or of a pipeline stage.
+    size_t before = start;
+    while(before > 0 && (editBuffer[before - 1] == ' ' || editBuffer[before - 1] == '\t')) {
+        before--;
+    }
+    int command = (before == 0 || editBuffer[before - 1] == '|' || editBuffer[before - 1] == '&');
+
+    size_t replace = 0;
+    size_t matchNum = 0;
+    char** matches = findCompletions(editBuffer + start, editCursor - start, command, &replace, &matchNum);
+    if(matchNum == 0) {
+        write(STDOUT_FILENO, "\a", 1);
+    } else {
+        size_t common = strlen(matches[0]);
+        for(size_t i = 1; i < matchNum; i++) {
+            size_t j = 0;
+            while(j < common && matches[i][j] == matches[0][j]) {
+                j++;
+            }
+            common = j;
+        }
+        if(common > replace) insertEdit(matches[0] + replace, common - replace);
+        if(matchNum == 1 && matches[0][common - 1] != '/') {
+            insertEdit(" ", 1);
+        } else if(matchNum > 1 && common <= replace) {
+            listCompletions(matches, matchNum);
+        }
+    }
+    for(size_t i = 0; i < matchNum; i++) {
+        free(matches[i]);
+    }
+    free(matches);
+}
+
+/*
+ * Function to search the history backwards as a query is typed (^R), showing the newest entry containing it.
+ * ^R again goes to the next older entry, ^G restores the line, Enter runs the entry shown and any other key leaves
+ * it in the line for editing.
+ * Returns the key that ended the search, handled then by the editor.
+ */
+int reverseSearch() {
+    char query[SEARCH_MAX];
+    size_t queryLength = 0;
+    long match = historyEntryNum;
+    char* original = strndup(editBuffer, editLength);
+    size_t originalLength = editLength;
+    int key = 0;
+    int failed = 0;
+
+    while(1) {
+        char prompt[SEARCH_MAX + 32];
+        int promptLength = snprintf(prompt, sizeof(prompt), "(%sreverse-i-search)`%.*s': ", failed ? "failed " : "",
+                                    (int) queryLength, query);
+        size_t matchLength = 0;
+        const char* matchStart = (match < (long) historyEntryNum) ? historyEntry(match, &matchLength) : editBuffer;
+        if(match == (long) historyEntryNum) matchLength = editLength;
+        const char* found = (queryLength > 0) ? memmem(matchStart, matchLength, query, queryLength) : NULL;
+        size_t cursor = (found != NULL) ? (size_t) (found - matchStart) : 0;
+        refreshLine(prompt, promptLength, matchStart, matchLength, cursor);
+
+        key = readKey();
+        long next = -1;
+        if(key == 18) {
+            next = searchHistory(query, queryLength, match);
+        } else if(key == 127 || key == 8) {
+            if(queryLength > 0) queryLength--;
+            next = (queryLength > 0) ? searchHistory(query, queryLength, historyEntryNum) : (long) historyEntryNum;
+        } else if(key >= 32 && key < 127 && queryLength < SEARCH_MAX) {
+            query[queryLength++] = key;
+            next = searchHistory(query, queryLength, (match < (long) historyEntryNum) ? match + 1 : match);
+        } else {
+            break;
+        }
+        failed = (next == -1);
+        if(next != -1) match = next;
+    }
+
+    if(key == 7 || key == 3) {
+        setEditLine(original, originalLength);
+        key = KEY_NONE;
+    } else if(match < (long) historyEntryNum) {
+        size_t matchLength = 0;
+        const char* entry = historyEntry(match, &matchLength);
+        setEditLine(entry, matchLength);
+    }
+    free(original);
+    return key;
+}
+
+/*
+ * Function to switch the terminal between raw mode, where every key is read as it is typed without being echoed,
+ * and the settings commands run with.
+ */
+void setRawMode(int raw) {
+    struct termios mode = cookedMode;
+    if(raw) {
+        mode.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+        mode.c_cflag |= CS8;
+        mode.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+        mode.c_cc[VMIN] = 1;
+        mode.c_cc[VTIME] = 0;
+    }
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &mode);
+}
+
+/*
+ * Function to enable the line editor and load the history, in an interactive shell on a capable terminal.
+ */
+void initLineEditor() {
+    const char* terminal = getVarValue(&shellVars, "TERM");
+    if(!jobControl || !isatty(STDOUT_FILENO) || terminal == NULL || strcmp(terminal, "dumb") == 0) return;
+    if(tcgetattr(STDIN_FILENO, &cookedMode) == -1) return;
+    editorEnabled = 1;
+    openHistory();
+    initCompletion();
+}
+
+/*
+ * Function to read a line with the line editor after a prompt.
+ * The line (without its newline) stays valid until the next call.
+ * Returns 0 once the end of the input has been reached (^D on an empty line), 1 else.
+ */
+int editLine(const char* prompt, size_t promptLength, const char** lineStore, size_t* lengthStore) {
+    refreshHistory();
+    size_t position = historyEntryNum;      //Entry shown by history recall, historyEntryNum for the new line.
+    setEditLine("", 0);
+    setRawMode(1);
+
+    int key = KEY_NONE;
+    int result = 1;
+    while(1) {
+        //A key that ended a search is handled like a typed one.
+        if(key == KEY_NONE) {
+            refreshLine(prompt, promptLength, editBuffer, editLength, editCursor);
+            key = readKey();
+        }
+        int handled = key;
+        key = KEY_NONE;
+
+        if(handled == -1 || (handled == 4 && editLength == 0)) {
+            //^D on an empty line ends the input.
+            write(STDOUT_FILENO, "\r\n", 2);
+            result = 0;
+            break;
+        } else if(handled == '\r' || handled == '\n') {
+            refreshLine(prompt, promptLength, editBuffer, editLength, editLength);
+            write(STDOUT_FILENO, "\r\n", 2);
+            break;
+        } else if(handled == 3) {
+            //^C abandons the line.
+            refreshLine(prompt, promptLength, editBuffer, editLength, editLength);
+            write(STDOUT_FILENO, "^C\r\n", 4);
+            setEditLine("", 0);
+            position = historyEntryNum;
+            lastStatus = 130;
+        } else if(handled == 18) {
+            key = reverseSearch();
+            position = historyEntryNum;
+            if(key == KEY_ESCAPE) key = KEY_NONE;
+        } else if(handled == KEY_UP || handled == 16 || handled == KEY_DOWN || handled == 14) {
+            size_t target = position;
+            if((handled == KEY_UP || handled == 16) && position > 0) target--;
+            if((handled == KEY_DOWN || handled == 14) && position < historyEntryNum) target++;
+            if(target == position) continue;
+            if(position == historyEntryNum) {
+                free(savedEdit);
+                savedEdit = strndup(editBuffer, editLength);
+            }
+            position = target;
+            if(position == historyEntryNum) {
+                setEditLine(savedEdit, strlen(savedEdit));
+            } else {
+                size_t entryLength = 0;
+                const char* entry = historyEntry(position, &entryLength);
+                setEditLine(entry, entryLength);
+            }
+        } else if(handled == KEY_LEFT || handled == 2) {
+            editCursor = previousChar(editCursor);
+        } else if(handled == KEY_RIGHT || handled == 6) {
+            editCursor = nextChar(editCursor);
+        } else if(handled == KEY_HOME || handled == 1) {
+            editCursor = 0;
+        } else if(handled == KEY_END || handled == 5) {
+            editCursor = editLength;
+        } else if(handled == 127 || handled == 8) {
+            deleteEdit(previousChar(editCursor), editCursor);
+        } else if(handled == KEY_DELETE || handled == 4) {
+            deleteEdit(editCursor, nextChar(editCursor));
+        } else if(handled == 11) {
+            deleteEdit(editCursor, editLength);
+        } else if(handled == 21) {
+            deleteEdit(0, editCursor);
+        } else if(handled == 23) {
+            size_t start = editCursor;
+            while(start > 0 && editBuffer[start - 1] == ' ') {
+                start--;
+            }
+            while(start > 0 && editBuffer[start - 1] != ' ') {
+                start--;
+            }
+            deleteEdit(start, editCursor);
+        } else if(handled == 12) {
+            write(STDOUT_FILENO, "\x1b[H\x1b[2J", 7);
+        } else if(handled == '\t') {
+            completeEdit();
+        } else if(handled >= 32 && handled < 256 && handled != 127) {
+            char byte = handled;
+            insertEdit(&byte, 1);
+        }
+    }
+    setRawMode(0);
+
+    editBuffer[editLength] = '\0';
+    if(result) addHistory(editBuffer, editLength);
+    *lineStore = editBuffer;
+    *lengthStore = editLength;
+    return result;
+}
+
+/*---------------------------------------------End of line editor section---------------------------------------------*/
+
+/*
+ * Function to print prompt to user then take input, continued being non-zero for the next line of an incomplete
+ * command, which gets the prompt "> ".
+ * The line (without its newline) stays valid until the next call, the buffer grows to hold lines of any length.
+ * Returns 0 once the end of the input has been reached, 1 else.
+ */
+int takeInput(int continued, const char** lineStore, size_t* lengthStore) {
+    char prompt[DIR_MAX + 16] = "> ";
+    int promptLength = continued ? 2 : formatPrompt(prompt, sizeof(prompt));
+    if(editorEnabled) return editLine(prompt, promptLength, lineStore, lengthStore);
+    printf("%s", prompt);
+    fflush(stdout);
+
+    //Drop the line returned by the previous call.
+    inputBuffered -= inputTaken;
+    memmove(inputBuffer, inputBuffer + inputTaken, inputBuffered);
+    inputTaken = 0;
+
+    while(1) {
+        char* newline = memchr(inputBuffer, '\n', inputBuffered);
+
+        //Return a full line, or what is left at the end of the input.
+        if(newline != NULL || (inputEnded && inputBuffered > 0)) {
+            *lineStore = inputBuffer;
+            *lengthStore = (newline != NULL) ? (size_t) (newline - inputBuffer) : inputBuffered;
+            inputTaken = (newline != NULL) ? *lengthStore + 1 : *lengthStore;
+            return 1;
+        }
+        if(inputEnded) return 0;
+
+        if(inputBuffered == inputSize) {
+            inputSize = (inputSize == 0) ? INPUT_MAX : 2 * inputSize;
+            inputBuffer = realloc(inputBuffer, inputSize);
+        }
+        waitInput();
+        ssize_t result = read(STDIN_FILENO, inputBuffer + inputBuffered, inputSize - inputBuffered);
+        stdinReady = 0;
+        if(result > 0) {
+            inputBuffered += result;
+        } else if(result == 0) {
+            inputEnded = 1;
+        } else if(errno != EINTR && errno != EAGAIN) {
+            handleReadError();
+            inputEnded = 1;
+        }
+    }
+}
+
+/*---------------------------------------------Beginning of globbing section---------------------------------------------*/
+/*
+ * Words with an unquoted '*', '?' or '[...]' are patterns, replaced by the paths they match in sorted order, or kept
+ * as they are when nothing matches. A pattern is split at '/' and each component is compiled once into tokens (runs
+ * of literal bytes, '?', '*' and 256-bit character classes) matched against every name of a directory without going
+ * through the pattern text again; a component without wildcards only extends the path, its directory is not read.
+ * Directories are read with getdents64() into a large buffer, so a directory of hundreds of thousands of files takes
+ * a few system calls, and the type returned with each name tells directories apart without a stat() per file.
+ * A "**" component matches any number of directories. The directories still to be read are kept in a queue, which
+ * with "set -o globthreads=N" N threads share, each reading other directories of the tree. The matched paths are
+ * gathered in one growing buffer instead of being allocated one by one.
+ */
+
+typedef enum GlobTokenType {
+    TOKEN_LITERAL,
+    TOKEN_ANY,                  //'?'
+    TOKEN_STAR,                 //'*'
+    TOKEN_CLASS                 //'[...]'
+} GlobTokenType;
+
+typedef struct GlobToken {
+    GlobTokenType type;
+    const char* literal;
+    size_t length;
+    uint64_t classBits[4];      //Bytes matched by TOKEN_CLASS.
+} GlobToken;
+
+typedef struct GlobComponent {
+    const char* name;           //Unescaped text of a component without wildcards.
+    size_t length;
+    int wildcard;               //Non-zero if names are matched against the tokens, zero if name is the only match.
+    int recursive;              //Non-zero for "**".
+    int matchesHidden;          //Non-zero if the component starts with a '.', which names starting with one need.
+    GlobToken* tokens;
+    size_t tokenNum;
+    size_t minLength;           //Length of the shortest name that can match.
+    const char* suffix;         //Literal bytes ending every matching name (those after the last '*').
+    size_t suffixLength;
+} GlobComponent;
+
+typedef struct GlobPattern {
+    GlobComponent* components;
+    size_t componentNum;
+    int absolute;
+    int dirOnly;                //Non-zero if the pattern ends with '/', which only directories match.
+    char* storage;              //Unescaped literal text of the components.
+    GlobToken* tokens;
+} GlobPattern;
+
+typedef struct GlobMatches {
+    char* text;                 //Matched paths, each terminated by '\0'.
+    size_t length;
+    size_t size;
+    size_t* offsets;            //Start of each path in text.
+    size_t count;
+    size_t capacity;
+} GlobMatches;
+
+typedef struct GlobTask {
+    char* path;                 //Directory whose names are matched, "" for the current one, else ending with '/'.
+    size_t pathLength;
+    size_t component;           //Component the names are matched against.
+    struct GlobTask* next;
+} GlobTask;
+
+typedef struct GlobWalk {
+    const GlobPattern* pattern;
+    GlobTask* queue;
+    int pending;                //Tasks queued or being run, the walk is over when none are left.
+    int threaded;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} GlobWalk;
+
+typedef struct GlobWorker {
+    GlobWalk* walk;
+    char* buffer;               //Directory entries read by the worker.
+    GlobMatches matches;
+    pthread_t thread;
+} GlobWorker;
+
+int globThreads = 1;            //Threads reading directories for "**", set with "set -o globthreads=N".
+GlobMatches globMatches = {NULL, 0, 0, NULL, 0, 0};
+char* globReadBuffer = NULL;    //Directory entries read by the shell's own thread.
+
+/*
+ * Function to parse the character class starting at a '[', adding the bytes it matches to token.
+ * Returns the end of the class, after its ']', or NULL if the '[' is not closed and so is an ordinary character.
+ */
+const char* compileClass(const char* c, const char* end, GlobToken* token) {
+    static const struct {
+        const char* name;
+        int (*test)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl}, {"digit", isdigit},
+        {"graph", isgraph}, {"lower", islower}, {"print", isprint}, {"punct", ispunct}, {"space", isspace},
+        {"upper", isupper}, {"xdigit", isxdigit},
+    };
+    memset(token->classBits, 0, sizeof(token->classBits));
+    token->type = TOKEN_CLASS;
+    c++;
+    int negated = (c < end && (*c == '!' || *c == '^'));
+    if(negated) c++;
+
+    //A ']' right after the '[' (or its negation) is one of the bytes of the class.
+    for(const char* first = c; c < end && (*c != ']' || c == first); c++) {
+        if(*c == '[' && c + 1 < end && c[1] == ':') {
+            const char* close = c + 2;
+            while(close + 1 < end && !(close[0] == ':' && close[1] == ']')) {
+                close++;
+            }
+            size_t i = 0;
+            while(i < sizeof(classes) / sizeof(classes[0]) && (strlen(classes[i].name) != (size_t) (close - c - 2) ||
+                                                               memcmp(classes[i].name, c + 2, close - c - 2) != 0)) {
+                i++;
+            }
+            if(close + 1 < end && i < sizeof(classes) / sizeof(classes[0])) {
+                for(int byte = 0; byte < 256; byte++) {
+                    if(classes[i].test(byte)) token->classBits[byte >> 6] |= (uint64_t) 1 << (byte & 63);
+                }
+                c = close + 1;
+                continue;
+            }
+        }
+        if(*c == '\\' && c + 1 < end) c++;
+        unsigned char low = *c;
+        unsigned char high = low;
+        if(c + 2 < end && c[1] == '-' && c[2] != ']') {
+            c += 2;
+            if(*c == '\\' && c + 1 < end) c++;
+            high = *c;
+        }
+        for(int byte = low; byte <= high; byte++) {
+            token->classBits[byte >> 6] |= (uint64_t) 1 << (byte & 63);
+        }
+    }
+    if(c == end) return NULL;
+    if(negated) {
+        for(int i = 0; i < 4; i++) {
+            token->classBits[i] = ~token->classBits[i];
+        }
+    }
+    return c + 1;
+}
+
+/*
+ * Function to compile a component of a pattern, from start to end, into tokens.
+ * Its literal bytes are written unescaped at *storage, which is moved past them.
+ */
+void compileComponent(GlobComponent* component, const char* start, const char* end, char** storage) {
+    component->name = *storage;
+    component->wildcard = 0;
+    component->recursive = (end - start == 2 && start[0] == '*' && start[1] == '*');
+    component->matchesHidden = (*start == '.');
+    component->minLength = 0;
+    component->suffix = NULL;
+    component->suffixLength = 0;
+
+    size_t tokenNum = 0;
+    GlobToken* tokens = component->tokens;
+    for(const char* c = start; c < end;) {
+        GlobToken* token = &tokens[tokenNum];
+        if(*c == '*') {
+            while(c < end && *c == '*') {
+                c++;
+            }
+            token->type = TOKEN_STAR;
+            component->wildcard = 1;
+            tokenNum++;
+            continue;
+        }
+        if(*c == '?') {
+            token->type = TOKEN_ANY;
+            component->wildcard = 1;
+            component->minLength++;
+            tokenNum++;
+            c++;
+            continue;
+        }
+        if(*c == '[') {
+            const char* next = compileClass(c, end, token);
+            if(next != NULL) {
+                component->wildcard = 1;
+                component->minLength++;
+                tokenNum++;
+                c = next;
+                continue;
+            }
+        }
+        if(*c == '\\' && c + 1 < end) c++;
+        if(tokenNum > 0 && tokens[tokenNum - 1].type == TOKEN_LITERAL) {
+            tokens[tokenNum - 1].length++;
+        } else {
+            token->type = TOKEN_LITERAL;
+            token->literal = *storage;
+            token->length = 1;
+            tokenNum++;
+        }
+        *(*storage)++ = *c++;
+        component->minLength++;
+    }
+    component->tokenNum = tokenNum;
+    component->length = *storage - component->name;
+    *(*storage)++ = '\0';
+
+    //Names not ending with the literal after the last '*' are rejected before the tokens are matched.
+    if(tokenNum >= 2 && tokens[tokenNum - 1].type == TOKEN_LITERAL && tokens[tokenNum - 2].type == TOKEN_STAR) {
+        component->suffix = tokens[tokenNum - 1].literal;
+        component->suffixLength = tokens[tokenNum - 1].length;
+    }
+}
+
+/*
+ * Function to compile a pattern, in which a backslash makes the next character literal.
+ * A trailing "**" matches every name below the directories, like "**" followed by "*".
+ * Returns 0 on success, -1 if no component has a wildcard, the pattern then being an ordinary word.
+ */
+int compileGlob(const char* text, size_t length, GlobPattern* pattern) {
+    const char* end = text + length;
+    pattern->absolute = (length > 0 && text[0] == '/');
+    pattern->dirOnly = (length > 0 && text[length - 1] == '/');
+    pattern->componentNum = 0;
+    //Every component has at most one token per byte, and one more for a trailing "**".
+    pattern->components = malloc((length + 2) / 2 * sizeof(GlobComponent) + sizeof(GlobComponent));
+    pattern->tokens = malloc((length + 1) * sizeof(GlobToken));
+    pattern->storage = malloc(2 * length + 4);
+
+    char* storage = pattern->storage;
+    GlobToken* tokens = pattern->tokens;
+    int wildcard = 0;
+    for(const char* start = text; start < end;) {
+        const char* slash = memchr(start, '/', end - start);
+        if(slash == NULL) slash = end;
+        if(slash > start) {
+            GlobComponent* component = &pattern->components[pattern->componentNum];
+            component->tokens = tokens;
+            compileComponent(component, start, slash, &storage);
+            //"**/**" matches what "**" does.
+            if(!component->recursive || pattern->componentNum == 0 || !component[-1].recursive) {
+                tokens += component->tokenNum;
+                wildcard |= component->wildcard;
+                pattern->componentNum++;
+            }
+        }
+        start = slash + 1;
+    }
+    if(pattern->componentNum > 0 && pattern->components[pattern->componentNum - 1].recursive) {
+        GlobComponent* component = &pattern->components[pattern->componentNum++];
+        component->tokens = tokens;
+        const char* star = "*";
+        compileComponent(component, star, star + 1, &storage);
+    }
+    if(!wildcard) {
+        free(pattern->components);
+        free(pattern->tokens);
+        free(pattern->storage);
+        return -1;
+    }
+    return 0;
+}
+
+void freeGlob(GlobPattern* pattern) {
+    free(pattern->components);
+    free(pattern->tokens);
+    free(pattern->storage);
+}
+
+/*
+ * Function to tell whether a name matches a component with wildcards.
+ * A '*' first matches nothing and takes one more byte each time what follows it fails to match, going back to the
+ * last '*' only, which is enough for glob patterns and keeps matching linear in most cases.
+ */
+int matchComponent(const GlobComponent* component, const char* name, size_t length) {
+    if(length < component->minLength) return 0;
+    if(name[0] == '.' && !component->matchesHidden) return 0;
+    if(component->suffixLength > 0 &&
+       memcmp(name + length - component->suffixLength, component->suffix, component->suffixLength) != 0) {
+        return 0;
+    }
+
+    size_t token = 0;
+    size_t position = 0;
+    size_t starToken = SIZE_MAX;
+    size_t starPosition = 0;
+    while(token < component->tokenNum || position < length) {
+        if(token < component->tokenNum) {
+            const GlobToken* current = &component->tokens[token];
+            if(current->type == TOKEN_STAR) {
+                starToken = token++;
+                starPosition = position;
+                continue;
+            }
+            int matched = 0;
+            if(current->type == TOKEN_LITERAL) {
+                matched = (length - position >= current->length &&
+                           memcmp(name + position, current->literal, current->length) == 0);
+            } else if(position < length) {
+                unsigned char byte = name[position];
+                matched = (current->type == TOKEN_ANY || (current->classBits[byte >> 6] >> (byte & 63)) & 1);
+            }
+            if(matched) {
+                position += (current->type == TOKEN_LITERAL) ? current->length : 1;
+                token++;
+                continue;
+            }
+        }
+        if(starToken == SIZE_MAX || starPosition >= length) return 0;
+        token = starToken + 1;
+        position = ++starPosition;
+    }
+    return 1;
+}
+
+/*
+ * Function to add a path, made of a directory path and a name, to a set of matches.
+ */
+void addGlobMatch(GlobMatches* matches, const char* path, size_t pathLength, const char* name, size_t nameLength,
+                  int slash) {
+    size_t length = pathLength + nameLength + slash + 1;
+    if(matches->length + length > matches->size) {
+        matches->size = 2 * (matches->length + length) + 4096;
+        matches->text = realloc(matches->text, matches->size);
+    }
+    if(matches->count == matches->capacity) {
+        matches->capacity = (matches->capacity == 0) ? 256 : 2 * matches->capacity;
+        matches->offsets = realloc(matches->offsets, matches->capacity * sizeof(size_t));
+    }
+    char* text = matches->text + matches->length;
+    memcpy(text, path, pathLength);
+    memcpy(text + pathLength, name, nameLength);
+    if(slash) text[pathLength + nameLength] = '/';
+    text[length - 1] = '\0';
+    matches->offsets[matches->count++] = matches->length;
+    matches->length += length;
+}
+
+/*
+ * Function to queue a directory, made of a directory path and a name, whose names are to be matched against a
+ * component of the pattern.
+ */
+void queueGlobTask(GlobWalk* walk, const char* path, size_t pathLength, const char* name, size_t nameLength,
+                   size_t component) {
+    GlobTask* task = malloc(sizeof(GlobTask) + pathLength + nameLength + 2);
+    task->path = (char*) (task + 1);
+    memcpy(task->path, path, pathLength);
+    memcpy(task->path + pathLength, name, nameLength);
+    task->pathLength = pathLength + nameLength;
+    if(nameLength > 0) task->path[task->pathLength++] = '/';
+    task->path[task->pathLength] = '\0';
+    task->component = component;
+
+    if(walk->threaded) pthread_mutex_lock(&walk->lock);
+    task->next = walk->queue;
+    walk->queue = task;
+    walk->pending++;
+    if(walk->threaded) {
+        pthread_cond_signal(&walk->changed);
+        pthread_mutex_unlock(&walk->lock);
+    }
+}
+
+/*
+ * Function to tell whether a name of a directory is a directory itself, from the type read with it when it is known.
+ * With follow, a symbolic link to a directory counts as one.
+ */
+int isGlobDirectory(int dirFd, const char* name, unsigned char type, int follow) {
+    if(type == DT_DIR) return 1;
+    if(type != DT_UNKNOWN && (type != DT_LNK || !follow)) return 0;
+    struct stat info;
+    return fstatat(dirFd, name, &info, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode);
+}
+
+/*
+ * Function to match the names of the directory of a task against its component, adding the paths that match the last
+ * one to matches and queueing the directories that match the others. For "**" the names are matched against the next
+ * component, and the directories are queued for "**" again.
+ */
+void runGlobTask(GlobWalk* walk, GlobTask* task, char* buffer, GlobMatches* matches) {
+    const GlobPattern* pattern = walk->pattern;
+    int recursive = pattern->components[task->component].recursive;
+    size_t index = task->component + recursive;
+    const GlobComponent* component = &pattern->components[index];
+    int last = (index == pattern->componentNum - 1);
+
+    //A name without wildcards is looked up directly.
+    if(!recursive && !component->wildcard) {
+        if(!last) {
+            queueGlobTask(walk, task->path, task->pathLength, component->name, component->length, index + 1);
+            return;
+        }
+        char* path = malloc(task->pathLength + component->length + 1);
+        memcpy(path, task->path, task->pathLength);
+        memcpy(path + task->pathLength, component->name, component->length + 1);
+        struct stat info;
+        if(fstatat(AT_FDCWD, path, &info, pattern->dirOnly ? 0 : AT_SYMLINK_NOFOLLOW) == 0 &&
+           (!pattern->dirOnly || S_ISDIR(info.st_mode))) {
+            addGlobMatch(matches, task->path, task->pathLength, component->name, component->length, pattern->dirOnly);
+        }
+        free(path);
+        return;
+    }
+
+    int dirFd = open(task->pathLength > 0 ? task->path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirFd == -1) return;
+    ssize_t size = 0;
+    while((size = getdents64(dirFd, buffer, GLOB_READ_SIZE)) > 0) {
+        for(ssize_t offset = 0; offset < size;) {
+            struct dirent64* entry = (struct dirent64*) (buffer + offset);
+            offset += entry->d_reclen;
+            const char* name = entry->d_name;
+            if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+            size_t length = strlen(name);
+
+            if(recursive && name[0] != '.' && isGlobDirectory(dirFd, name, entry->d_type, 0)) {
+                queueGlobTask(walk, task->path, task->pathLength, name, length, task->component);
+            }
+            int matched = component->wildcard ? matchComponent(component, name, length) :
+                          (length == component->length && memcmp(name, component->name, length) == 0);
+            if(!matched) continue;
+            if(last && !pattern->dirOnly) {
+                addGlobMatch(matches, task->path, task->pathLength, name, length, 0);
+            } else if(isGlobDirectory(dirFd, name, entry->d_type, 1)) {
+                if(last) {
+                    addGlobMatch(matches, task->path, task->pathLength, name, length, 1);
+                } else {
+                    queueGlobTask(walk, task->path, task->pathLength, name, length, index + 1);
+                }
+            }
+        }
+    }
+    close(dirFd);
+}
+
+/*
+ * Function run by the threads of a walk, taking tasks from the queue until none are left or running.
+ */
+void* globWorker(void* data) {
+    GlobWorker* worker = data;
+    GlobWalk* walk = worker->walk;
+    pthread_mutex_lock(&walk->lock);
+    while(1) {
+        while(walk->queue == NULL && walk->pending > 0) {
+            pthread_cond_wait(&walk->changed, &walk->lock);
+        }
+        if(walk->queue == NULL) break;
+        GlobTask* task = walk->queue;
+        walk->queue = task->next;
+        pthread_mutex_unlock(&walk->lock);
+        runGlobTask(walk, task, worker->buffer, &worker->matches);
+        free(task);
+        pthread_mutex_lock(&walk->lock);
+        if(--walk->pending == 0) pthread_cond_broadcast(&walk->changed);
+    }
+    pthread_mutex_unlock(&walk->lock);
+    return NULL;
+}
+
+typedef struct GlobSortKey {
+    uint64_t prefix;            //First 8 bytes of the path, most significant first, so prefixes compare like the paths.
+    const char* path;
+} GlobSortKey;
+
+int compareGlobMatches(const void* a, const void* b) {
+    const GlobSortKey* first = a;
+    const GlobSortKey* second = b;
+    if(first->prefix != second->prefix) return (first->prefix < second->prefix) ? -1 : 1;
+    return strcmp(first->path, second->path);
+}
+
+/*
+ * Function to sort the paths of globMatches.
+ * Most paths differ in their first 8 bytes, which are compared as one integer before the strings are.
+ */
+void sortGlobMatches() {
+    GlobSortKey* keys = malloc(globMatches.count * sizeof(GlobSortKey));
+    for(size_t i = 0; i < globMatches.count; i++) {
+        const char* path = globMatches.text + globMatches.offsets[i];
+        const char* byte = path;
+        uint64_t prefix = 0;
+        for(int j = 0; j < 8; j++) {
+            prefix = (prefix << 8) | (unsigned char) *byte;
+            if(*byte != '\0') byte++;
+        }
+        keys[i].prefix = prefix;
+        keys[i].path = path;
+    }
+    qsort(keys, globMatches.count, sizeof(GlobSortKey), compareGlobMatches);
+    for(size_t i = 0; i < globMatches.count; i++) {
+        globMatches.offsets[i] = keys[i].path - globMatches.text;
+    }
+    free(keys);
+}
+
+/*
+ * Function to find the paths matching a pattern, in which a backslash makes the next character literal.
+ * The paths are left sorted in globMatches, until the next call.
+ * Returns the number of paths, -1 if the pattern has no wildcard and is an ordinary word.
+ */
+long expandGlob(const char* text, size_t length) {
+    GlobPattern pattern;
+    if(compileGlob(text, length, &pattern) == -1) return -1;
+    if(globReadBuffer == NULL) globReadBuffer = malloc(GLOB_READ_SIZE);
+    globMatches.length = 0;
+    globMatches.count = 0;
+
+    GlobWalk walk = {&pattern, NULL, 0, 0};
+    queueGlobTask(&walk, "/", pattern.absolute, "", 0, 0);
+    int recursive = 0;
+    for(size_t i = 0; i < pattern.componentNum; i++) {
+        recursive |= pattern.components[i].recursive;
+    }
+
+    if(!recursive || globThreads == 1) {
+        while(walk.queue != NULL) {
+            GlobTask* task = walk.queue;
+            walk.queue = task->next;
+            runGlobTask(&walk, task, globReadBuffer, &globMatches);
+            free(task);
+        }
+    } else {
+        //The shell's thread is one of the workers, its matches go directly to globMatches.
+        walk.threaded = 1;
+        pthread_mutex_init(&walk.lock, NULL);
+        pthread_cond_init(&walk.changed, NULL);
+        GlobWorker* workers = calloc(globThreads, sizeof(GlobWorker));
+        workers[0].walk = &walk;
+        workers[0].buffer = globReadBuffer;
+        workers[0].matches = globMatches;
+        for(int i = 1; i < globThreads; i++) {
+            workers[i].walk = &walk;
+            workers[i].buffer = malloc(GLOB_READ_SIZE);
+            if(pthread_create(&workers[i].thread, NULL, globWorker, &workers[i]) != 0) {
+                free(workers[i].buffer);
+                workers[i].walk = NULL;
+            }
+        }
+        globWorker(&workers[0]);
+        globMatches = workers[0].matches;
+        for(int i = 1; i < globThreads; i++) {
+            if(workers[i].walk == NULL) continue;
+            pthread_join(workers[i].thread, NULL);
+            free(workers[i].buffer);
+            GlobMatches* matches = &workers[i].matches;
+            for(size_t j = 0; j < matches->count; j++) {
+                addGlobMatch(&globMatches, "", 0, matches->text + matches->offsets[j],
+                             strlen(matches->text + matches->offsets[j]), 0);
+            }
+            free(matches->text);
+            free(matches->offsets);
+        }
+        free(workers);
+        pthread_mutex_destroy(&walk.lock);
+        pthread_cond_destroy(&walk.changed);
+    }
+    freeGlob(&pattern);
+
+    sortGlobMatches();
+    return globMatches.count;
+}
+
+/*---------------------------------------------End of globbing section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of parser section---------------------------------------------*/
+/*
+ * A line is parsed into a pipeline in a single pass: quotes are removed, and variables and patterns are expanded
+ * while words are scanned, and every word, argument vector and command is written into an arena that is reset between
+ * lines, so parsing a line allocates nothing and there is no limit on the number or length of arguments.
+ * Runs of ordinary characters are skipped 16 bytes at a time with SSE2 where available.
+ */
+
+Arena lineArena;
+char** wordList = NULL;         //Words of the command being parsed, copied into the arena once it is complete.
+size_t wordListSize = 0;
+Redirect* redirectList = NULL;  //Redirections of the command being parsed, likewise.
+size_t redirectListSize = 0;
+size_t* quotedList = NULL;      //Offsets of the quoted wildcard characters of the word being parsed.
+size_t quotedListSize = 0;
+char* patternBuffer = NULL;     //Pattern of the word being expanded, with its quoted wildcard characters escaped.
+size_t patternSize = 0;
+
+//Bytes that interrupt a run of ordinary characters, outside of quotes and inside double quotes.
+const char unquotedSpecials[] = " \t\r\n\"'\\$`|&#<>*?[";
+const char quotedSpecials[] = "\"\\$`";
+//Bytes of a word that are special in a pattern.
+const char globSpecials[] = "*?[\\";
+//Bytes that interrupt a run of ordinary characters when looking for the end of a command of a list.
+const char listSpecials[] = " \t\r\n\"'\\$`#;&|";
+unsigned char isUnquotedSpecial[256];
+unsigned char isQuotedSpecial[256];
+unsigned char isListSpecial[256];
+unsigned char isGlobSpecial[256];
+
+/*
+ * Function to make the next chunk of an arena current, reusing chunks kept from earlier lines when they are big enough.
+ */
+void arenaNextChunk(Arena* arena, size_t size) {
+    ArenaChunk* next = (arena->current != NULL) ? arena->current->next : arena->first;
+    if(next == NULL || next->size < size) {
+        size_t chunkSize = (size > ARENA_CHUNK) ? size : ARENA_CHUNK;
+        ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + chunkSize);
+        chunk->size = chunkSize;
+        chunk->next = next;
+        if(arena->current != NULL) {
+            arena->current->next = chunk;
+        } else {
+            arena->first = chunk;
+        }
+        next = chunk;
+    }
+    arena->current = next;
+    arena->used = 0;
+}
+
+/*
+ * Function to allocate memory from an arena, aligned to 8 bytes.
+ */
+void* arenaAlloc(Arena* arena, size_t size) {
+    size_t start = (arena->used + 7) & ~(size_t) 7;
+    if(arena->current == NULL || start + size > arena->current->size) {
+        arenaNextChunk(arena, size);
+        start = 0;
+    }
+    arena->used = start + size;
+    return arena->current->data + start;
+}
+
+/*
+ * Function to get the top of an arena, where a string can be built with arenaAppend().
+ */
+char* arenaTop(Arena* arena) {
+    if(arena->current == NULL) arenaNextChunk(arena, 0);
+    return arena->current->data + arena->used;
+}
+
+/*
+ * Function to append bytes to the string of the given length being built at the top of an arena.
+ * Returns the new location of the string, which moves to another chunk when the current one is full.
+ */
+char* arenaAppend(Arena* arena, char* string, size_t length, const char* bytes, size_t count) {
+    if(arena->used + count > arena->current->size) {
+        arenaNextChunk(arena, 2 * (length + count));
+        memcpy(arena->current->data, string, length);
+        string = arena->current->data;
+        arena->used = length;
+    }
+    memcpy(arena->current->data + arena->used, bytes, count);
+    arena->used += count;
+    return string;
+}
+
+/*
+ * Function to free everything allocated from an arena in O(1), keeping its chunks for reuse.
+ */
+void arenaReset(Arena* arena) {
+    arena->current = arena->first;
+    arena->used = 0;
+}
+
+/*
+ * Function to free what was allocated from an arena since mark, a copy of the arena taken earlier.
+ */
+void arenaRewind(Arena* arena, const Arena* mark) {
+    arena->current = mark->current;
+    arena->used = mark->used;
+}
+
+/*
+ * Function to fill the lookup tables used when scanning without SIMD.
+ */
+void initParser() {
+    for(const char* c = unquotedSpecials; *c != '\0'; c++) {
+        isUnquotedSpecial[(unsigned char) *c] = 1;
+    }
+    for(const char* c = quotedSpecials; *c != '\0'; c++) {
+        isQuotedSpecial[(unsigned char) *c] = 1;
+    }
+    for(const char* c = listSpecials; *c != '\0'; c++) {
+        isListSpecial[(unsigned char) *c] = 1;
+    }
+    for(const char* c = globSpecials; *c != '\0'; c++) {
+        isGlobSpecial[(unsigned char) *c] = 1;
+    }
+}
+
+/*
+ * Function to find the first byte in text which is one of specials.
+ * Returns the number of bytes before it, length if there is none.
+ */
+size_t scanOrdinary(const char* text, size_t length, const char* specials, const unsigned char* isSpecial) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (text + i));
+        __m128i hits = _mm_setzero_si128();
+        for(const char* c = specials; *c != '\0'; c++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(*c)));
+        }
+        int mask = _mm_movemask_epi8(hits);
+        if(mask != 0) return i + __builtin_ctz(mask);
+    }
+#endif
+    while(i < length && !isSpecial[(unsigned char) text[i]]) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * State of the parser within a line.
+ */
+typedef struct Parser {
+    const char* cursor;
+    const char* end;
+    Arena* arena;
+    char* word;                 //Word being built at the top of the arena, NULL between words.
+    size_t wordLength;
+    size_t wordNum;             //Number of words of the current command in wordList.
+    size_t redirectNum;         //Number of redirections of the current command in redirectList.
+    Redirect* pendingRedirect;  //Redirection whose file name is the next word, NULL else.
+    const char* line;
+    int expanded;               //Non-zero once a variable was expanded.
+    int substituted;            //Non-zero once the output of a command was substituted.
+    uint64_t expandTicks;       //Time spent expanding variables, in ticks.
+    int globbing;               //Non-zero if the current word has an unquoted wildcard character.
+    size_t quotedNum;           //Number of quoted wildcard characters of the current word, in quotedList.
+} Parser;
+
+/*
+ * Function to append bytes to the current word, starting a word if there is none.
+ */
+void appendWord(Parser* parser, const char* bytes, size_t count) {
+    if(parser->word == NULL) {
+        parser->word = arenaTop(parser->arena);
+        parser->wordLength = 0;
+    }
+    if(count == 0) return;
+    parser->word = arenaAppend(parser->arena, parser->word, parser->wordLength, bytes, count);
+    parser->wordLength += count;
+}
+
+/*
+ * Function to append quoted bytes to the current word, recording where its wildcard characters are, as those only
+ * match themselves if the word turns out to be a pattern.
+ */
+void appendQuoted(Parser* parser, const char* bytes, size_t count) {
+    appendWord(parser, bytes, count);
+    const char* end = bytes + count;
+    for(const char* c = bytes; c < end; c++) {
+        c += scanOrdinary(c, end - c, globSpecials, isGlobSpecial);
+        if(c == end) break;
+        if(parser->quotedNum == quotedListSize) {
+            quotedListSize = (quotedListSize == 0) ? 16 : 2 * quotedListSize;
+            quotedList = realloc(quotedList, quotedListSize * sizeof(size_t));
+        }
+        quotedList[parser->quotedNum++] = parser->wordLength - (end - c);
+    }
+}
+
+/*
+ * Function to replace the word just terminated by the paths it matches, if it is a pattern.
+ * Assignments before the command name are not patterns.
+ * Returns 1 if the word was replaced, 0 if it stays as it is.
+ */
+int globWord(Parser* parser) {
+    size_t quotedNum = parser->quotedNum;
+    parser->globbing = 0;
+    parser->quotedNum = 0;
+    if(assignmentNameLength(parser->word) > 0) {
+        size_t i = 0;
+        while(i < parser->wordNum && assignmentNameLength(wordList[i]) > 0) {
+            i++;
+        }
+        if(i == parser->wordNum) return 0;
+    }
+
+    //The pattern is the word with a backslash before each quoted wildcard character.
+    size_t length = parser->wordLength + quotedNum;
+    if(length + 1 > patternSize) {
+        patternSize = 2 * (length + 1);
+        patternBuffer = realloc(patternBuffer, patternSize);
+    }
+    size_t copied = 0;
+    char* pattern = patternBuffer;
+    for(size_t i = 0; i < quotedNum; i++) {
+        memcpy(pattern, parser->word + copied, quotedList[i] - copied);
+        pattern += quotedList[i] - copied;
+        *pattern++ = '\\';
+        copied = quotedList[i];
+    }
+    memcpy(pattern, parser->word + copied, parser->wordLength - copied);
+
+    long matchNum = expandGlob(patternBuffer, length);
+    if(matchNum == -1) return 0;
+    //What matches may change, so the line must be parsed again each time it runs.
+    parser->expanded = 1;
+    if(matchNum == 0) return 0;
+
+    char* text = arenaAlloc(parser->arena, globMatches.length);
+    memcpy(text, globMatches.text, globMatches.length);
+    while(parser->wordNum + matchNum + 1 >= wordListSize) {
+        wordListSize = (wordListSize == 0) ? 64 : 2 * wordListSize;
+        wordList = realloc(wordList, wordListSize * sizeof(char*));
+    }
+    for(long i = 0; i < matchNum; i++) {
+        wordList[parser->wordNum++] = text + globMatches.offsets[i];
+    }
+    parser->word = NULL;
+    return 1;
+}
+
+/*
+ * Function to terminate the current word, if any, and add it to the words of the command.
+ */
+void finishWord(Parser* parser) {
+    if(parser->word == NULL) return;
+    parser->word = arenaAppend(parser->arena, parser->word, parser->wordLength, "", 1);
+    if(parser->pendingRedirect != NULL) {
+        parser->pendingRedirect->target = parser->word;
+        parser->pendingRedirect = NULL;
+        parser->word = NULL;
+        parser->globbing = 0;
+        parser->quotedNum = 0;
+        return;
+    }
+    if(parser->globbing) {
+        if(globWord(parser)) return;
+    } else {
+        parser->quotedNum = 0;
+    }
+    if(parser->wordNum + 1 >= wordListSize) {
+        wordListSize = (wordListSize == 0) ? 64 : 2 * wordListSize;
+        wordList = realloc(wordList, wordListSize * sizeof(char*));
+    }
+    wordList[parser->wordNum++] = parser->word;
+    parser->word = NULL;
+}
+
+/*
+ * Function to move the words gathered so far into a command of the pipeline.
+ * Returns 0 on success, -1 if the command is empty or the pipeline is too long.
+ */
+int finishCommand(Parser* parser, Pipeline* pipeline) {
+    finishWord(parser);
+    if(parser->pendingRedirect != NULL) {
+        printf("ERROR: Missing file name after redirection\n");
+        return -1;
+    }
+    if(parser->wordNum == 0 && parser->redirectNum == 0) {
+        printf("ERROR: Missing command in pipeline\n");
+        return -1;
+    }
+    if(pipeline->stageNum == PIPELINE_MAX) {
+        printf("ERROR: More than %d commands in pipeline\n", PIPELINE_MAX);
+        return -1;
+    }
+    Command* command = &pipeline->stages[pipeline->stageNum++];
+    command->assignNum = 0;
+    while(command->assignNum < (int) parser->wordNum && assignmentNameLength(wordList[command->assignNum]) > 0) {
+        command->assignNum++;
+    }
+    command->assigns = arenaAlloc(parser->arena, (parser->wordNum + 1) * sizeof(char*));
+    memcpy(command->assigns, wordList, parser->wordNum * sizeof(char*));
+    command->assigns[parser->wordNum] = NULL;
+    command->argv = command->assigns + command->assignNum;
+    command->argc = parser->wordNum - command->assignNum;
+    command->redirectNum = parser->redirectNum;
+    command->redirects = arenaAlloc(parser->arena, parser->redirectNum * sizeof(Redirect));
+    memcpy(command->redirects, redirectList, parser->redirectNum * sizeof(Redirect));
+    command->cpus = NULL;
+    parser->wordNum = 0;
+    parser->redirectNum = 0;
+    return 0;
+}
+
+/*
+ * Function to parse a redirection operator, the cursor being just after its first character ('<' or '>').
+ * A word of unquoted digits written right before the operator is the descriptor to redirect, the file name is the
+ * next word, or for "<&" and ">&" the digits that follow.
+ * Returns 0 on success, -1 on a syntax error.
+ */
+int parseRedirect(Parser* parser, char operator) {
+    if(parser->pendingRedirect != NULL) {
+        printf("ERROR: Missing file name after redirection\n");
+        return -1;
+    }
+
+    int fd = (operator == '<') ? 0 : 1;
+    if(parser->word != NULL && parser->wordLength > 0 && parser->wordLength < 10 &&
+       (size_t) (parser->cursor - 1 - parser->line) >= parser->wordLength) {
+        const char* start = parser->cursor - 1 - parser->wordLength;
+        if(memcmp(start, parser->word, parser->wordLength) == 0 && strspn(start, "0123456789") == parser->wordLength &&
+           (start == parser->line || strchr(" \t\r\n|", start[-1]) != NULL)) {
+            fd = 0;
+            for(size_t i = 0; i < parser->wordLength; i++) {
+                fd = 10 * fd + (start[i] - '0');
+            }
+            parser->word = NULL;
+        }
+    }
+    if(fd >= REDIRECT_FD_MAX) {
+        printf("ERROR: Cannot redirect descriptor %d, only 0 to %d can be\n", fd, REDIRECT_FD_MAX - 1);
+        return -1;
+    }
+    finishWord(parser);
+
+    if(parser->redirectNum == redirectListSize) {
+        redirectListSize = (redirectListSize == 0) ? 8 : 2 * redirectListSize;
+        redirectList = realloc(redirectList, redirectListSize * sizeof(Redirect));
+    }
+    Redirect* redirect = &redirectList[parser->redirectNum++];
+    redirect->type = (operator == '<') ? REDIRECT_IN : REDIRECT_OUT;
+    redirect->fd = fd;
+    redirect->target = NULL;
+    redirect->openFd = -1;
+
+    if(parser->cursor < parser->end && *parser->cursor == '&') {
+        parser->cursor++;
+        size_t digits = 0;
+        while(parser->cursor + digits < parser->end && isdigit((unsigned char) parser->cursor[digits])) {
+            digits++;
+        }
+        if(digits == 0) {
+            printf("ERROR: Missing descriptor number after '%c&'\n", operator);
+            return -1;
+        }
+        redirect->type = REDIRECT_DUP;
+        redirect->target = arenaAlloc(parser->arena, digits + 1);
+        memcpy(redirect->target, parser->cursor, digits);
+        redirect->target[digits] = '\0';
+        parser->cursor += digits;
+        return 0;
+    }
+    if(operator == '>' && parser->cursor < parser->end && *parser->cursor == '>') {
+        parser->cursor++;
+        redirect->type = REDIRECT_APPEND;
+    }
+    parser->pendingRedirect = redirect;
+    return 0;
+}
+
+/*
+ * Function to append the value of an expansion to the current word.
+ * Outside of quotes the value is split into separate words at blanks, like the words typed on the line would be.
+ */
+void appendExpansion(Parser* parser, const char* value, size_t length, int quoted) {
+    if(quoted) {
+        appendQuoted(parser, value, length);
+        return;
+    }
+    const char* end = value + length;
+    while(value < end) {
+        const char* run = value;
+        while(run < end && *run != ' ' && *run != '\t' && *run != '\n') {
+            run++;
+        }
+        if(run > value) {
+            appendWord(parser, value, run - value);
+            if(scanOrdinary(value, run - value, globSpecials, isGlobSpecial) < (size_t) (run - value)) {
+                parser->globbing = 1;
+            }
+        }
+        value = run;
+        if(value < end) {
+            finishWord(parser);
+            while(value < end && (*value == ' ' || *value == '\t' || *value == '\n')) {
+                value++;
+            }
+        }
+    }
+}
+
+/*
+ * Function to substitute the output of a command, given by its text, at the cursor, without its trailing newlines.
+ * The command is parsed with the same lists as the line, so the words of the line gathered so far are kept aside.
+ * Returns 0 on success, -1 on error.
+ */
+int substituteOutput(Parser* parser, const char* command, size_t length, int quoted) {
+    size_t wordNum = parser->wordNum;
+    size_t redirectNum = parser->redirectNum;
+    size_t pendingIndex = (parser->pendingRedirect != NULL) ? parser->pendingRedirect - redirectList : 0;
+    size_t quotedNum = parser->quotedNum;
+    char** words = malloc((wordNum + 1) * sizeof(char*));
+    Redirect* redirects = malloc((redirectNum + 1) * sizeof(Redirect));
+    size_t* quotedOffsets = malloc((quotedNum + 1) * sizeof(size_t));
+    memcpy(words, wordList, wordNum * sizeof(char*));
+    memcpy(redirects, redirectList, redirectNum * sizeof(Redirect));
+    memcpy(quotedOffsets, quotedList, quotedNum * sizeof(size_t));
+
+    size_t outputLength = 0;
+    char* output = captureOutput(command, length, &outputLength);
+
+    memcpy(wordList, words, wordNum * sizeof(char*));
+    memcpy(redirectList, redirects, redirectNum * sizeof(Redirect));
+    memcpy(quotedList, quotedOffsets, quotedNum * sizeof(size_t));
+    if(parser->pendingRedirect != NULL) parser->pendingRedirect = redirectList + pendingIndex;
+    free(words);
+    free(redirects);
+    free(quotedOffsets);
+    if(output == NULL) return -1;
+
+    while(outputLength > 0 && output[outputLength - 1] == '\n') {
+        outputLength--;
+    }
+    parser->expanded = 1;
+    parser->substituted = 1;
+    appendExpansion(parser, output, outputLength, quoted);
+    return 0;
+}
+
+/*
+ * Function to substitute the output of "$(command)", the cursor being just after the opening parenthesis.
+ * Parentheses are counted to find the closing one, skipping quoted text, so substitutions can be nested.
+ * Returns 0 on success, -1 on a syntax error or if the command could not run.
+ */
+int substituteCommand(Parser* parser, int quoted) {
+    const char* start = parser->cursor;
+    int depth = 1;
+    for(const char* c = start; c < parser->end; c++) {
+        if(*c == '\\' && c + 1 < parser->end) {
+            c++;
+        } else if(*c == '\'' || *c == '"') {
+            const char* close = memchr(c + 1, *c, parser->end - c - 1);
+            if(close == NULL) break;
+            c = close;
+        } else if(*c == '(') {
+            depth++;
+        } else if(*c == ')' && --depth == 0) {
+            parser->cursor = c + 1;
+            return substituteOutput(parser, start, c - start, quoted);
+        }
+    }
+    printf("ERROR: Missing ')' after '$('\n");
+    return -1;
+}
+
+/*
+ * Function to substitute the output of "`command`", the cursor being just after the opening backquote.
+ * Inside backquotes a backslash before '`', '\\' or '$' only escapes it, and is removed before the command runs.
+ * Returns 0 on success, -1 on a syntax error or if the command could not run.
+ */
+int substituteBackquoted(Parser* parser, int quoted) {
+    const char* start = parser->cursor;
+    const char* close = start;
+    int escaped = 0;
+    while(close < parser->end && *close != '`') {
+        if(*close == '\\' && close + 1 < parser->end) {
+            escaped = 1;
+            close++;
+        }
+        close++;
+    }
+    if(close == parser->end) {
+        printf("ERROR: Missing closing '`'\n");
+        return -1;
+    }
+    parser->cursor = close + 1;
+    if(!escaped) return substituteOutput(parser, start, close - start, quoted);
+
+    char* command = malloc(close - start);
+    size_t length = 0;
+    for(const char* c = start; c < close; c++) {
+        if(*c == '\\' && strchr("`\\$", c[1]) != NULL) c++;
+        command[length++] = *c;
+    }
+    int result = substituteOutput(parser, command, length, quoted);
+    free(command);
+    return result;
+}
+
+/*
+ * Function to expand $@ or $*, the positional parameters separated by blanks.
+ * With separate (for "$@") every parameter is a word of its own, even inside double quotes.
+ */
+void expandPositional(Parser* parser, int quoted, int separate) {
+    char name[16];
+    for(int i = 1; i <= positionalNum; i++) {
+        if(i > 1 && separate) {
+            finishWord(parser);
+        } else if(i > 1) {
+            appendExpansion(parser, " ", 1, quoted);
+        }
+        int nameLength = snprintf(name, sizeof(name), "%d", i);
+        Variable* variable = getVar(&shellVars, name, nameLength);
+        const char* value = (variable != NULL) ? variable->entry + nameLength + 1 : "";
+        appendExpansion(parser, value, strlen(value), quoted);
+    }
+}
+
+/*
+ * Function to expand the variable reference starting after a '$' at the cursor.
+ * Outside of quotes the value is split into separate words at blanks, like the words typed on the line would be.
+ * Returns 0 on success, -1 on a syntax error.
+ */
+int expandVariable(Parser* parser, int quoted) {
+    const char* name = parser->cursor;
+    size_t nameLength = 0;
+    char statusText[16];
+    const char* value = NULL;
+
+    if(name < parser->end && *name == '(') {
+        parser->cursor++;
+        return substituteCommand(parser, quoted);
+    } else if(name < parser->end && *name == '{') {
+        const char* close = memchr(name, '}', parser->end - name);
+        if(close == NULL) {
+            printf("ERROR: Missing '}' after '${'\n");
+            return -1;
+        }
+        name++;
+        nameLength = close - name;
+        parser->cursor = close + 1;
+    } else if(name < parser->end && *name != '\0' && strchr("?#@*", *name) != NULL) {
+        nameLength = 1;
+        parser->cursor++;
+    } else {
+        while(name + nameLength < parser->end && (isalnum((unsigned char) name[nameLength]) || name[nameLength] == '_')) {
+            nameLength++;
+        }
+        parser->cursor += nameLength;
+    }
+
+    //A '$' not followed by a name is kept as it is.
+    if(nameLength == 0 && parser->cursor[-1] != '}') {
+        appendWord(parser, "$", 1);
+        return 0;
+    }
+    parser->expanded = 1;
+    if(nameLength == 1 && name[0] == '?') {
+        snprintf(statusText, sizeof(statusText), "%d", lastStatus);
+        value = statusText;
+    } else if(nameLength == 1 && name[0] == '#') {
+        snprintf(statusText, sizeof(statusText), "%d", positionalNum);
+        value = statusText;
+    } else if(nameLength == 1 && (name[0] == '@' || name[0] == '*')) {
+        expandPositional(parser, quoted, name[0] == '@');
+        return 0;
+    } else {
+        Variable* variable = getVar(&shellVars, name, nameLength);
+        if(variable != NULL) value = variable->entry + nameLength + 1;
+    }
+    if(value == NULL) value = "";
+    appendExpansion(parser, value, strlen(value), quoted);
+    return 0;
+}
+
+/*
+ * Function to parse the inside of a pair of '"', starting after the opening quote.
+ * Returns 0 on success, -1 on a syntax error.
+ */
+int parseDoubleQuoted(Parser* parser) {
+    appendWord(parser, NULL, 0);
+    while(1) {
+        size_t run = scanOrdinary(parser->cursor, parser->end - parser->cursor, quotedSpecials, isQuotedSpecial);
+        appendQuoted(parser, parser->cursor, run);
+        parser->cursor += run;
+        if(parser->cursor == parser->end) {
+            printf("ERROR: Missing closing '\"'\n");
+            return -1;
+        }
+        char c = *parser->cursor++;
+        if(c == '"') {
+            return 0;
+        } else if(c == '$') {
+            uint64_t start = readTicks();
+            if(expandVariable(parser, 1) == -1) return -1;
+            parser->expandTicks += readTicks() - start;
+        } else if(c == '`') {
+            uint64_t start = readTicks();
+            if(substituteBackquoted(parser, 1) == -1) return -1;
+            parser->expandTicks += readTicks() - start;
+        } else if(parser->cursor < parser->end && strchr("\"\\$`\n", *parser->cursor) != NULL) {
+            //Backslash only escapes characters that are special inside double quotes.
+            if(*parser->cursor != '\n') appendQuoted(parser, parser->cursor, 1);
+            parser->cursor++;
+        } else {
+            appendQuoted(parser, "\\", 1);
+        }
+    }
+}
+
+/*
+ * Function to parse a line into a pipeline, with words unquoted and variables expanded.
+ * Everything the pipeline points to is allocated in arena.
+ * Returns 0 on success (stageNum is 0 for a blank line or a comment), -1 on a syntax error, which is reported.
+ */
+int parseLine(const char* line, size_t length, Arena* arena, Pipeline* pipeline) {
+    uint64_t start = readTicks();
+    Parser parser = {line, line + length, arena, NULL, 0, 0, 0, NULL, line, 0, 0, 0, 0, 0};
+    pipeline->stageNum = 0;
+    pipeline->background = 0;
+
+    while(parser.cursor < parser.end) {
+        size_t run = scanOrdinary(parser.cursor, parser.end - parser.cursor, unquotedSpecials, isUnquotedSpecial);
+        if(run > 0) {
+            appendWord(&parser, parser.cursor, run);
+            parser.cursor += run;
+            continue;
+        }
+
+        char c = *parser.cursor++;
+        switch(c) {
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+                finishWord(&parser);
+                break;
+            case '\'': {
+                const char* close = memchr(parser.cursor, '\'', parser.end - parser.cursor);
+                if(close == NULL) {
+                    printf("ERROR: Missing closing \"'\"\n");
+                    return -1;
+                }
+                appendQuoted(&parser, parser.cursor, close - parser.cursor);
+                parser.cursor = close + 1;
+                break;
+            }
+            case '"':
+                if(parseDoubleQuoted(&parser) == -1) return -1;
+                break;
+            case '\\':
+                //A backslash before a newline joins the lines, before anything else it makes it an ordinary character.
+                if(parser.cursor < parser.end) {
+                    if(*parser.cursor != '\n') appendQuoted(&parser, parser.cursor, 1);
+                    parser.cursor++;
+                }
+                break;
+            case '*':
+            case '?':
+            case '[':
+                parser.globbing = 1;
+                appendWord(&parser, parser.cursor - 1, 1);
+                break;
+            case '$': {
+                uint64_t expandStart = readTicks();
+                if(expandVariable(&parser, 0) == -1) return -1;
+                parser.expandTicks += readTicks() - expandStart;
+                break;
+            }
+            case '`': {
+                uint64_t expandStart = readTicks();
+                if(substituteBackquoted(&parser, 0) == -1) return -1;
+                parser.expandTicks += readTicks() - expandStart;
+                break;
+            }
+            case '#':
+                //A '#' starting a word comments out the rest of the line.
+                if(parser.word == NULL) {
+                    parser.cursor = parser.end;
+                } else {
+                    appendWord(&parser, "#", 1);
+                }
+                break;
+            case '|':
+                if(finishCommand(&parser, pipeline) == -1) return -1;
+                break;
+            case '<':
+            case '>':
+                if(parseRedirect(&parser, c) == -1) return -1;
+                break;
+            case '&':
+                //'&' ends the command line, only blanks or a comment may follow.
+                pipeline->background = 1;
+                while(parser.cursor < parser.end && strchr(" \t\r\n", *parser.cursor) != NULL) {
+                    parser.cursor++;
+                }
+                if(parser.cursor < parser.end && *parser.cursor != '#') {
+                    printf("ERROR: Unexpected text after '&'\n");
+                    return -1;
+                }
+                parser.cursor = parser.end;
+                break;
+        }
+    }
+
+    finishWord(&parser);
+    pipeline->expanded = parser.expanded;
+    pipeline->substituted = parser.substituted;
+    if(parser.wordNum == 0 && parser.redirectNum == 0 && pipeline->stageNum == 0) {
+        if(pipeline->background) {
+            printf("ERROR: Missing command before '&'\n");
+            return -1;
+        }
+        return 0;
+    }
+    int result = finishCommand(&parser, pipeline);
+    recordLatency(METRIC_PARSE, readTicks() - start);
+    if(parser.expanded) recordLatency(METRIC_EXPAND, parser.expandTicks);
+    return result;
+}
+
+/*
+ * Before a line is parsed into pipelines, the list parser splits it at the operators ';', '&', '&&', '||' and
+ * newlines, and finds compound commands (if, while, until, for, { } and function definitions), which may span many
+ * lines. It builds a tree of nodes in an arena without expanding anything: each simple command is kept as its text,
+ * given to parseLine() every time it runs, so a loop body sees the values its variables have at each iteration while
+ * the loop itself is parsed once. Keywords are only recognized where a command starts.
+ */
+
+typedef enum NodeType {
+    NODE_COMMAND,               //A pipeline, parsed from its text when it runs.
+    NODE_SEQUENCE,              //first, then second.
+    NODE_AND,                   //first, then second if first succeeded.
+    NODE_OR,                    //first, then second if first failed.
+    NODE_NOT,                   //first, with its exit status negated.
+    NODE_IF,                    //second if first succeeds, else third (NULL, or another NODE_IF for elif).
+    NODE_WHILE,                 //second as long as first succeeds.
+    NODE_UNTIL,                 //second as long as first fails.
+    NODE_FOR,                   //second once for each word, assigned to the variable name.
+    NODE_GROUP,                 //first, between { and }.
+    NODE_FUNCTION               //Defines the function name, whose body is first.
+} NodeType;
+
+typedef struct Node {
+    NodeType type;
+    int background;             //Non-zero for a compound command followed by '&'.
+    const char* text;           //Source of a command or compound command, with the redirections of the latter.
+    size_t length;
+    const char* name;           //Variable of NODE_FOR, name of NODE_FUNCTION.
+    size_t nameLength;
+    const char* words;          //Word list of NODE_FOR, NULL without "in" (the positional parameters are used).
+    size_t wordsLength;
+    const char* redirects;      //Redirections of a compound command, NULL if none.
+    size_t redirectsLength;
+    struct Node* first;
+    struct Node* second;        //The rest of the list for NODE_SEQUENCE, so long lists do not nest.
+    struct Node* third;
+} Node;
+
+/*
+ * State of the list parser within a text.
+ */
+typedef struct ListParser {
+    const char* cursor;
+    const char* end;
+    Arena* arena;
+    int failed;                 //Non-zero after a syntax error, described by message.
+    int incomplete;             //Non-zero if the text ended inside a command, message says what is missing.
+    int background;             //Non-zero if the last command parsed ended with '&'.
+    char message[64];
+} ListParser;
+
+const char* closingKeywords[] = {"then", "elif", "else", "fi", "do", "done", "}", NULL};
+
+/*
+ * Function to record a syntax error, or with incomplete non-zero that the text ended too early.
+ * Returns NULL, for the parsing functions to return.
+ */
+Node* listError(ListParser* parser, int incomplete, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(parser->message, sizeof(parser->message), format, arguments);
+    va_end(arguments);
+    if(incomplete) {
+        parser->incomplete = 1;
+    } else {
+        parser->failed = 1;
+    }
+    return NULL;
+}
+
+/*
+ * Function to report the operator or word at the cursor as a syntax error.
+ */
+Node* unexpectedToken(ListParser* parser) {
+    const char* c = parser->cursor;
+    size_t length = 1;
+    if(c + 1 < parser->end && c[1] == c[0] && strchr("&|;", *c) != NULL) {
+        length = 2;
+    } else if(strchr("&|;<>()", *c) == NULL) {
+        while(c + length < parser->end && strchr(" \t\r\n;&|<>()", c[length]) == NULL) {
+            length++;
+        }
+    }
+    return listError(parser, 0, "Unexpected '%.*s'", (int) (length < 16 ? length : 16), c);
+}
+
+/*
+ * Function to skip blanks, escaped newlines and comments, stopping at a newline.
+ */
+void skipBlanks(ListParser* parser) {
+    const char* c = parser->cursor;
+    while(c < parser->end) {
+        if(*c == ' ' || *c == '\t' || *c == '\r') {
+            c++;
+        } else if(*c == '\\' && c + 1 < parser->end && c[1] == '\n') {
+            c += 2;
+        } else if(*c == '#') {
+            const char* newline = memchr(c, '\n', parser->end - c);
+            c = (newline != NULL) ? newline : parser->end;
+        } else {
+            break;
+        }
+    }
+    parser->cursor = c;
+}
+
+/*
+ * Function to skip blanks, comments and newlines.
+ */
+void skipSeparators(ListParser* parser) {
+    skipBlanks(parser);
+    while(parser->cursor < parser->end && *parser->cursor == '\n') {
+        parser->cursor++;
+        skipBlanks(parser);
+    }
+}
+
+/*
+ * Function to tell if the word at the cursor is keyword, which must be followed by a blank or an operator.
+ */
+int atKeyword(ListParser* parser, const char* keyword) {
+    size_t length = strlen(keyword);
+    const char* c = parser->cursor;
+    if((size_t) (parser->end - c) < length || memcmp(c, keyword, length) != 0) return 0;
+    return c + length == parser->end || (c[length] != '\0' && strchr(" \t\r\n;&|<>()", c[length]) != NULL);
+}
+
+/*
+ * Function to move past keyword if it is at the cursor.
+ * Returns 1 if it was, 0 else.
+ */
+int takeKeyword(ListParser* parser, const char* keyword) {
+    if(!atKeyword(parser, keyword)) return 0;
+    parser->cursor += strlen(keyword);
+    return 1;
+}
+
+/*
+ * Function to move past keyword, which must be at the cursor.
+ * Returns 1 on success, 0 if something else is there (a syntax error) or the text ended (incomplete).
+ */
+int expectKeyword(ListParser* parser, const char* keyword) {
+    if(takeKeyword(parser, keyword)) return 1;
+    if(parser->cursor == parser->end) {
+        listError(parser, 1, "Missing '%s'", keyword);
+    } else {
+        unexpectedToken(parser);
+    }
+    return 0;
+}
+
+/*
+ * Function to find which keyword ending a compound command (such as "done" or "fi") is at the cursor.
+ * Returns the keyword, NULL if there is none.
+ */
+const char* atClosingKeyword(ListParser* parser) {
+    if(parser->cursor == parser->end || strchr("tedf}", *parser->cursor) == NULL) return NULL;
+    for(int i = 0; closingKeywords[i] != NULL; i++) {
+        if(atKeyword(parser, closingKeywords[i])) return closingKeywords[i];
+    }
+    return NULL;
+}
+
+/*
+ * Function to skip the quoted text or substitution starting at c: a quote, a backquote, "$(" or "${". What is nested
+ * in it is skipped too, so the ')' of "$(echo ')')" is not taken for the closing one.
+ * Returns a pointer after its end, NULL if the text ends first.
+ */
+const char* skipQuoted(ListParser* parser, const char* c) {
+    const char* end = parser->end;
+    if(*c == '\'' || (*c == '$' && c[1] == '{')) {
+        char close = (*c == '\'') ? '\'' : '}';
+        const char* found = memchr(c + 1, close, end - c - 1);
+        if(found != NULL) return found + 1;
+        listError(parser, 1, (close == '\'') ? "Missing closing \"'\"" : "Missing '}' after '${'");
+        return NULL;
+    }
+
+    char open = *c;
+    int depth = 1;
+    if(open == '$') c++;
+    for(c++; c < end; c++) {
+        if(*c == '\\') {
+            c++;
+        } else if(open == '`') {
+            if(*c == '`') return c + 1;
+        } else if(open == '"' && *c == '"') {
+            return c + 1;
+        } else if(open == '$' && *c == ')') {
+            if(--depth == 0) return c + 1;
+        } else if(open == '$' && *c == '(') {
+            depth++;
+        } else if(*c == '`' || (*c == '$' && c + 1 < end && (c[1] == '(' || c[1] == '{')) ||
+                  (open == '$' && (*c == '\'' || *c == '"'))) {
+            const char* after = skipQuoted(parser, c);
+            if(after == NULL) return NULL;
+            c = after - 1;
+        }
+    }
+    listError(parser, 1, (open == '"') ? "Missing closing '\"'" : (open == '`') ? "Missing closing '`'" :
+                                         "Missing ')' after '$('");
+    return NULL;
+}
+
+/*
+ * Function to find the end of the simple command (a pipeline) at the cursor: an unquoted ';', newline, "&&", "||" or
+ * the end of the text. A '&' putting the command in the background is part of it and ends it. A pipeline may go on
+ * to the next line after a '|'.
+ * Returns the end, NULL if the text ends inside the command.
+ */
+const char* findCommandEnd(ListParser* parser) {
+    const char* c = parser->cursor;
+    const char* end = parser->end;
+    int wordStart = 1;
+    parser->background = 0;
+    while(c < end) {
+        size_t run = scanOrdinary(c, end - c, listSpecials, isListSpecial);
+        if(run > 0) {
+            c += run;
+            wordStart = 0;
+            continue;
+        }
+        switch(*c) {
+            case ' ':
+            case '\t':
+            case '\r':
+                c++;
+                wordStart = 1;
+                break;
+            case '\n':
+            case ';':
+                return c;
+            case '\\':
+                if(c + 1 == end) {
+                    listError(parser, 1, "Missing line after '\\'");
+                    return NULL;
+                }
+                c += 2;
+                wordStart = 0;
+                break;
+            case '#':
+                if(wordStart) {
+                    const char* newline = memchr(c, '\n', end - c);
+                    c = (newline != NULL) ? newline : end;
+                } else {
+                    c++;
+                }
+                break;
+            case '$':
+                if(c + 1 < end && (c[1] == '(' || c[1] == '{')) {
+                    c = skipQuoted(parser, c);
+                    if(c == NULL) return NULL;
+                } else {
+                    c++;
+                }
+                wordStart = 0;
+                break;
+            case '\'':
+            case '"':
+            case '`':
+                c = skipQuoted(parser, c);
+                if(c == NULL) return NULL;
+                wordStart = 0;
+                break;
+            case '&':
+                if(c + 1 < end && c[1] == '&') return c;
+                //The '&' of "<&" and ">&" names a descriptor.
+                if(c > parser->cursor && (c[-1] == '<' || c[-1] == '>')) {
+                    c++;
+                    break;
+                }
+                parser->background = 1;
+                return c + 1;
+            case '|':
+                if(c + 1 < end && c[1] == '|') return c;
+                c++;
+                while(c < end && (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')) {
+                    c++;
+                }
+                if(c == end) {
+                    listError(parser, 1, "Missing command after '|'");
+                    return NULL;
+                }
+                wordStart = 1;
+                break;
+        }
+    }
+    return c;
+}
+
+/*
+ * Function to allocate a node starting at start in the text.
+ */
+Node* newNode(ListParser* parser, NodeType type, const char* start) {
+    Node* node = arenaAlloc(parser->arena, sizeof(Node));
+    memset(node, 0, sizeof(Node));
+    node->type = type;
+    node->text = start;
+    return node;
+}
+
+//Compound commands contain lists.
+Node* parseList(ListParser* parser, int topLevel);
+
+/*
+ * Function to parse the list of a compound command, which must not be empty, up to the keyword ending it.
+ * expected is the keyword reported missing if the text ends first.
+ * Returns the list, NULL on error.
+ */
+Node* parseBody(ListParser* parser, const char* expected) {
+    Node* list = parseList(parser, 0);
+    if(list != NULL || parser->failed || parser->incomplete) return list;
+    if(parser->cursor == parser->end) return listError(parser, 1, "Missing '%s'", expected);
+    return listError(parser, 0, "Missing command before '%s'", atClosingKeyword(parser));
+}
+
+/*
+ * Function to parse an if command after its "if" (or an elif branch after its "elif"), up to its "fi".
+ */
+Node* parseIf(ListParser* parser, const char* start) {
+    Node* node = newNode(parser, NODE_IF, start);
+    if((node->first = parseBody(parser, "then")) == NULL || !expectKeyword(parser, "then")) return NULL;
+    if((node->second = parseBody(parser, "fi")) == NULL) return NULL;
+
+    const char* branch = parser->cursor;
+    if(takeKeyword(parser, "elif")) {
+        node->third = parseIf(parser, branch);
+        if(node->third == NULL) return NULL;
+    } else if(takeKeyword(parser, "else")) {
+        if((node->third = parseBody(parser, "fi")) == NULL || !expectKeyword(parser, "fi")) return NULL;
+    } else if(!expectKeyword(parser, "fi")) {
+        return NULL;
+    }
+    node->length = parser->cursor - start;
+    return node;
+}
+
+/*
+ * Function to parse a while or until loop after its keyword.
+ */
+Node* parseLoop(ListParser* parser, NodeType type, const char* start) {
+    Node* node = newNode(parser, type, start);
+    if((node->first = parseBody(parser, "do")) == NULL || !expectKeyword(parser, "do")) return NULL;
+    if((node->second = parseBody(parser, "done")) == NULL || !expectKeyword(parser, "done")) return NULL;
+    node->length = parser->cursor - start;
+    return node;
+}
+
+/*
+ * Function to parse a for loop after its keyword: "for name [in words]; do list; done".
+ */
+Node* parseFor(ListParser* parser, const char* start) {
+    Node* node = newNode(parser, NODE_FOR, start);
+    skipBlanks(parser);
+    node->name = parser->cursor;
+    while(parser->cursor < parser->end && (isalnum((unsigned char) *parser->cursor) || *parser->cursor == '_')) {
+        parser->cursor++;
+    }
+    node->nameLength = parser->cursor - node->name;
+    if(parser->cursor == parser->end) return listError(parser, 1, "Missing 'do'");
+    if(node->nameLength == 0 || isdigit((unsigned char) node->name[0]) ||
+       strchr(" \t\r\n;", *parser->cursor) == NULL) {
+        return listError(parser, 0, "Invalid variable name after 'for'");
+    }
+
+    skipBlanks(parser);
+    if(takeKeyword(parser, "in")) {
+        skipBlanks(parser);
+        node->words = parser->cursor;
+        const char* wordsEnd = findCommandEnd(parser);
+        if(wordsEnd == NULL) return NULL;
+        parser->cursor = wordsEnd;
+        if(parser->background || (wordsEnd < parser->end && *wordsEnd != ';' && *wordsEnd != '\n')) {
+            return unexpectedToken(parser);
+        }
+        node->wordsLength = wordsEnd - node->words;
+    }
+    skipBlanks(parser);
+    if(parser->cursor < parser->end && *parser->cursor == ';') parser->cursor++;
+    skipSeparators(parser);
+    if(!expectKeyword(parser, "do")) return NULL;
+    if((node->second = parseBody(parser, "done")) == NULL || !expectKeyword(parser, "done")) return NULL;
+    node->length = parser->cursor - start;
+    return node;
+}
+
+/*
+ * Function to parse a simple command at the cursor.
+ */
+Node* parseSimpleCommand(ListParser* parser) {
+    const char* start = parser->cursor;
+    const char* end = findCommandEnd(parser);
+    if(end == NULL) return NULL;
+    if(end == start || (parser->background && end == start + 1)) return unexpectedToken(parser);
+    Node* node = newNode(parser, NODE_COMMAND, start);
+    node->length = end - start;
+    parser->cursor = end;
+    return node;
+}
+
+/*
+ * Function to parse what may follow the keyword ending a compound command: redirections, which apply to all of its
+ * commands, and a '&' running it in the background.
+ * Returns node, NULL on a syntax error.
+ */
+Node* finishCompound(ListParser* parser, Node* node) {
+    const char* end = parser->cursor;
+    skipBlanks(parser);
+    const char* c = parser->cursor;
+    parser->background = 0;
+    if(c < parser->end && (*c == '<' || *c == '>' || isdigit((unsigned char) *c))) {
+        const char* redirectsEnd = findCommandEnd(parser);
+        if(redirectsEnd == NULL) return NULL;
+        node->redirects = c;
+        node->redirectsLength = redirectsEnd - c - parser->background;
+        end = c + node->redirectsLength;
+        parser->cursor = redirectsEnd;
+    } else if(c < parser->end && *c == '&' && (c + 1 == parser->end || c[1] != '&')) {
+        parser->background = 1;
+        parser->cursor++;
+    } else if(c < parser->end && *c == '|' && (c + 1 == parser->end || c[1] != '|')) {
+        return listError(parser, 0, "Compound commands cannot be piped");
+    }
+    node->length = end - node->text;
+    node->background = parser->background;
+    return node;
+}
+
+/*
+ * Function to parse the compound command starting at the cursor, if any.
+ * Returns the command, NULL on error or if there is none (neither failed nor incomplete is set then).
+ */
+Node* parseCompound(ListParser* parser) {
+    const char* start = parser->cursor;
+    Node* node = NULL;
+    if(takeKeyword(parser, "if")) {
+        node = parseIf(parser, start);
+    } else if(takeKeyword(parser, "while")) {
+        node = parseLoop(parser, NODE_WHILE, start);
+    } else if(takeKeyword(parser, "until")) {
+        node = parseLoop(parser, NODE_UNTIL, start);
+    } else if(takeKeyword(parser, "for")) {
+        node = parseFor(parser, start);
+    } else if(takeKeyword(parser, "{")) {
+        node = newNode(parser, NODE_GROUP, start);
+        if((node->first = parseBody(parser, "}")) == NULL || !expectKeyword(parser, "}")) return NULL;
+    } else {
+        return NULL;
+    }
+    return (node != NULL) ? finishCompound(parser, node) : NULL;
+}
+
+/*
+ * Function to tell if a character may be part of the name of a function.
+ */
+int isFunctionNameChar(char c) {
+    return isalnum((unsigned char) c) || c == '_' || c == '-' || c == '.' || c == ':';
+}
+
+/*
+ * Function to tell if a function definition "name()" starts at the cursor.
+ */
+int atFunctionDefinition(ListParser* parser) {
+    const char* c = parser->cursor;
+    while(c < parser->end && isFunctionNameChar(*c)) {
+        c++;
+    }
+    if(c == parser->cursor) return 0;
+    while(c < parser->end && (*c == ' ' || *c == '\t')) {
+        c++;
+    }
+    if(c == parser->end || *c != '(') return 0;
+    c++;
+    while(c < parser->end && (*c == ' ' || *c == '\t')) {
+        c++;
+    }
+    return c < parser->end && *c == ')';
+}
+
+/*
+ * Function to parse a function definition, "name() body" or "function name [()] body" with the keyword already
+ * taken, whose body is a compound command.
+ */
+Node* parseFunction(ListParser* parser, const char* start) {
+    Node* node = newNode(parser, NODE_FUNCTION, start);
+    skipBlanks(parser);
+    node->name = parser->cursor;
+    while(parser->cursor < parser->end && isFunctionNameChar(*parser->cursor)) {
+        parser->cursor++;
+    }
+    node->nameLength = parser->cursor - node->name;
+    if(parser->cursor == parser->end) return listError(parser, 1, "Missing function body");
+    if(node->nameLength == 0) return unexpectedToken(parser);
+
+    skipBlanks(parser);
+    if(parser->cursor < parser->end && *parser->cursor == '(') {
+        parser->cursor++;
+        skipBlanks(parser);
+        if(parser->cursor == parser->end) return listError(parser, 1, "Missing ')'");
+        if(*parser->cursor != ')') return unexpectedToken(parser);
+        parser->cursor++;
+    }
+    skipSeparators(parser);
+    if(parser->cursor == parser->end) return listError(parser, 1, "Missing function body");
+    node->first = parseCompound(parser);
+    if(node->first == NULL && !parser->failed && !parser->incomplete) {
+        return listError(parser, 0, "Function body must be a compound command");
+    }
+    if(node->first == NULL) return NULL;
+    if(node->first->background) return listError(parser, 0, "Unexpected '&' after function body");
+    node->length = parser->cursor - start;
+    return node;
+}
+
+/*
+ * Function to parse a command at the cursor: a simple command, a compound command, a function definition, or any of
+ * those preceded by '!'.
+ */
+Node* parseCommand(ListParser* parser) {
+    skipBlanks(parser);
+    const char* start = parser->cursor;
+    if(takeKeyword(parser, "!")) {
+        Node* node = newNode(parser, NODE_NOT, start);
+        skipBlanks(parser);
+        if(parser->cursor == parser->end) return listError(parser, 1, "Missing command after '!'");
+        if((node->first = parseCommand(parser)) == NULL) return NULL;
+        node->length = parser->cursor - start;
+        return node;
+    }
+
+    Node* node = parseCompound(parser);
+    if(node != NULL || parser->failed || parser->incomplete) return node;
+    if(takeKeyword(parser, "function") || atFunctionDefinition(parser)) return parseFunction(parser, start);
+    if(atClosingKeyword(parser) != NULL) return unexpectedToken(parser);
+    return parseSimpleCommand(parser);
+}
+
+/*
+ * Function to parse commands joined by "&&" and "||", which may be followed by newlines.
+ */
+Node* parseAndOr(ListParser* parser) {
+    Node* node = parseCommand(parser);
+    while(node != NULL) {
+        skipBlanks(parser);
+        const char* c = parser->cursor;
+        if(c + 1 >= parser->end || c[1] != c[0] || (*c != '&' && *c != '|')) return node;
+        parser->cursor += 2;
+        skipSeparators(parser);
+        if(parser->cursor == parser->end) return listError(parser, 1, "Missing command after '%.2s'", c);
+
+        Node* pair = newNode(parser, (*c == '&') ? NODE_AND : NODE_OR, node->text);
+        pair->first = node;
+        if((pair->second = parseCommand(parser)) == NULL) return NULL;
+        node = pair;
+    }
+    return NULL;
+}
+
+/*
+ * Function to parse a list of commands separated by ';', '&' or newlines.
+ * At the top level the list is a command line: it ends at the first newline that is not inside a compound command,
+ * and blank lines and comments before it are skipped. Nested in a compound command, it ends at the keyword closing
+ * that command, such as "done" or "fi".
+ * Returns the list, NULL if it is empty or on error.
+ */
+Node* parseList(ListParser* parser, int topLevel) {
+    Node* list = NULL;
+    Node** last = &list;
+    while(1) {
+        if(list == NULL || !topLevel) {
+            skipSeparators(parser);
+        } else {
+            skipBlanks(parser);
+            if(parser->cursor < parser->end && *parser->cursor == '\n') {
+                parser->cursor++;
+                break;
+            }
+        }
+        if(parser->cursor == parser->end || (!topLevel && atClosingKeyword(parser) != NULL)) break;
+
+        Node* item = parseAndOr(parser);
+        if(item == NULL) return NULL;
+        if(list == NULL) {
+            list = item;
+        } else {
+            Node* sequence = newNode(parser, NODE_SEQUENCE, (*last)->text);
+            sequence->first = *last;
+            sequence->second = item;
+            *last = sequence;
+            last = &sequence->second;
+        }
+
+        skipBlanks(parser);
+        if(parser->cursor == parser->end || (!topLevel && atClosingKeyword(parser) != NULL)) break;
+        char c = *parser->cursor;
+        if(c == ';' || c == '\n') {
+            parser->cursor++;
+            if(topLevel && c == '\n') break;
+        } else if(!parser->background) {
+            return unexpectedToken(parser);
+        }
+    }
+    return list;
+}
+
+/*
+ * Function to move the list parser past the line where it stopped on an error, so that parsing can go on from the
+ * next one. After an incomplete command there is nothing left.
+ */
+void skipErrorLine(ListParser* parser) {
+    const char* newline = memchr(parser->cursor, '\n', parser->end - parser->cursor);
+    parser->cursor = (newline != NULL && !parser->incomplete) ? newline + 1 : parser->end;
+    parser->failed = 0;
+    parser->incomplete = 0;
+}
+
+/*
+ * Function to tell if text is a single pipeline, which parseLine() can run by itself, rather than a list or a compound
+ * command. The nodes are allocated in arena.
+ * Returns 1 if it is (or if the text is blank), 0 if it is not, -1 on a syntax error, which is reported.
+ */
+int isSimpleCommand(const char* text, size_t length, Arena* arena) {
+    ListParser parser = {text, text + length, arena, 0, 0, 0, ""};
+    Node* node = parseList(&parser, 1);
+    if(parser.failed || parser.incomplete) {
+        printf("ERROR: %s\n", parser.message);
+        return -1;
+    }
+    skipSeparators(&parser);
+    return node == NULL || (node->type == NODE_COMMAND && parser.cursor == parser.end);
+}
+
+/*
+ * Function to tell if text ends inside a command (a compound command, quotes, or after an operator), so that the
+ * interactive shell reads more lines to complete it.
+ */
+int needsMoreInput(const char* text, size_t length) {
+    ListParser parser = {text, text + length, &lineArena, 0, 0, 0, ""};
+    arenaReset(&lineArena);
+    while(parser.cursor < parser.end && !parser.failed && !parser.incomplete) {
+        parseList(&parser, 1);
+    }
+    return parser.incomplete;
+}
+
+/*---------------------------------------------End of parser section---------------------------------------------*/
+
+/*
+ * Function to change working directory (implementation of cd command).
+ */
+int cd(int argc, char** argv, int inFd, int outFd) {
+    char* arg = (argc > 1) ? argv[1] : NULL;
+    int status = 0;
+
+    //Back-up working directory
+    char workDirCopy[DIR_MAX] = "";
+    strcpy(workDirCopy, workDir);
+
+    //Case "cd"
+    if(arg == NULL) {
+        return 0;
+    }
+    //Arguments are not limited in length, the working directory is.
+    if(strlen(workDir) + strlen(arg) + 2 > DIR_MAX) {
+        errno = ENAMETOOLONG;
+        handleChDirError();
+        return 1;
+    }
+    //Case "cd ~" and "cd ~/path"
+    if(arg[0] == '~') {
+        strcpy(workDir, home);
+        if(strlen(arg) > 2) strcat(workDir, &arg[2]);
+        if(chdir(workDir) == -1) {
+            handleChDirError();
+            status = 1;
+            //Restore from back-up
+            strcpy(workDir, workDirCopy);
+        }
+    }
+    //Case "cd .."
+    else if (strcmp(arg, "..") == 0) {
+        int i = 0;
+        while(workDir[i+1] != '\0') {
+            i++;
+        }
+        do {
+            workDir[i] = '\0';
+            i--;
+        } while (workDir[i] != '/');
+        if(chdir(workDir) == -1) {
+            handleChDirError();
+            status = 1;
+            //Restore from back-up
+            strcpy(workDir, workDirCopy);
+        }
+    }
+    //Case "cd absolute_path"
+    else if (arg[0] == '/') {
+        strcpy(workDir, arg);
+        //Add slash at end if not found.
+        if(workDir[strlen(workDir) - 1] != '/') strcat(workDir, "/");
+        if(chdir(workDir) == -1) {
+            handleChDirError();
+            status = 1;
+            //Restore from back-up
+            strcpy(workDir, workDirCopy);
+        }
+    }
+    //Case "cd relative_path"
+    else {
+        strcat(workDir, arg);
+        //Add slash at end if not found.
+        if(workDir[strlen(workDir) - 1] != '/') strcat(workDir, "/");
+        if(chdir(workDir) == -1) {
+            handleChDirError();
+            status = 1;
+            //Restore from back-up
+            strcpy(workDir, workDirCopy);
+        }
+    }
+    if(status == 0) visitDirectory(workDir);
+    return status;
+}
+
+/*
+ * Function to print its arguments separated by spaces to the output (implementation of echo command).
+ */
+int echo(int argc, char** argv, int inFd, int outFd) {
+    //Assemble the line in the arena so that it is written with a single call.
+    char* line = arenaTop(&lineArena);
+    size_t length = 0;
+    for(int i = 1; i < argc; i++) {
+        size_t argLength = strlen(argv[i]);
+        if(i > 1) line = arenaAppend(&lineArena, line, length++, " ", 1);
+        line = arenaAppend(&lineArena, line, length, argv[i], argLength);
+        length += argLength;
+    }
+    line = arenaAppend(&lineArena, line, length++, "\n", 1);
+    return (write(outFd, line, length) == -1) ? 1 : 0;
+}
+
+/*
+ * Function to export variables to the environment of commands (implementation of export command).
+ * "export NAME=value" sets and exports a variable, "export NAME" exports it, "export" lists exported variables.
+ */
+int export(int argc, char** argv, int inFd, int outFd) {
+    if(argc < 2) {
+        for(char** entry = varEnvironment(&shellVars); *entry != NULL; entry++) {
+            dprintf(outFd, "export %s\n", *entry);
+        }
+        return 0;
+    }
+    for(int i = 1; i < argc; i++) {
+        size_t nameLength = assignmentNameLength(argv[i]);
+        if(nameLength > 0) {
+            const char* value = argv[i] + nameLength + 1;
+            setVar(&shellVars, argv[i], nameLength, value, strlen(value), 1);
+        } else {
+            nameLength = strlen(argv[i]);
+            exportVar(&shellVars, argv[i], nameLength);
+        }
+
+        //Cached command paths are only valid for the old search path.
+        if(nameLength == 4 && strncmp(argv[i], "PATH", 4) == 0) {
+            clearCommandHash();
+            updateCompletionPath();
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function to show or reset the command hash table (implementation of hash command).
+ * "hash" lists cached commands, "hash -r" empties the table, "hash name" looks up and caches a command.
+ */
+int hash(int argc, char** argv, int inFd, int outFd) {
+    char* arg = (argc > 1) ? argv[1] : NULL;
+    if(arg == NULL || arg[0] == '\0') {
+        dprintf(outFd, "hits\tcommand\n");
+        for(int i = 0; i < HASH_BUCKETS; i++) {
+            for(HashEntry* entry = commandHash[i]; entry != NULL; entry = entry->next) {
+                dprintf(outFd, "%4lu\t%s\n", entry->hits, entry->path);
+            }
+        }
+        dprintf(outFd, "lookups: %lu hits, %lu misses\n", hashHits, hashMisses);
+    } else if(strcmp(arg, "-r") == 0) {
+        clearCommandHash();
+    } else if(lookupCommand(arg) == NULL) {
+        printf("hash: %s: not found\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Function to set or list shell options (implementation of set command).
+ * "set -o name=value" sets an option, "set -o" lists them. The options are placement, the CPU placement policy of
+ * background jobs (none, roundrobin, leastloaded or node:N), globthreads, the number of threads reading
+ * directories to expand "**", timeout, the deadline of jobs started without the timeout prefix (0 for none), capture,
+ * whether the output of background jobs is captured, and capturedir, where captured output that does not fit is spilled.
+ */
+int setBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    if(argc < 2 || strcmp(argv[1], "-o") != 0) {
+        printf("Usage: set -o [placement=none|roundrobin|leastloaded|node:N] [globthreads=N] [timeout=DURATION]\n"
+               "              [capture=on|off] [capturedir=DIR]\n");
+        return 2;
+    }
+    if(argc == 2) {
+        char policy[32];
+        formatPlacementPolicy(policy, sizeof(policy));
+        dprintf(outFd, "placement\t%s\n", policy);
+        dprintf(outFd, "globthreads\t%d\n", globThreads);
+        dprintf(outFd, "timeout\t\t%gs\n", defaultTimeoutMs / 1000.0);
+        dprintf(outFd, "capture\t\t%s\n", captureJobs ? "on" : "off");
+        dprintf(outFd, "capturedir\t%s\n", captureDir);
+        return 0;
+    }
+    for(int i = 2; i < argc; i++) {
+        if(strncmp(argv[i], "globthreads=", 12) == 0) {
+            char* end = NULL;
+            long threads = strtol(argv[i] + 12, &end, 10);
+            if(end == argv[i] + 12 || *end != '\0' || threads < 1 || threads > GLOB_THREADS_MAX) {
+                printf("set: %s: thread count must be from 1 to %d\n", argv[i] + 12, GLOB_THREADS_MAX);
+                return 2;
+            }
+            globThreads = threads;
+        } else if(strcmp(argv[i], "capture=on") == 0 || strcmp(argv[i], "capture=off") == 0) {
+            captureJobs = (strcmp(argv[i], "capture=on") == 0);
+        } else if(strncmp(argv[i], "capturedir=", 11) == 0) {
+            snprintf(captureDir, sizeof(captureDir), "%s", argv[i] + 11);
+        } else if(strncmp(argv[i], "timeout=", 8) == 0) {
+            long timeoutMs = parseDuration(argv[i] + 8);
+            if(timeoutMs == -1) {
+                printf("set: %s: invalid duration\n", argv[i] + 8);
+                return 2;
+            }
+            defaultTimeoutMs = timeoutMs;
+        } else if(strncmp(argv[i], "placement=", 10) != 0) {
+            printf("set: %s: unknown option\n", argv[i]);
+            return 2;
+        } else if(setPlacementPolicy(argv[i] + 10) == -1) {
+            printf("set: %s: unknown placement policy\n", argv[i] + 10);
+            return 2;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function to print the latency histograms and counters of the shell (implementation of stats command).
+ * "stats -r" clears them.
+ */
+int statsBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    if(argc > 1 && strcmp(argv[1], "-r") == 0) {
+        resetMetrics();
+    } else {
+        printMetrics(outFd);
+    }
+    return 0;
+}
+
+/*
+ * Function to list the jobs of the current scope with their state and resource usage (implementation of jobs command).
+ * Finished jobs are removed from the table once listed.
+ */
+int jobsBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    //The table is most recent first, list it oldest first.
+    int jobNum = 0;
+    for(Job* job = jobs; job != NULL; job = job->next) {
+        jobNum++;
+    }
+    for(int i = jobNum - 1; i >= 0; i--) {
+        Job* job = jobs;
+        for(int j = 0; j < i; j++) {
+            job = job->next;
+        }
+        if(job->scope == jobScope) printJob(job, outFd);
+    }
+    Job* job = jobs;
+    while(job != NULL) {
+        Job* next = job->next;
+        if(job->state == JOB_DONE && job->scope == jobScope) removeJob(job);
+        job = next;
+    }
+    return 0;
+}
+
+/*
+ * Function to wait for jobs to finish (implementation of wait command).
+ * "wait" waits for every running job of the current scope, "wait %n" or "wait pid" for one job.
+ * Returns the exit status of the job waited for, 0 when waiting for every job.
+ */
+int waitBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    char* arg = (argc > 1) ? argv[1] : NULL;
+    if(arg == NULL) {
+        Job* job = jobs;
+        while(job != NULL) {
+            Job* next = job->next;
+            if(job->scope != jobScope) {
+                job = next;
+                continue;
+            }
+            if(job->state == JOB_RUNNING) {
+                waitJob(job);
+                next = jobs;
+            } else if(job->state == JOB_DONE) {
+                removeJob(job);
+            }
+            job = next;
+        }
+        return 0;
+    }
+    Job* job = findJob(arg);
+    if(job == NULL) {
+        printf("wait: %s: no such job\n", arg);
+        return 127;
+    }
+    int status = waitJob(job);
+    if(job->state == JOB_DONE) removeJob(job);
+    return status;
+}
+
+/*
+ * Function to continue a job in the foreground (implementation of fg command).
+ * Returns the exit status of the job.
+ */
+int fg(int argc, char** argv, int inFd, int outFd) {
+    char* arg = (argc > 1) ? argv[1] : NULL;
+    Job* job = findJob(arg);
+    if(job == NULL) {
+        printf("fg: %s: no such job\n", (arg != NULL) ? arg : "current");
+        return 1;
+    }
+    printf("%s\n", job->command);
+    fflush(stdout);
+    job->background = 0;
+
+    //Output captured so far is shown, and the rest while the job is in the foreground.
+    JobLog* log = findJobLog(job->id);
+    if(log != NULL) {
+        writeJobLog(log, outFd);
+        log->followFd = outFd;
+    }
+    if(jobControl) tcsetpgrp(STDIN_FILENO, job->pgid);
+    continueJob(job);
+    int status = waitJob(job);
+    if(log != NULL && findJobLog(job->id) == log) {
+        if(job->state == JOB_DONE) readJobOutput(log, INT_MAX);
+        log->followFd = -1;
+    }
+    if(job->state == JOB_DONE) removeJob(job);
+    return status;
+}
+
+/*
+ * Function to show the output captured for a background job (implementation of joblog command).
+ * Usage: joblog [%n]   output of job n, of the most recent job without argument
+ *        joblog -l     list the jobs whose output is kept
+ */
+int joblog(int argc, char** argv, int inFd, int outFd) {
+    if(argc > 1 && strcmp(argv[1], "-l") == 0) {
+        for(JobLog* log = jobLogs; log != NULL; log = log->next) {
+            readJobOutput(log, INT_MAX);
+            dprintf(outFd, "[%d]  %-8s %10llu bytes  %s\n", log->id, (log->fd != -1) ? "Open" : "Closed",
+                    (unsigned long long) log->total, log->command);
+        }
+        return 0;
+    }
+    int id = 0;
+    if(argc > 1) id = atoi(argv[1] + (argv[1][0] == '%'));
+    JobLog* log = (argc == 1 || id > 0) ? findJobLog(id) : NULL;
+    if(log == NULL) {
+        printf("joblog: %s: no output kept for job\n", (argc > 1) ? argv[1] : "current");
+        return 1;
+    }
+    return (writeJobLog(log, outFd) == -1) ? 1 : 0;
+}
+
+/*
+ * Function to continue a stopped job in the background (implementation of bg command).
+ */
+int bg(int argc, char** argv, int inFd, int outFd) {
+    char* arg = (argc > 1) ? argv[1] : NULL;
+    Job* job = findJob(arg);
+    if(job == NULL) {
+        printf("bg: %s: no such job\n", (arg != NULL) ? arg : "current");
+        return 1;
+    }
+    job->background = 1;
+    continueJob(job);
+    printf("[%d] %s &\n", job->id, job->command);
+    return 0;
+}
+
+/*
+ * Function to succeed (implementation of true and : commands).
+ */
+int trueBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    return 0;
+}
+
+/*
+ * Function to fail (implementation of false command).
+ */
+int falseBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    return 1;
+}
+
+/*
+ * Function to print the working directory (implementation of pwd command).
+ */
+int pwd(int argc, char** argv, int inFd, int outFd) {
+    //workDir always ends with a '/', which is only printed for the root directory.
+    int length = strlen(workDir);
+    if(length > 1) length--;
+    return (dprintf(outFd, "%.*s\n", length, workDir) < 0) ? 1 : 0;
+}
+
+/*
+ * Function to print the last component of a path, without a suffix if given (implementation of basename command).
+ */
+int basenameBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    if(argc < 2 || argc > 3) {
+        printf("basename: usage: basename name [suffix]\n");
+        return 1;
+    }
+    const char* path = argv[1];
+    size_t end = strlen(path);
+    while(end > 1 && path[end - 1] == '/') {
+        end--;
+    }
+    size_t start = end;
+    while(start > 0 && path[start - 1] != '/') {
+        start--;
+    }
+    //A path made of slashes only names the root directory.
+    if(start == end && end > 0) start = end - 1;
+    if(argc == 3) {
+        size_t suffixLength = strlen(argv[2]);
+        if(suffixLength < end - start && memcmp(path + end - suffixLength, argv[2], suffixLength) == 0) {
+            end -= suffixLength;
+        }
+    }
+    return (dprintf(outFd, "%.*s\n", (int) (end - start), path + start) < 0) ? 1 : 0;
+}
+
+/*
+ * Function to wait for a number of seconds (implementation of sleep command).
+ * Each argument is a duration read by parseDuration(), they are added up.
+ * Children that terminate meanwhile are reaped by the event loop, ^C ends the wait.
+ * Returns 0 after the full time, 130 if interrupted.
+ */
+int sleepBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    long long ms = 0;
+    if(argc < 2) {
+        printf("sleep: missing operand\n");
+        return 1;
+    }
+    for(int i = 1; i < argc; i++) {
+        long duration = parseDuration(argv[i]);
+        if(duration == -1) {
+            printf("sleep: invalid time interval '%s'\n", argv[i]);
+            return 1;
+        }
+        ms += duration;
+    }
+
+    struct timespec now;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    interrupted = 0;
+    while(!interrupted) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double remaining = (deadline.tv_sec - now.tv_sec) * 1e3 + (deadline.tv_nsec - now.tv_nsec) / 1e6;
+        if(remaining <= 0) return 0;
+        eventLoopWait((remaining > INT32_MAX) ? INT32_MAX : (int) remaining + 1);
+    }
+    if(jobControl) printf("\n");
+    return 128 + SIGINT;
+}
+
+/*
+ * Function to evaluate a unary test (a file test or a string test).
+ * Returns 0 if true, 1 if false, 2 for an unknown operator, which is reported.
+ */
+int unaryTest(const char* operator, const char* operand) {
+    struct stat info;
+    if(strlen(operator) != 2 || operator[0] != '-') {
+        printf("test: %s: unary operator expected\n", operator);
+        return 2;
+    }
+    switch(operator[1]) {
+        case 'n':
+            return operand[0] == '\0';
+        case 'z':
+            return operand[0] != '\0';
+        case 't':
+            return !isatty(atoi(operand));
+        case 'r':
+            return access(operand, R_OK) != 0;
+        case 'w':
+            return access(operand, W_OK) != 0;
+        case 'x':
+            return access(operand, X_OK) != 0;
+        case 'L':
+        case 'h':
+            return lstat(operand, &info) != 0 || !S_ISLNK(info.st_mode);
+        case 'e':
+        case 'f':
+        case 'd':
+        case 's':
+        case 'p':
+        case 'S':
+        case 'b':
+        case 'c':
+            break;
+        default:
+            printf("test: %s: unary operator expected\n", operator);
+            return 2;
+    }
+    if(stat(operand, &info) != 0) return 1;
+    switch(operator[1]) {
+        case 'f':
+            return !S_ISREG(info.st_mode);
+        case 'd':
+            return !S_ISDIR(info.st_mode);
+        case 's':
+            return info.st_size == 0;
+        case 'p':
+            return !S_ISFIFO(info.st_mode);
+        case 'S':
+            return !S_ISSOCK(info.st_mode);
+        case 'b':
+            return !S_ISBLK(info.st_mode);
+        case 'c':
+            return !S_ISCHR(info.st_mode);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Function to evaluate a binary test (a string comparison, an integer comparison or a file age comparison).
+ * Returns 0 if true, 1 if false, 2 for an unknown operator or an invalid integer, which is reported.
+ */
+int binaryTest(const char* left, const char* operator, const char* right) {
+    if(strcmp(operator, "=") == 0 || strcmp(operator, "==") == 0) return strcmp(left, right) != 0;
+    if(strcmp(operator, "!=") == 0) return strcmp(left, right) == 0;
+    if(strcmp(operator, "<") == 0) return strcmp(left, right) >= 0;
+    if(strcmp(operator, ">") == 0) return strcmp(left, right) <= 0;
+    if(strcmp(operator, "-nt") == 0 || strcmp(operator, "-ot") == 0) {
+        struct stat leftInfo;
+        struct stat rightInfo;
+        if(stat(left, &leftInfo) != 0 || stat(right, &rightInfo) != 0) return 1;
+        double difference = (leftInfo.st_mtim.tv_sec - rightInfo.st_mtim.tv_sec) +
+                            (leftInfo.st_mtim.tv_nsec - rightInfo.st_mtim.tv_nsec) / 1e9;
+        return (operator[1] == 'n') ? !(difference > 0) : !(difference < 0);
+    }
+
+    const char* operators[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    int index = 0;
+    while(index < 6 && strcmp(operator, operators[index]) != 0) {
+        index++;
+    }
+    if(index == 6) {
+        printf("test: %s: binary operator expected\n", operator);
+        return 2;
+    }
+    char* leftEnd = NULL;
+    char* rightEnd = NULL;
+    long long leftValue = strtoll(left, &leftEnd, 10);
+    long long rightValue = strtoll(right, &rightEnd, 10);
+    if(leftEnd == left || *leftEnd != '\0' || rightEnd == right || *rightEnd != '\0') {
+        printf("test: integer expression expected\n");
+        return 2;
+    }
+    int results[] = {leftValue == rightValue, leftValue != rightValue, leftValue < rightValue,
+                     leftValue <= rightValue, leftValue > rightValue, leftValue >= rightValue};
+    return !results[index];
+}
+
+/*
+ * Function to evaluate a test expression, following the POSIX rules based on the number of arguments,
+ * with "!" for negation and "-a"/"-o" for longer expressions.
+ * Returns 0 if true, 1 if false, 2 on error.
+ */
+int testExpression(int argc, char** argv) {
+    //-o binds less tightly than -a, split at the first of them outside of the operands of a binary test.
+    if(argc > 3) {
+        const char* connectives[] = {"-o", "-a"};
+        for(int c = 0; c < 2; c++) {
+            for(int i = 1; i < argc - 1; i++) {
+                if(strcmp(argv[i], connectives[c]) != 0) continue;
+                int left = testExpression(i, argv);
+                if(left == 2) return 2;
+                if(c == 0 && left == 0) return 0;
+                if(c == 1 && left != 0) return 1;
+                return testExpression(argc - i - 1, argv + i + 1);
+            }
+        }
+    }
+    if(argc == 0) {
+        return 1;
+    } else if(strcmp(argv[0], "!") == 0 && argc > 1) {
+        int result = testExpression(argc - 1, argv + 1);
+        return (result == 2) ? 2 : !result;
+    } else if(argc == 1) {
+        return argv[0][0] == '\0';
+    } else if(argc == 2) {
+        return unaryTest(argv[0], argv[1]);
+    } else if(argc == 3 && strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0) {
+        return argv[1][0] == '\0';
+    } else if(argc == 3) {
+        return binaryTest(argv[0], argv[1], argv[2]);
+    }
+    printf("test: too many arguments\n");
+    return 2;
+}
+
+/*
+ * Function to evaluate a condition (implementation of test and [ commands).
+ * Returns 0 if the condition is true, 1 if false, 2 on error.
+ */
+int testBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    if(strcmp(argv[0], "[") == 0) {
+        if(strcmp(argv[argc - 1], "]") != 0) {
+            printf("[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+    return testExpression(argc - 1, argv + 1);
+}
+
+/*
+ * Function to append the result of a printf() conversion to a string being built at the top of the line arena.
+ */
+char* appendFormatted(char* output, size_t* length, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    int size = vsnprintf(NULL, 0, format, arguments);
+    va_end(arguments);
+    if(size <= 0) return output;
+
+    char* formatted = malloc(size + 1);
+    va_start(arguments, format);
+    vsnprintf(formatted, size + 1, format, arguments);
+    va_end(arguments);
+    output = arenaAppend(&lineArena, output, *length, formatted, size);
+    *length += size;
+    free(formatted);
+    return output;
+}
+
+/*
+ * Function to print arguments according to a format (implementation of printf command).
+ * Supports the escapes \n \t \r \a \b \f \v \\ and \NNN (octal), and the conversions %s %c %d %i %u %o %x %X %%
+ * with flags, width and precision. The format is reused until every argument has been consumed.
+ * Returns 0 on success, 1 on an invalid conversion or number.
+ */
+int printfBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    if(argc < 2) {
+        printf("printf: usage: printf format [arguments]\n");
+        return 1;
+    }
+    const char* format = argv[1];
+    int argIndex = 2;
+    int status = 0;
+    char* output = arenaTop(&lineArena);
+    size_t length = 0;
+
+    do {
+        int consumed = 0;
+        for(const char* c = format; *c != '\0'; c++) {
+            if(*c == '\\' && c[1] != '\0') {
+                const char* escapes = "n\nt\tr\ra\ab\bf\fv\v\\\\";
+                const char* escape = strchr(escapes, c[1]);
+                char byte = '\\';
+                if(c[1] >= '0' && c[1] <= '7') {
+                    int value = 0;
+                    int digits = 0;
+                    while(digits < 3 && c[1] >= '0' && c[1] <= '7') {
+                        value = 8 * value + (*++c - '0');
+                        digits++;
+                    }
+                    byte = (char) value;
+                } else if(escape != NULL && (escape - escapes) % 2 == 0) {
+                    byte = escape[1];
+                    c++;
+                }
+                output = arenaAppend(&lineArena, output, length++, &byte, 1);
+                continue;
+            }
+            if(*c != '%') {
+                output = arenaAppend(&lineArena, output, length++, c, 1);
+                continue;
+            }
+            if(c[1] == '%') {
+                output = arenaAppend(&lineArena, output, length++, "%", 1);
+                c++;
+                continue;
+            }
+
+            //Copy the conversion specification, leaving room for a length modifier.
+            char specification[32] = "%";
+            size_t specLength = 1;
+            c++;
+            while(*c != '\0' && strchr("-+ #0123456789.", *c) != NULL && specLength < sizeof(specification) - 5) {
+                specification[specLength++] = *c++;
+            }
+            const char* arg = (argIndex < argc) ? argv[argIndex++] : NULL;
+            consumed = 1;
+            char* end = NULL;
+            if(*c == 's') {
+                strcpy(specification + specLength, "s");
+                output = appendFormatted(output, &length, specification, (arg != NULL) ? arg : "");
+            } else if(*c == 'c') {
+                strcpy(specification + specLength, "c");
+                if(arg != NULL && arg[0] != '\0') output = appendFormatted(output, &length, specification, arg[0]);
+            } else if(*c == 'd' || *c == 'i') {
+                long long value = (arg != NULL) ? strtoll(arg, &end, 0) : 0;
+                if(arg != NULL && (end == arg || *end != '\0')) {
+                    printf("printf: %s: invalid number\n", arg);
+                    status = 1;
+                }
+                snprintf(specification + specLength, 4, "ll%c", *c);
+                output = appendFormatted(output, &length, specification, value);
+            } else if(*c != '\0' && strchr("uoxX", *c) != NULL) {
+                unsigned long long value = (arg != NULL) ? strtoull(arg, &end, 0) : 0;
+                if(arg != NULL && (end == arg || *end != '\0')) {
+                    printf("printf: %s: invalid number\n", arg);
+                    status = 1;
+                }
+                snprintf(specification + specLength, 4, "ll%c", *c);
+                output = appendFormatted(output, &length, specification, value);
+            } else {
+                printf("printf: %%%c: invalid conversion\n", (*c != '\0') ? *c : ' ');
+                return 1;
+            }
+        }
+        if(!consumed) break;
+    } while(argIndex < argc);
+
+    if(length > 0 && write(outFd, output, length) == -1) status = 1;
+    return status;
+}
+
+/*
+ * Function to move all remaining data from one file descriptor to another, without passing it through a user-space
+ * buffer whenever the kernel can do the copy:
+ * copy_file_range() between two regular files (which may share extents on file systems supporting reflinks),
+ * splice() when either end is a pipe, sendfile() from a regular file to anything else (e.g. a terminal or socket).
+ * If none applies, or the files turn out not to support it, the data is copied with read()/write().
+ * Returns 0 on success, -1 on error.
+ */
+int transferData(int inFd, int outFd) {
+    struct stat inInfo;
+    struct stat outInfo;
+    if(fstat(inFd, &inInfo) == -1 || fstat(outFd, &outInfo) == -1) return -1;
+    ssize_t moved = 0;
+    int copied = 0;
+
+    //The kernel calls refuse some combinations of files (EINVAL, EXDEV, EBADF for O_APPEND, ...), that is only
+    //known once the first call fails, in which case the next method is tried. Errors after data moved are real.
+    if(S_ISREG(inInfo.st_mode) && S_ISREG(outInfo.st_mode)) {
+        while((moved = copy_file_range(inFd, NULL, outFd, NULL, COPY_CHUNK, 0)) > 0) {
+            copied = 1;
+        }
+        if(moved == 0) return 0;
+        if(copied) return -1;
+    }
+    if(S_ISFIFO(inInfo.st_mode) || S_ISFIFO(outInfo.st_mode)) {
+        while((moved = splice(inFd, NULL, outFd, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+            copied = 1;
+        }
+        if(moved == 0) return 0;
+        if(copied || errno != EINVAL) return -1;
+    } else if(S_ISREG(inInfo.st_mode)) {
+        while((moved = sendfile(outFd, inFd, NULL, COPY_CHUNK)) > 0) {
+            copied = 1;
+        }
+        if(moved == 0) return 0;
+        if(copied) return -1;
+    }
+
+    char* buffer = malloc(COPY_CHUNK);
+    ssize_t size = 0;
+    while((size = read(inFd, buffer, COPY_CHUNK)) > 0) {
+        for(ssize_t written = 0; written < size; ) {
+            ssize_t result = write(outFd, buffer + written, size - written);
+            if(result == -1) {
+                free(buffer);
+                return -1;
+            }
+            written += result;
+        }
+    }
+    free(buffer);
+    return (size == 0) ? 0 : -1;
+}
+
+/*
+ * Function to copy files, or the input if no file is given, to the output (implementation of cat command).
+ * Returns 0 on success, 1 if a file could not be copied.
+ */
+int cat(int argc, char** argv, int inFd, int outFd) {
+    int result = 0;
+    if(argc < 2) {
+        return (transferData(inFd, outFd) == -1) ? 1 : 0;
+    }
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-") == 0) {
+            if(transferData(inFd, outFd) == -1) result = 1;
+            continue;
+        }
+        int fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+        if(fd == -1) {
+            dprintf(STDERR_FILENO, "cat: %s: %s\n", argv[i], strerror(errno));
+            result = 1;
+            continue;
+        }
+        //A reader that went away (EPIPE) ends the copy quietly, like a cat killed by SIGPIPE would.
+        if(transferData(fd, outFd) == -1) {
+            result = 1;
+            if(errno == EPIPE) {
+                close(fd);
+                break;
+            }
+            dprintf(STDERR_FILENO, "cat: %s: %s\n", argv[i], strerror(errno));
+        }
+        close(fd);
+    }
+    return result;
+}
+
+/*
+ * Function to close the files opened for the redirections of a command.
+ */
+void closeRedirects(Command* command) {
+    for(int i = 0; i < command->redirectNum; i++) {
+        if(command->redirects[i].openFd != -1) {
+            close(command->redirects[i].openFd);
+            command->redirects[i].openFd = -1;
+        }
+    }
+}
+
+unsigned int userFds = 0;       //Bit n set while descriptor n (above 2) is open by the redirection of a compound command.
+
+/*
+ * Function to open the files a command is redirected to, just before it starts.
+ * Returns 0 on success, -1 if a file could not be opened, in which case none is left open.
+ */
+int openRedirects(Command* command) {
+    for(int i = 0; i < command->redirectNum; i++) {
+        Redirect* redirect = &command->redirects[i];
+        int flags = O_CLOEXEC;
+        if(redirect->type == REDIRECT_DUP) {
+            continue;
+        } else if(redirect->type == REDIRECT_IN) {
+            flags |= O_RDONLY;
+        } else if(redirect->type == REDIRECT_OUT) {
+            flags |= O_WRONLY | O_CREAT | O_TRUNC;
+        } else {
+            flags |= O_WRONLY | O_CREAT | O_APPEND;
+        }
+        redirect->openFd = open(redirect->target, flags, 0666);
+        if(redirect->openFd == -1) {
+            handleOpenError(redirect->target);
+            closeRedirects(command);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function to work out the descriptors 0 to REDIRECT_FD_MAX - 1 of a command once its redirections are applied, in
+ * the order they were written: fds receives for each the shell's descriptor it is a copy of, -1 if it is not open.
+ * A command starts with inFd, outFd, the shell's error output and the descriptors opened by the redirections of the
+ * compound commands it is part of. "n>&m" for any other m fails with EBADF, so that commands cannot reach the
+ * descriptors the shell keeps for itself.
+ * Returns 0 on success, -1 on error.
+ */
+int resolveRedirects(Command* command, int inFd, int outFd, int* fds) {
+    fds[STDIN_FILENO] = inFd;
+    fds[STDOUT_FILENO] = outFd;
+    fds[STDERR_FILENO] = STDERR_FILENO;
+    for(int fd = STDERR_FILENO + 1; fd < REDIRECT_FD_MAX; fd++) {
+        fds[fd] = (userFds & (1u << fd)) ? fd : -1;
+    }
+    for(int i = 0; i < command->redirectNum; i++) {
+        Redirect* redirect = &command->redirects[i];
+        int source = redirect->openFd;
+        if(redirect->type == REDIRECT_DUP) {
+            int fd = atoi(redirect->target);
+            source = (fd < REDIRECT_FD_MAX) ? fds[fd] : -1;
+        }
+        if(source == -1) {
+            printf("ERROR: %s: %s\n", redirect->target, strerror(EBADF));
+            return -1;
+        }
+        fds[redirect->fd] = source;
+    }
+    return 0;
+}
+
+/*
+ * Function to get the environment of a command: the exported variables, with the assignments written before the
+ * command name added or replacing them. Only a command with assignments needs its own copy, made in the line arena.
+ */
+char** commandEnvironment(Command* command) {
+    char** environment = varEnvironment(&shellVars);
+    if(command->assignNum == 0) return environment;
+
+    size_t envNum = 0;
+    while(environment[envNum] != NULL) {
+        envNum++;
+    }
+    char** copy = arenaAlloc(&lineArena, (envNum + command->assignNum + 1) * sizeof(char*));
+    memcpy(copy, environment, envNum * sizeof(char*));
+    for(int i = 0; i < command->assignNum; i++) {
+        size_t nameLength = assignmentNameLength(command->assigns[i]);
+        size_t j = 0;
+        while(j < envNum && strncmp(copy[j], command->assigns[i], nameLength + 1) != 0) {
+            j++;
+        }
+        if(j == envNum) envNum++;
+        copy[j] = command->assigns[i];
+    }
+    copy[envNum] = NULL;
+    return copy;
+}
+
+/*
+ * Function to spawn a non-built-in command of a job with its standard input and output connected to the given descriptors.
+ * The executable is resolved through the command hash table and spawned with posix_spawn(),
+ * which glibc implements with clone(CLONE_VM|CLONE_VFORK): the child shares the shell's address space
+ * until it execs, so no page tables are copied and the argument vector is handed over as it lies in the parser's arena.
+ * Returns the PID of the child, -1 if it could not be started.
+ */
+pid_t spawnCommand(Job* job, Command* command, int inFd, int outFd) {
+    pid_t childID = 0;
+
+    spawnCount++;
+    const char* path = lookupCommand(command->argv[0]);
+    if(path == NULL) {
+        spawnFailures++;
+        errno = ENOENT;
+        handleExecError();
+        return -1;
+    }
+    if(openRedirects(command) == -1) return -1;
+    int fds[REDIRECT_FD_MAX];
+    if(resolveRedirects(command, inFd, outFd, fds) == -1) {
+        closeRedirects(command);
+        return -1;
+    }
+
+    //Pipes and redirected files are opened with O_CLOEXEC, so only the descriptors duplicated here reach the
+    //executable. A source that is itself replaced is first copied above the redirectable descriptors, so the order of
+    //the dup2() calls does not matter and "3>&1 1>&2 2>&3" swaps the outputs.
+    posix_spawn_file_actions_t fileActions;
+    posix_spawn_file_actions_init(&fileActions);
+    int copies[REDIRECT_FD_MAX];
+    int copyNum = 0;
+    for(int fd = 0; fd < REDIRECT_FD_MAX; fd++) {
+        int source = fds[fd];
+        if(source == -1 || source == fd) continue;
+        if(command->redirectNum > 0 && source < REDIRECT_FD_MAX && fds[source] != source) {
+            source = fcntl(source, F_DUPFD_CLOEXEC, REDIRECT_FD_MAX);
+            copies[copyNum++] = source;
+        }
+        posix_spawn_file_actions_adddup2(&fileActions, source, fd);
+    }
+
+    //The shell ignores SIGPIPE (and the job control signals when interactive) and blocks SIGCHLD,
+    //executables get the default actions and an empty mask back.
+    posix_spawnattr_t attributes;
+    sigset_t defaultSignals;
+    sigset_t emptyMask;
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    posix_spawnattr_init(&attributes);
+    sigemptyset(&defaultSignals);
+    sigaddset(&defaultSignals, SIGPIPE);
+    sigaddset(&defaultSignals, SIGINT);
+    sigaddset(&defaultSignals, SIGQUIT);
+    sigaddset(&defaultSignals, SIGTSTP);
+    sigaddset(&defaultSignals, SIGTTIN);
+    sigaddset(&defaultSignals, SIGTTOU);
+    sigemptyset(&emptyMask);
+    posix_spawnattr_setsigdefault(&attributes, &defaultSignals);
+    posix_spawnattr_setsigmask(&attributes, &emptyMask);
+
+    //With job control the job gets its own process group, which a foreground job's first process puts in charge of the
+    //terminal before it execs, so it cannot be stopped by reading from the terminal before the shell hands it over.
+    if(jobControl) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attributes, job->pgid);
+#if __GLIBC_PREREQ(2, 35)
+        if(job->pgid == 0 && !job->background) posix_spawn_file_actions_addtcsetpgrp_np(&fileActions, STDIN_FILENO);
+#endif
+    }
+    posix_spawnattr_setflags(&attributes, flags);
+
+    //posix_spawn() returns the error code instead of setting errno, exec failures are reported here too.
+    Placement placement;
+    int placed = beginPlacement(job, command, &placement);
+    uint64_t start = readTicks();
+    int error = posix_spawn(&childID, path, &fileActions, &attributes, command->argv, commandEnvironment(command));
+    recordLatency(METRIC_SPAWN, readTicks() - start);
+    if(placed) endPlacement(job, &placement, (error == 0) ? childID : -1);
+    posix_spawn_file_actions_destroy(&fileActions);
+    posix_spawnattr_destroy(&attributes);
+    for(int i = 0; i < copyNum; i++) {
+        close(copies[i]);
+    }
+    closeRedirects(command);
+    if(error != 0) {
+        spawnFailures++;
+        errno = error;
+        handleExecError();
+        return -1;
+    }
+    addJobProcess(job, childID, start);
+    return childID;
+}
+
+/*---------------------------------------------Beginning of parallel section---------------------------------------------*/
+/*
+ * parallel runs a command once for each of a list of arguments, with at most a given number of commands running at a
+ * time. Each command is a job whose completion callback starts the next one, so a slot is refilled as soon as the
+ * event loop reaps a child. With -g the output of each command is kept in a memory file and copied to the output in
+ * one piece when the command finishes, so outputs of concurrent commands are never interleaved.
+ */
+
+typedef struct ParallelRun {
+    int running;                //Number of commands in flight.
+    int failed;                 //Number of commands that failed or could not be started.
+    int interrupted;            //Non-zero once a command was killed by ^C, no more commands are started then.
+    int outFd;
+} ParallelRun;
+
+typedef struct ParallelInput {
+    int watchFd;                //Copy of the input watched by the event loop, -1 if it cannot be (regular files).
+    int ready;                  //Non-zero if a read() would not block.
+    int ended;
+    char* buffer;               //Input read and not taken yet starts at offset start.
+    size_t start;
+    size_t size;
+    size_t capacity;
+} ParallelInput;
+
+typedef struct ParallelTask {
+    ParallelRun* run;
+    int groupFd;                //Memory file holding the output of the command with -g, -1 else.
+} ParallelTask;
+
+/*
+ * Function called when a command started by parallel terminates.
+ */
+void parallelTaskDone(Job* job, void* data) {
+    ParallelTask* task = data;
+    task->run->running--;
+    if(jobExitStatus(job) != 0) task->run->failed++;
+    if(WIFSIGNALED(job->status) && WTERMSIG(job->status) == SIGINT) task->run->interrupted = 1;
+    if(task->groupFd != -1) {
+        lseek(task->groupFd, 0, SEEK_SET);
+        transferData(task->groupFd, task->run->outFd);
+        close(task->groupFd);
+    }
+    free(task);
+    removeJob(job);
+}
+
+/*
+ * Function to build the command run for one argument: every "{}" in the words of the template is replaced by the
+ * argument, which is added as the last word if there is no "{}". The command has no assignments, redirections or
+ * CPU list, and is allocated in the line arena.
+ */
+void buildParallelCommand(Command* command, int templateArgc, char** templateArgv, const char* arg) {
+    size_t argLength = strlen(arg);
+    int replaced = 0;
+    memset(command, 0, sizeof(Command));
+    command->argv = arenaAlloc(&lineArena, (templateArgc + 2) * sizeof(char*));
+    command->assigns = command->argv;
+    for(int i = 0; i < templateArgc; i++) {
+        const char* word = templateArgv[i];
+        const char* marker = strstr(word, "{}");
+        if(marker == NULL) {
+            command->argv[i] = templateArgv[i];
+            continue;
+        }
+        char* expanded = arenaTop(&lineArena);
+        size_t length = 0;
+        for(; marker != NULL; marker = strstr(word, "{}")) {
+            expanded = arenaAppend(&lineArena, expanded, length, word, marker - word);
+            length += marker - word;
+            expanded = arenaAppend(&lineArena, expanded, length, arg, argLength);
+            length += argLength;
+            word = marker + 2;
+        }
+        expanded = arenaAppend(&lineArena, expanded, length, word, strlen(word) + 1);
+        command->argv[i] = expanded;
+        replaced = 1;
+    }
+    command->argc = templateArgc;
+    if(!replaced) command->argv[command->argc++] = (char*) arg;
+    command->argv[command->argc] = NULL;
+}
+
+/*
+ * Function called by the event loop when the input of parallel is readable.
+ */
+void handleParallelInput(int fd, uint32_t events, void* data) {
+    ((ParallelInput*) data)->ready = 1;
+}
+
+/*
+ * Function to read what is available of the input of parallel, after moving the lines not taken yet to the start of
+ * the buffer.
+ */
+void readParallelInput(ParallelInput* input, int inFd) {
+    input->size -= input->start;
+    memmove(input->buffer, input->buffer + input->start, input->size);
+    input->start = 0;
+    if(input->size == input->capacity) {
+        input->capacity = (input->capacity == 0) ? INPUT_MAX : 2 * input->capacity;
+        input->buffer = realloc(input->buffer, input->capacity + 1);
+    }
+    ssize_t result = read(inFd, input->buffer + input->size, input->capacity - input->size);
+    if(result > 0) {
+        input->size += result;
+    } else if(result == 0 || (errno != EINTR && errno != EAGAIN)) {
+        input->ended = 1;
+    }
+    input->ready = (input->watchFd == -1);
+}
+
+/*
+ * Function to take the next non-empty line of the input of parallel, the last one may have no newline.
+ * Returns the line, valid until the next read, or NULL if no complete line is buffered.
+ */
+const char* takeParallelLine(ParallelInput* input) {
+    while(input->start < input->size) {
+        char* line = input->buffer + input->start;
+        char* newline = memchr(line, '\n', input->size - input->start);
+        if(newline == NULL && !input->ended) return NULL;
+        if(newline == NULL) newline = input->buffer + input->size;
+        *newline = '\0';
+        input->start = newline - input->buffer + 1;
+        if(input->start > input->size) input->start = input->size;
+        if(line[0] != '\0') return line;
+    }
+    return NULL;
+}
+
+/*
+ * Function to start the command for one argument.
+ */
+void startParallelTask(ParallelRun* run, int templateArgc, char** templateArgv, const char* arg, int group, int inFd) {
+    Command command;
+    buildParallelCommand(&command, templateArgc, templateArgv, arg);
+
+    ParallelTask* task = malloc(sizeof(ParallelTask));
+    task->run = run;
+    task->groupFd = group ? memfd_create("parallel", MFD_CLOEXEC) : -1;
+
+    //Commands run in the shell's process group, so that they are in the foreground with the shell.
+    Job* job = createJob(arg, strlen(arg), 1);
+    job->pgid = shellPgid;
+    job->onDone = parallelTaskDone;
+    job->callbackData = task;
+    if(spawnCommand(job, &command, inFd, (task->groupFd != -1) ? task->groupFd : run->outFd) == -1) {
+        run->failed++;
+        if(task->groupFd != -1) close(task->groupFd);
+        free(task);
+        removeJob(job);
+        return;
+    }
+    run->running++;
+}
+
+/*
+ * Function to run a command for each argument, at most N at a time (implementation of parallel command).
+ * Usage: parallel [-j N] [-g] command [word...] [::: arg...]
+ * Without ":::" the arguments are the non-empty lines of the input. -j defaults to the number of online CPUs.
+ * Returns the number of commands that failed, at most 101 (like GNU parallel), or 130 if interrupted by ^C.
+ */
+int parallel(int argc, char** argv, int inFd, int outFd) {
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    int group = 0;
+    int i = 1;
+    for(; i < argc && argv[i][0] == '-'; i++) {
+        if(strcmp(argv[i], "-g") == 0) {
+            group = 1;
+        } else if(strncmp(argv[i], "-j", 2) == 0) {
+            const char* count = (argv[i][2] != '\0') ? argv[i] + 2 : ((i + 1 < argc) ? argv[++i] : "");
+            slots = atol(count);
+            if(slots < 1) {
+                printf("parallel: -j: invalid number of jobs\n");
+                return 2;
+            }
+        } else {
+            printf("parallel: %s: unknown option\n", argv[i]);
+            return 2;
+        }
+    }
+    int templateArgc = 0;
+    char** templateArgv = argv + i;
+    while(i + templateArgc < argc && strcmp(templateArgv[templateArgc], ":::") != 0) {
+        templateArgc++;
+    }
+    if(templateArgc == 0) {
+        printf("parallel: missing command\n");
+        return 2;
+    }
+
+    //Arguments come after ":::", or one per non-empty line of the input, which the commands do not get then. Lines are
+    //taken as they arrive: the input is watched by the event loop along with the commands, and only read while a slot
+    //is free, so a slow producer does not hold back the commands of the lines it already wrote.
+    char** args = argv + i + templateArgc + 1;
+    int argNum = argc - (i + templateArgc + 1);
+    int fromInput = (argNum < 0);
+    ParallelInput input = {-1, 1, 0, NULL, 0, 0, 0};
+    int commandInFd = inFd;
+    if(fromInput) {
+        input.watchFd = fcntl(inFd, F_DUPFD_CLOEXEC, REDIRECT_FD_MAX);
+        if(input.watchFd != -1 && eventLoopAdd(input.watchFd, EPOLLIN | EPOLLONESHOT, handleParallelInput, &input) == 0) {
+            input.ready = 0;
+        } else if(input.watchFd != -1) {
+            close(input.watchFd);
+            input.watchFd = -1;
+        }
+        commandInFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    ParallelRun run = {0, 0, 0, outFd};
+    int next = 0;
+    int done = 0;
+    fflush(stdout);
+    while((!done && !run.interrupted) || run.running > 0) {
+        while(!done && !run.interrupted && run.running < slots) {
+            const char* arg = NULL;
+            if(!fromInput) {
+                if(next < argNum) arg = args[next++];
+            } else if((arg = takeParallelLine(&input)) == NULL && !input.ended) {
+                if(!input.ready) {
+                    eventLoopModify(input.watchFd, EPOLLIN | EPOLLONESHOT);
+                    break;
+                }
+                readParallelInput(&input, inFd);
+                continue;
+            }
+            if(arg == NULL) {
+                done = 1;
+                break;
+            }
+            startParallelTask(&run, templateArgc, templateArgv, arg, group, commandInFd);
+        }
+        if(run.running > 0 || (!done && !run.interrupted)) eventLoopWait(-1);
+    }
+
+    if(input.watchFd != -1) {
+        eventLoopRemove(input.watchFd);
+        close(input.watchFd);
+    }
+    if(commandInFd != inFd) close(commandInFd);
+    free(input.buffer);
+    if(run.interrupted) {
+        //The ^C echoed by the terminal is not followed by a newline.
+        if(jobControl) printf("\n");
+        return 128 + SIGINT;
+    }
+    return (run.failed > 101) ? 101 : run.failed;
+}
+
+/*---------------------------------------------End of parallel section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of result cache section---------------------------------------------*/
+/*
+ * "cache [-i FILE]... [-c FILE]... [-e NAME]... command [word...]" runs a deterministic command only if its result is
+ * not known yet. The result is keyed by the working directory, the words of the command, the values of the variables
+ * named with -e and the state of the declared input files: size, modification time and inode with -i, content with
+ * -c. The command reads /dev/null, so that everything it depends on has to be declared.
+ * Results are stored in a directory ($XDG_CACHE_HOME/oshell, or RESULT_CACHE_DIR in the home directory), one file per
+ * result named after the XXH64 hash of its key, holding its output, error output and exit status. On a hit nothing is
+ * spawned and the output is written with sendfile(), on a miss it is written the same way once the command completed.
+ * An entry holds its whole key, which is compared on a hit, so two keys with the same hash only cost a miss. Results
+ * of commands killed by a signal are not stored.
+ * The store is kept under a size limit by removing the entries used least recently: a hit updates the modification
+ * time of its entry, and once the store outgrows the limit the oldest entries are removed until it is 10% below it.
+ *
+ * Entry layout: a ResultHeader, the key, the output and the error output.
+ */
+
+#define RESULT_MAGIC "OSHRSULT"
+#define RESULT_VERSION 1
+
+typedef struct ResultHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t status;
+    uint64_t keySize;
+    uint64_t outSize;
+    uint64_t errorSize;
+} ResultHeader;
+
+typedef struct ResultKey {
+    char* data;
+    size_t size;
+    size_t capacity;
+} ResultKey;
+
+typedef struct ResultEntry {
+    char name[24];
+    off_t size;
+    struct timespec used;       //Modification time, updated on every hit.
+} ResultEntry;
+
+long long resultLimit = RESULT_CACHE_LIMIT; //Size the store is kept under, set with "cache limit SIZE".
+long long resultBytes = -1;     //Size of the store, -1 until it is first scanned.
+unsigned long resultHits = 0;
+unsigned long resultMisses = 0;
+unsigned long resultStored = 0;
+unsigned long resultEvicted = 0;
+
+#define XXH_PRIME1 11400714785074694791ULL
+#define XXH_PRIME2 14029467366897019727ULL
+#define XXH_PRIME3 1609587929392839161ULL
+#define XXH_PRIME4 9650029242287828579ULL
+#define XXH_PRIME5 2870177450012600261ULL
+
+uint64_t xxhRead64(const unsigned char* bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+uint64_t xxhRotate(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t xxhRound(uint64_t accumulator, uint64_t input) {
+    return xxhRotate(accumulator + input * XXH_PRIME2, 31) * XXH_PRIME1;
+}
+
+uint64_t xxhMerge(uint64_t hash, uint64_t accumulator) {
+    return (hash ^ xxhRound(0, accumulator)) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+/*
+ * Function to compute the XXH64 hash (seed 0) of length bytes, 32 bytes per round in four independent lanes.
+ */
+uint64_t xxHash64(const void* input, size_t length) {
+    const unsigned char* bytes = input;
+    const unsigned char* end = bytes + length;
+    uint64_t hash;
+
+    if(length >= 32) {
+        uint64_t lanes[4] = {XXH_PRIME1 + XXH_PRIME2, XXH_PRIME2, 0, -XXH_PRIME1};
+        for(; bytes + 32 <= end; bytes += 32) {
+            for(int i = 0; i < 4; i++) {
+                lanes[i] = xxhRound(lanes[i], xxhRead64(bytes + 8 * i));
+            }
+        }
+        hash = xxhRotate(lanes[0], 1) + xxhRotate(lanes[1], 7) + xxhRotate(lanes[2], 12) + xxhRotate(lanes[3], 18);
+        for(int i = 0; i < 4; i++) {
+            hash = xxhMerge(hash, lanes[i]);
+        }
+    } else {
+        hash = XXH_PRIME5;
+    }
+    hash += length;
+
+    for(; bytes + 8 <= end; bytes += 8) {
+        hash = xxhRotate(hash ^ xxhRound(0, xxhRead64(bytes)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if(bytes + 4 <= end) {
+        uint32_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = xxhRotate(hash ^ (word * XXH_PRIME1), 23) * XXH_PRIME2 + XXH_PRIME3;
+        bytes += 4;
+    }
+    for(; bytes < end; bytes++) {
+        hash = xxhRotate(hash ^ (*bytes * XXH_PRIME5), 11) * XXH_PRIME1;
+    }
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/*
+ * Function to get the directory of the store, which is created with its parents if needed.
+ * Returns 0 on success, -1 if it cannot be created.
+ */
+int resultCacheDir(char* path, size_t size) {
+    const char* cacheHome = getVarValue(&shellVars, "XDG_CACHE_HOME");
+    const char* homeDir = getVarValue(&shellVars, "HOME");
+    if(cacheHome != NULL && cacheHome[0] == '/') {
+        snprintf(path, size, "%s/oshell", cacheHome);
+    } else {
+        snprintf(path, size, "%s/%s", (homeDir != NULL) ? homeDir : home, RESULT_CACHE_DIR);
+    }
+    for(char* slash = strchr(path + 1, '/'); ; slash = strchr(slash + 1, '/')) {
+        if(slash != NULL) *slash = '\0';
+        int result = mkdir(path, 0700);
+        int error = errno;
+        if(slash == NULL) return (result == -1 && error != EEXIST) ? -1 : 0;
+        *slash = '/';
+    }
+}
+
+/*
+ * Function to append bytes to a key.
+ */
+void keyAppend(ResultKey* key, const void* bytes, size_t count) {
+    if(key->size + count > key->capacity) {
+        key->capacity = (key->size + count > 2 * key->capacity) ? key->size + count : 2 * key->capacity;
+        key->data = realloc(key->data, key->capacity);
+    }
+    memcpy(key->data + key->size, bytes, count);
+    key->size += count;
+}
+
+/*
+ * Function to append a string and its NUL to a key, with a tag saying what it is.
+ */
+void keyAppendString(ResultKey* key, char tag, const char* string) {
+    keyAppend(key, &tag, 1);
+    keyAppend(key, string, strlen(string) + 1);
+}
+
+/*
+ * Function to append the state of an input file to a key: its size, modification time and inode, or with content set
+ * its size and the hash of its content. A missing file has a state too, so creating it changes the key.
+ * Returns 0 on success, -1 if the file exists but cannot be read.
+ */
+int keyAppendFile(ResultKey* key, const char* path, int content) {
+    keyAppendString(key, content ? 'c' : 'i', path);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if(fd == -1 && errno == ENOENT) {
+        keyAppend(key, "-", 1);
+        return 0;
+    }
+    if(fd == -1 || fstat(fd, &info) == -1) {
+        if(fd != -1) close(fd);
+        handleOpenError(path);
+        return -1;
+    }
+    uint64_t state[5] = {info.st_size, 0, 0, 0, 0};
+    if(!content) {
+        state[1] = info.st_dev;
+        state[2] = info.st_ino;
+        state[3] = info.st_mtim.tv_sec;
+        state[4] = info.st_mtim.tv_nsec;
+    } else if(info.st_size > 0) {
+        void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) {
+            close(fd);
+            handleMmapError();
+            return -1;
+        }
+        state[1] = xxHash64(data, info.st_size);
+        munmap(data, info.st_size);
+    }
+    close(fd);
+    keyAppend(key, "+", 1);
+    keyAppend(key, state, sizeof(state));
+    return 0;
+}
+
+/*
+ * Function to write size bytes of a file, from offset on, to a descriptor: with sendfile(), or with pread()/write()
+ * when sendfile() refuses the descriptor.
+ * Returns 0 on success, -1 on error.
+ */
+int replayResult(int fd, off_t offset, uint64_t size, int outFd) {
+    ssize_t moved = 0;
+    while(size > 0 && (moved = sendfile(outFd, fd, &offset, (size < COPY_CHUNK) ? size : COPY_CHUNK)) > 0) {
+        size -= moved;
+    }
+    if(size == 0) return 0;
+    if(moved == -1 && errno != EINVAL && errno != ENOSYS) return -1;
+
+    char* buffer = malloc(COPY_CHUNK);
+    while(size > 0) {
+        ssize_t length = pread(fd, buffer, (size < COPY_CHUNK) ? size : COPY_CHUNK, offset);
+        if(length <= 0) break;
+        for(ssize_t written = 0; written < length; ) {
+            ssize_t result = write(outFd, buffer + written, length - written);
+            if(result == -1) {
+                free(buffer);
+                return -1;
+            }
+            written += result;
+        }
+        offset += length;
+        size -= length;
+    }
+    free(buffer);
+    return (size == 0) ? 0 : -1;
+}
+
+/*
+ * Function to write out the output and error output of an entry.
+ */
+void replayEntry(int fd, ResultHeader* header, int outFd) {
+    off_t offset = sizeof(ResultHeader) + header->keySize;
+    fflush(stdout);
+    replayResult(fd, offset, header->outSize, outFd);
+    replayResult(fd, offset + header->outSize, header->errorSize, STDERR_FILENO);
+}
+
+/*
+ * Function to replay the entry at path if it holds the result of key, marking it as used.
+ * Returns the exit status of the result, -1 if there is no such entry.
+ */
+int replayStoredResult(const char* path, ResultKey* key, int outFd) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return -1;
+    ResultHeader header;
+    struct stat info;
+    int valid = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                memcmp(header.magic, RESULT_MAGIC, sizeof(header.magic)) == 0 && header.version == RESULT_VERSION &&
+                header.keySize == key->size && fstat(fd, &info) == 0 &&
+                (uint64_t) info.st_size == sizeof(header) + header.keySize + header.outSize + header.errorSize;
+    if(valid) {
+        char* stored = malloc(key->size);
+        valid = pread(fd, stored, key->size, sizeof(header)) == (ssize_t) key->size &&
+                memcmp(stored, key->data, key->size) == 0;
+        free(stored);
+    }
+    if(!valid) {
+        close(fd);
+        return -1;
+    }
+    replayEntry(fd, &header, outFd);
+    futimens(fd, NULL);
+    close(fd);
+    return header.status;
+}
+
+/*
+ * Function to run a command with its output and error output going to a new entry, which is put in place at path
+ * with rename() once complete, so that a concurrent lookup never sees it half written. The output is replayed once
+ * the command terminated. If the entry cannot be created, the command runs with the shell's output.
+ * Returns the exit status of the command.
+ */
+int runAndStoreResult(const char* path, ResultKey* key, Command* command, int outFd) {
+    char temporary[DIR_MAX + 32];
+    snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, getpid());
+    int fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    int errorFd = (fd != -1) ? memfd_create("cache", MFD_CLOEXEC) : -1;
+    if(fd == -1 || errorFd == -1) {
+        printf("ERROR: Cannot create cache entry %s: %s\n", temporary, strerror(errno));
+        if(fd != -1) close(fd);
+        unlink(temporary);
+        fd = -1;
+    } else {
+        pwrite(fd, key->data, key->size, sizeof(ResultHeader));
+        lseek(fd, sizeof(ResultHeader) + key->size, SEEK_SET);
+    }
+
+    //The command runs in the shell's process group, like those of parallel, so that ^C reaches it.
+    Job* job = createJob(command->argv[0], strlen(command->argv[0]), 1);
+    job->pgid = shellPgid;
+    int inFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int savedError = -1;
+    if(fd != -1) {
+        fflush(stdout);
+        savedError = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(errorFd, STDERR_FILENO);
+    }
+    pid_t childID = spawnCommand(job, command, inFd, (fd != -1) ? fd : outFd);
+    if(savedError != -1) {
+        dup2(savedError, STDERR_FILENO);
+        close(savedError);
+    }
+    close(inFd);
+
+    int status = 127;
+    int killed = 1;
+    if(childID != -1) {
+        while(job->state != JOB_DONE) {
+            eventLoopWait(-1);
+        }
+        status = jobExitStatus(job);
+        killed = WIFSIGNALED(job->status);
+    }
+    removeJob(job);
+    if(fd == -1) return status;
+
+    ResultHeader header;
+    struct stat info;
+    memset(&header, 0, sizeof(header));
+    fstat(fd, &info);
+    header.keySize = key->size;
+    header.outSize = info.st_size - sizeof(header) - key->size;
+    lseek(errorFd, 0, SEEK_SET);
+    lseek(fd, 0, SEEK_END);
+    transferData(errorFd, fd);
+    close(errorFd);
+    fstat(fd, &info);
+    header.errorSize = info.st_size - sizeof(header) - key->size - header.outSize;
+    memcpy(header.magic, RESULT_MAGIC, sizeof(header.magic));
+    header.version = RESULT_VERSION;
+    header.status = status;
+
+    if(!killed && pwrite(fd, &header, sizeof(header), 0) == sizeof(header) && rename(temporary, path) == 0) {
+        resultStored++;
+        if(resultBytes != -1) resultBytes += info.st_size;
+    } else {
+        unlink(temporary);
+    }
+    replayEntry(fd, &header, outFd);
+    close(fd);
+    return status;
+}
+
+/*
+ * Function to list the entries of the store.
+ * Returns the total size of the entries, -1 if the store cannot be read.
+ */
+long long scanResults(const char* dir, ResultEntry** entriesStore, size_t* numStore) {
+    DIR* stream = opendir(dir);
+    if(stream == NULL) return -1;
+    ResultEntry* entries = NULL;
+    size_t num = 0;
+    size_t capacity = 0;
+    long long total = 0;
+    struct dirent* dirEntry = NULL;
+    while((dirEntry = readdir(stream)) != NULL) {
+        size_t length = strlen(dirEntry->d_name);
+        struct stat info;
+        if(length >= sizeof(entries->name) || length < 4 || strcmp(dirEntry->d_name + length - 4, ".res") != 0) continue;
+        if(fstatat(dirfd(stream), dirEntry->d_name, &info, AT_SYMLINK_NOFOLLOW) == -1) continue;
+        if(num == capacity) {
+            capacity = (capacity == 0) ? 64 : 2 * capacity;
+            entries = realloc(entries, capacity * sizeof(ResultEntry));
+        }
+        memcpy(entries[num].name, dirEntry->d_name, length + 1);
+        entries[num].size = info.st_size;
+        entries[num].used = info.st_mtim;
+        total += info.st_size;
+        num++;
+    }
+    closedir(stream);
+    if(entriesStore != NULL) {
+        *entriesStore = entries;
+        *numStore = num;
+    } else {
+        free(entries);
+    }
+    return total;
+}
+
+int compareResultEntries(const void* first, const void* second) {
+    const ResultEntry* a = first;
+    const ResultEntry* b = second;
+    if(a->used.tv_sec != b->used.tv_sec) return (a->used.tv_sec < b->used.tv_sec) ? -1 : 1;
+    if(a->used.tv_nsec != b->used.tv_nsec) return (a->used.tv_nsec < b->used.tv_nsec) ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Function to remove the entries used least recently while the store is larger than the limit, until it is 10% below.
+ * The size of the store is only scanned again when the running count says it outgrew the limit, as other shells
+ * sharing the store may have added or removed entries since.
+ */
+void trimResults(const char* dir) {
+    if(resultBytes == -1) resultBytes = scanResults(dir, NULL, NULL);
+    if(resultBytes <= resultLimit) return;
+
+    ResultEntry* entries = NULL;
+    size_t num = 0;
+    resultBytes = scanResults(dir, &entries, &num);
+    if(resultBytes > resultLimit) {
+        qsort(entries, num, sizeof(ResultEntry), compareResultEntries);
+        int dirFd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        for(size_t i = 0; i < num && dirFd != -1 && resultBytes > resultLimit - resultLimit / 10; i++) {
+            if(unlinkat(dirFd, entries[i].name, 0) == -1) continue;
+            resultBytes -= entries[i].size;
+            resultEvicted++;
+        }
+        if(dirFd != -1) close(dirFd);
+    }
+    free(entries);
+}
+
+/*
+ * Function to parse a size with an optional K, M or G suffix (powers of 1024).
+ * Returns the size, -1 if it is malformed.
+ */
+long long parseSize(const char* text) {
+    char* end = NULL;
+    errno = 0;
+    long long size = strtoll(text, &end, 10);
+    if(end == text || errno != 0 || size < 0) return -1;
+    int shift = 0;
+    if(*end == 'K' || *end == 'k') {
+        shift = 10;
+    } else if(*end == 'M' || *end == 'm') {
+        shift = 20;
+    } else if(*end == 'G' || *end == 'g') {
+        shift = 30;
+    }
+    if(shift != 0) end++;
+    if(*end != '\0' || size > (LLONG_MAX >> shift)) return -1;
+    return size << shift;
+}
+
+/*
+ * Function to print the state of the store and the hits and misses of the shell.
+ */
+void printResultStats(const char* dir, int outFd) {
+    ResultEntry* entries = NULL;
+    size_t num = 0;
+    long long total = scanResults(dir, &entries, &num);
+    free(entries);
+    if(total != -1) resultBytes = total;
+    unsigned long lookups = resultHits + resultMisses;
+    dprintf(outFd, "store\t%s\n", dir);
+    dprintf(outFd, "entries\t%zu\n", num);
+    dprintf(outFd, "size\t%.1f MiB of %.1f MiB\n", ((total != -1) ? total : 0) / 1048576.0, resultLimit / 1048576.0);
+    dprintf(outFd, "hits\t%lu (%.1f%%)\n", resultHits, (lookups > 0) ? 100.0 * resultHits / lookups : 0.0);
+    dprintf(outFd, "misses\t%lu\n", resultMisses);
+    dprintf(outFd, "stored\t%lu\n", resultStored);
+    dprintf(outFd, "evicted\t%lu\n", resultEvicted);
+}
+
+/*
+ * Function to run a command through the result cache, or manage the cache (implementation of cache command).
+ * Usage: cache [-i FILE]... [-c FILE]... [-e NAME]... command [word...]
+ *        cache stats | cache clear | cache limit SIZE
+ * Returns the exit status of the command, stored or not, 2 for bad usage.
+ */
+int cacheBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    char dir[DIR_MAX];
+    if(resultCacheDir(dir, sizeof(dir)) == -1) {
+        printf("ERROR: Cannot create cache directory %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if(argc == 2 && strcmp(argv[1], "stats") == 0) {
+        printResultStats(dir, outFd);
+        return 0;
+    }
+    if(argc == 2 && strcmp(argv[1], "clear") == 0) {
+        long long limit = resultLimit;
+        resultLimit = 0;
+        trimResults(dir);
+        resultLimit = limit;
+        return 0;
+    }
+    if(argc == 3 && strcmp(argv[1], "limit") == 0) {
+        long long limit = parseSize(argv[2]);
+        if(limit == -1) {
+            printf("cache: %s: invalid size\n", argv[2]);
+            return 2;
+        }
+        resultLimit = limit;
+        trimResults(dir);
+        return 0;
+    }
+
+    ResultKey key = {NULL, 0, 0};
+    char cwd[DIR_MAX];
+    if(getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+    keyAppendString(&key, 'd', cwd);
+    int i = 1;
+    for(; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        if(strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-c") == 0) {
+            if(keyAppendFile(&key, argv[i + 1], argv[i][1] == 'c') == -1) {
+                free(key.data);
+                return 1;
+            }
+        } else if(strcmp(argv[i], "-e") == 0) {
+            const char* value = getVarValue(&shellVars, argv[i + 1]);
+            keyAppendString(&key, 'e', argv[i + 1]);
+            keyAppendString(&key, (value != NULL) ? '=' : '-', (value != NULL) ? value : "");
+        } else {
+            break;
+        }
+    }
+    if(i >= argc || argv[i][0] == '-') {
+        printf("Usage: cache [-i FILE]... [-c FILE]... [-e NAME]... command [word...]\n"
+               "       cache stats | cache clear | cache limit SIZE\n");
+        free(key.data);
+        return 2;
+    }
+    for(int j = i; j < argc; j++) {
+        keyAppendString(&key, 'w', argv[j]);
+    }
+
+    char path[DIR_MAX + 24];
+    snprintf(path, sizeof(path), "%s/%016llx.res", dir, (unsigned long long) xxHash64(key.data, key.size));
+    int status = replayStoredResult(path, &key, outFd);
+    if(status != -1) {
+        resultHits++;
+    } else {
+        Command command;
+        memset(&command, 0, sizeof(command));
+        command.argc = argc - i;
+        command.argv = argv + i;
+        command.assigns = command.argv;
+        resultMisses++;
+        status = runAndStoreResult(path, &key, &command, outFd);
+        trimResults(dir);
+    }
+    free(key.data);
+    return status;
+}
+
+/*---------------------------------------------End of result cache section---------------------------------------------*/
+
+/*
+ * Function to stand for command and builtin when they are not followed by a command, see resolveBuiltIn().
+ * For "builtin name" it is only reached when name is not a built-in.
+ */
+int commandBuiltIn(int argc, char** argv, int inFd, int outFd) {
+    if(argc < 2) return 0;
+    printf("%s: %s: not a shell builtin\n", argv[0], argv[1]);
+    return 1;
+}
+
+/*---------------------------------------------Beginning of built-in registry section---------------------------------------------*/
+/*
+ * Built-ins are found through a perfect hash table: at start-up a seed is searched for with which the names of all
+ * built-ins hash to distinct slots, so finding a command costs one hash and at most one string comparison, however
+ * many built-ins there are.
+ */
+
+const BuiltIn builtIns[] = {
+    {"cd", cd}, {"echo", echo}, {"export", export}, {"hash", hash}, {"cat", cat, 1}, {"jobs", jobsBuiltIn},
+    {"wait", waitBuiltIn}, {"fg", fg}, {"bg", bg}, {"parallel", parallel, 1}, {"true", trueBuiltIn}, {":", trueBuiltIn},
+    {"false", falseBuiltIn}, {"test", testBuiltIn}, {"[", testBuiltIn}, {"printf", printfBuiltIn}, {"pwd", pwd},
+    {"sleep", sleepBuiltIn, 1}, {"basename", basenameBuiltIn}, {"command", commandBuiltIn, 1},
+    {"builtin", commandBuiltIn, 1}, {"set", setBuiltIn}, {"stats", statsBuiltIn}, {"cache", cacheBuiltIn, 1},
+    {"joblog", joblog},
+};
+
+const size_t builtInNum = sizeof(builtIns) / sizeof(builtIns[0]);
+const BuiltIn* builtInTable[1 << BUILTIN_TABLE_BITS];
+uint32_t builtInSeed = 0;
+
+/*
+ * Function to get the slot of a name in the built-in table for a seed.
+ */
+uint32_t builtInSlot(const char* name, size_t length, uint32_t seed) {
+    return ((hashBytes(name, length) ^ seed) * 2654435761u) >> (32 - BUILTIN_TABLE_BITS);
+}
+
+/*
+ * Function to find a seed without collisions and fill the built-in table.
+ */
+void initBuiltIns() {
+    for(builtInSeed = 0; ; builtInSeed++) {
+        memset(builtInTable, 0, sizeof(builtInTable));
+        size_t i = 0;
+        for(; i < builtInNum; i++) {
+            uint32_t slot = builtInSlot(builtIns[i].name, strlen(builtIns[i].name), builtInSeed);
+            if(builtInTable[slot] != NULL) break;
+            builtInTable[slot] = &builtIns[i];
+        }
+        if(i == builtInNum) return;
+    }
+}
+
+/*
+ * Function to find which built-in command implements a command name.
+ * Returns the built-in, NULL if the command is not a built-in.
+ */
+const BuiltIn* findBuiltIn(const char* name) {
+    const BuiltIn* entry = builtInTable[builtInSlot(name, strlen(name), builtInSeed)];
+    return (entry != NULL && strcmp(entry->name, name) == 0) ? entry : NULL;
+}
+
+/*
+ * Function to find the built-in a command runs, removing the command and builtin escapes from its arguments:
+ * "command name" runs the executable name even if there is a built-in of that name, "builtin name" only runs a
+ * built-in.
+ * Returns the built-in, NULL if the command runs an executable.
+ */
+const BuiltIn* resolveBuiltIn(Command* command) {
+    int external = 0;
+    while(command->argc > 1) {
+        if(strcmp(command->argv[0], "command") == 0) {
+            external = 1;
+        } else if(strcmp(command->argv[0], "builtin") == 0) {
+            //An unknown name is left to the builtin built-in, which reports it.
+            if(findBuiltIn(command->argv[1]) == NULL) break;
+            external = 0;
+        } else {
+            break;
+        }
+        command->argv++;
+        command->argc--;
+    }
+    return external ? NULL : findBuiltIn(command->argv[0]);
+}
+
+/*
+ * Function to call a built-in command implementation.
+ * Built-ins read from inFd and write to outFd so that they can run inside a pipeline.
+ * Returns the exit status of the built-in.
+ */
+int builtIn(const BuiltIn* command, int argc, char** argv, int inFd, int outFd) {
+    //Output may be written straight to the file descriptor, so nothing may be left in stdout's buffer,
+    //and messages the built-in printed must come out before the output of the next command.
+    fflush(stdout);
+    int status = command->function(argc, argv, inFd, outFd);
+    fflush(stdout);
+    return status;
+}
+
+/*
+ * Function to tell if a built-in may run inside the shell. A server runs the built-ins that may block in a copy of
+ * itself, as the lines of its other connections would wait for them.
+ */
+int runsInShell(const BuiltIn* command) {
+    return command != NULL && !(serving && command->mayBlock);
+}
+
+/*---------------------------------------------End of built-in registry section---------------------------------------------*/
+
+/*
+ * Function to run a built-in inside the shell with its redirections applied.
+ * The redirections are resolved the same way as for a spawned command, then the input and output replace inFd and
+ * outFd and the error output temporarily replaces the shell's own stderr. Other descriptors can be copied from, as in
+ * "3>&1 1>&2 2>&3", but the built-in itself only uses those three.
+ * Returns the exit status of the built-in, 1 if a redirection failed.
+ */
+int runBuiltIn(const BuiltIn* builtInCommand, Command* command, int inFd, int outFd) {
+    if(command->redirectNum == 0) return builtIn(builtInCommand, command->argc, command->argv, inFd, outFd);
+    if(openRedirects(command) == -1) return 1;
+    int fds[REDIRECT_FD_MAX];
+    if(resolveRedirects(command, inFd, outFd, fds) == -1) {
+        closeRedirects(command);
+        return 1;
+    }
+
+    //The shell's stderr is kept aside before it is replaced, the input or output may be a copy of it.
+    int savedError = -1;
+    if(fds[STDERR_FILENO] != STDERR_FILENO) {
+        savedError = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, REDIRECT_FD_MAX);
+        if(fds[STDIN_FILENO] == STDERR_FILENO) fds[STDIN_FILENO] = savedError;
+        if(fds[STDOUT_FILENO] == STDERR_FILENO) fds[STDOUT_FILENO] = savedError;
+        dup2(fds[STDERR_FILENO], STDERR_FILENO);
+    }
+    int status = builtIn(builtInCommand, command->argc, command->argv, fds[STDIN_FILENO], fds[STDOUT_FILENO]);
+    if(savedError != -1) {
+        dup2(savedError, STDERR_FILENO);
+        close(savedError);
+    }
+    closeRedirects(command);
+    return status;
+}
+
+/*
+ * Function to run a built-in in a forked copy of the shell, as a process of a job.
+ * Descriptors in closeFds (other than inFd and outFd) are closed in the child.
+ * Returns the PID of the child, -1 if it could not be started.
+ */
+pid_t forkBuiltIn(Job* job, const BuiltIn* builtInCommand, Command* command, int inFd, int outFd, int* closeFds, int closeNum) {
+    fflush(stdout);
+    Placement placement;
+    int placed = beginPlacement(job, command, &placement);
+    spawnCount++;
+    uint64_t start = readTicks();
+    pid_t childID = fork();
+    if(childID == 0) {
+        sigset_t emptyMask;
+        sigemptyset(&emptyMask);
+        sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        resetEventLoop();
+        if(jobControl) setpgid(0, job->pgid);
+        for(int i = 0; i < closeNum; i++) {
+            if(closeFds[i] != inFd && closeFds[i] != outFd) close(closeFds[i]);
+        }
+        _exit(runBuiltIn(builtInCommand, command, inFd, outFd));
+    }
+    recordLatency(METRIC_SPAWN, readTicks() - start);
+    if(placed) endPlacement(job, &placement, childID);
+    if(childID == -1) {
+        spawnFailures++;
+        return -1;
+    }
+
+    //Set the process group from both sides, so it is in place whichever runs first.
+    if(jobControl) setpgid(childID, (job->pgid != 0) ? job->pgid : childID);
+    addJobProcess(job, childID, start);
+    return childID;
+}
+
+/*
+ * Function to execute the commands of a pipeline as a job, with the output of each command connected to the input of
+ * the next. Every command is started before any of them is waited for, so all of them run concurrently.
+ * A built-in at either end of the pipeline runs inside the shell, writing to or reading from the pipe directly.
+ * A built-in anywhere else (or at the start when the end is already a built-in, so that the two never wait on each
+ * other) runs in a forked copy of the shell, and so does every built-in of a job with a deadline, which could not be
+ * stopped otherwise.
+ * Returns the exit status of the last command if it is a built-in run inside the shell, -1 else.
+ */
+int executePipeline(Job* job, Pipeline* pipeline) {
+    int stageNum = pipeline->stageNum;
+    Command* stages = pipeline->stages;
+    int pipes[PIPELINE_MAX - 1][2];
+    const BuiltIn* commands[PIPELINE_MAX];
+    int inProcess[PIPELINE_MAX] = {0};
+    int status = -1;
+
+    for(int i = 0; i < stageNum; i++) {
+        commands[i] = resolveBuiltIn(&stages[i]);
+    }
+    inProcess[stageNum - 1] = (runsInShell(commands[stageNum - 1]) && job->timeoutMs <= 0);
+    inProcess[0] = (runsInShell(commands[0]) && !inProcess[stageNum - 1] && job->timeoutMs <= 0);
+
+    //Create all pipes up front, enlarged so that fast producers are not throttled by the 64 KiB default.
+    for(int i = 0; i < stageNum - 1; i++) {
+        if(pipe2(pipes[i], O_CLOEXEC) == -1) {
+            printf("ERROR: Cannot create pipe: %s\n", strerror(errno));
+            for(int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            return 1;
+        }
+        fcntl(pipes[i][1], F_SETPIPE_SZ, PIPE_SIZE);
+    }
+
+    //Start every command that does not run inside the shell.
+    for(int i = 0; i < stageNum; i++) {
+        int inFd = (i == 0) ? STDIN_FILENO : pipes[i - 1][0];
+        int outFd = (i == stageNum - 1) ? STDOUT_FILENO : pipes[i][1];
+        if(inProcess[i]) {
+            continue;
+        } else if(commands[i] == NULL) {
+            spawnCommand(job, &stages[i], inFd, outFd);
+        } else {
+            forkBuiltIn(job, commands[i], &stages[i], inFd, outFd, &pipes[0][0], 2 * (stageNum - 1));
+        }
+    }
+
+    //Close the shell's copies of the pipe ends, keeping only the ones used by built-ins running in the shell.
+    for(int i = 0; i < stageNum - 1; i++) {
+        if(!inProcess[i]) close(pipes[i][1]);
+        if(!inProcess[i + 1]) close(pipes[i][0]);
+    }
+
+    if(inProcess[0]) {
+        runBuiltIn(commands[0], &stages[0], STDIN_FILENO, pipes[0][1]);
+        close(pipes[0][1]);
+    }
+    if(inProcess[stageNum - 1]) {
+        status = runBuiltIn(commands[stageNum - 1], &stages[stageNum - 1], pipes[stageNum - 2][0], STDOUT_FILENO);
+        close(pipes[stageNum - 2][0]);
+    }
+    return status;
+}
+
+/*
+ * Function to print the time taken by a command (for the time keyword): wall-clock time, and CPU time of the shell
+ * since start plus that of the job's processes.
+ */
+void printTimes(Job* job, struct timespec* start, struct rusage* shellStart) {
+    struct timespec end;
+    struct rusage shellEnd;
+    struct timeval user;
+    struct timeval system;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &shellEnd);
+    timersub(&shellEnd.ru_utime, &shellStart->ru_utime, &user);
+    timersub(&shellEnd.ru_stime, &shellStart->ru_stime, &system);
+    if(job != NULL) {
+        timeradd(&user, &job->usage.ru_utime, &user);
+        timeradd(&system, &job->usage.ru_stime, &system);
+    }
+    double real = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+    fflush(stdout);
+    dprintf(STDERR_FILENO, "\nreal\t%dm%.3fs\nuser\t%dm%.3fs\nsys\t%dm%.3fs\n",
+            (int) real / 60, real - 60 * ((int) real / 60),
+            (int) user.tv_sec / 60, user.tv_sec % 60 + user.tv_usec / 1e6,
+            (int) system.tv_sec / 60, system.tv_sec % 60 + system.tv_usec / 1e6);
+}
+
+/*
+ * Function to set the shell variables assigned before a command.
+ */
+void assignVariables(Command* command) {
+    for(int i = 0; i < command->assignNum; i++) {
+        char* assign = command->assigns[i];
+        size_t nameLength = assignmentNameLength(assign);
+        setVar(&shellVars, assign, nameLength, assign + nameLength + 1, strlen(assign + nameLength + 1), 0);
+
+        //Cached command paths are only valid for the old search path.
+        if(nameLength == 4 && strncmp(assign, "PATH", 4) == 0) {
+            clearCommandHash();
+            updateCompletionPath();
+        }
+    }
+}
+
+/*
+ * Function to take the @cpu= prefix of a command off its arguments, into the CPU set it is placed on.
+ * Returns 0 on success, -1 if the CPU list is malformed.
+ */
+int takePlacement(Command* command) {
+    if(command->argc == 0 || strncmp(command->argv[0], "@cpu=", 5) != 0) return 0;
+    command->cpus = arenaAlloc(&lineArena, sizeof(cpu_set_t));
+    if(parseCpuList(command->argv[0] + 5, command->cpus) == -1) {
+        printf("ERROR: Invalid CPU list in %s\n", command->argv[0]);
+        return -1;
+    }
+    command->argv++;
+    command->argc--;
+    return 0;
+}
+
+/*
+ * Function to take the timeout prefix ("timeout [-k GRACE] DURATION") of a command off its arguments, into the
+ * deadline of its job and the grace period between SIGTERM and SIGKILL.
+ * Returns 0 on success, -1 if a duration is malformed or the command is missing.
+ */
+int takeTimeout(Command* command, long* timeoutMs, long* graceMs) {
+    if(command->argc == 0 || strcmp(command->argv[0], "timeout") != 0) return 0;
+    int used = 1;
+    *graceMs = TIMEOUT_GRACE_MS;
+    if(used + 1 < command->argc && strcmp(command->argv[used], "-k") == 0) {
+        *graceMs = parseDuration(command->argv[used + 1]);
+        if(*graceMs == -1) {
+            printf("ERROR: Invalid duration in timeout: %s\n", command->argv[used + 1]);
+            return -1;
+        }
+        used += 2;
+    }
+    if(used + 1 >= command->argc) {
+        printf("ERROR: Usage: timeout [-k GRACE] DURATION command\n");
+        return -1;
+    }
+    *timeoutMs = parseDuration(command->argv[used]);
+    if(*timeoutMs == -1) {
+        printf("ERROR: Invalid duration in timeout: %s\n", command->argv[used]);
+        return -1;
+    }
+    command->argv += used + 1;
+    command->argc -= used + 1;
+    return 0;
+}
+
+/*
+ * Function to start the commands of a parsed line, line being its text for the job table.
+ * Built-ins run inside the shell, assignments and redirections alone, complete before it returns and store their exit
+ * status in statusStore, which is -1 when the status is that of the job.
+ * A timeout prefix on the first command gives the whole job a deadline, and makes a lone built-in run as a process.
+ * "timeout 0" gives it none, not even the shell's default.
+ * Returns the job running the processes of the line, NULL if there is none.
+ */
+Job* startPipeline(Pipeline* pipeline, const char* line, size_t length, int* statusStore) {
+    int status = 0;
+    Job* job = NULL;
+    Command* first = &pipeline->stages[0];
+
+    int missingCommand = 0;
+    int badPlacement = 0;
+    long timeoutMs = -1;
+    long graceMs = TIMEOUT_GRACE_MS;
+    lineCount++;
+    int badTimeout = (takeTimeout(first, &timeoutMs, &graceMs) == -1);
+    for(int i = 0; i < pipeline->stageNum; i++) {
+        if(takePlacement(&pipeline->stages[i]) == -1) badPlacement = 1;
+        if(pipeline->stages[i].argc == 0) missingCommand = 1;
+    }
+
+    if(badTimeout || badPlacement) {
+        status = (badTimeout) ? 125 : 2;
+    } else if(missingCommand && pipeline->stageNum > 1) {
+        printf("ERROR: Missing command in pipeline\n");
+        status = 2;
+    } else if(missingCommand) {
+        //A line of assignments sets shell variables, redirections alone create or truncate their files,
+        //a bare time keyword times nothing. The status is that of the last command substitution, if any.
+        assignVariables(first);
+        if(pipeline->substituted) status = lastStatus;
+        if(openRedirects(first) == -1) {
+            status = 1;
+        } else {
+            closeRedirects(first);
+        }
+    } else if(pipeline->stageNum > 1) {
+        job = createJob(line, length, pipeline->background);
+        job->timeoutMs = timeoutMs;
+        status = executePipeline(job, pipeline);
+    } else {
+        const BuiltIn* builtInCommand = resolveBuiltIn(first);
+
+        //Check to see which command to execute
+        if(builtInCommand != NULL && (pipeline->background || timeoutMs > 0 || !runsInShell(builtInCommand))) {
+            //A built-in started in the background, with a deadline or in a server that it could block runs in a copy
+            //of the shell, like any other job.
+            job = createJob(line, length, pipeline->background);
+            job->timeoutMs = timeoutMs;
+            forkBuiltIn(job, builtInCommand, first, STDIN_FILENO, STDOUT_FILENO, NULL, 0);
+            status = -1;
+        } else if(builtInCommand != NULL) {
+            status = runBuiltIn(builtInCommand, first, STDIN_FILENO, STDOUT_FILENO);
+        } else {
+            job = createJob(line, length, pipeline->background);
+            job->timeoutMs = timeoutMs;
+            spawnCommand(job, first, STDIN_FILENO, STDOUT_FILENO);
+            status = -1;
+        }
+    }
+
+    if(job != NULL && job->pidNum == 0) {
+        //Nothing could be started.
+        if(status == -1) status = 127;
+        removeJob(job);
+        job = NULL;
+    }
+    if(job != NULL && timeoutMs > 0) setJobDeadline(job, timeoutMs, graceMs);
+    *statusStore = status;
+    return job;
+}
+
+/*---------------------------------------------Beginning of control flow section---------------------------------------------*/
+/*
+ * Command lists, loops, conditionals and functions run inside the shell by walking the nodes made by the list parser:
+ * a simple command is parsed when it runs and goes through runPipeline(), so built-ins and assignments in a loop body
+ * cost no process at all, and only external commands are spawned. Nodes and the commands parsed from them live in the
+ * line arena, which every node rewinds once it ran, so a loop of any length runs in the same memory.
+ * break, continue and return are handled by runPipeline() like exit: they only record how many loops to leave or that
+ * the function returns, which stops the lists they are in and is acted on by the enclosing loops and function call.
+ * A function keeps a copy of the text of its body, parsed again into an arena of its own when it is defined.
+ */
+
+typedef struct Function {
+    char* name;
+    char* source;               //Text of the body, which its nodes point into.
+    Arena arena;                //Nodes of the body.
+    Node* body;
+    int calls;                  //Number of calls running, during which a replaced definition is kept.
+    int replaced;               //Non-zero once another definition took its place.
+    struct Function* next;
+} Function;
+
+Function* functionTable[HASH_BUCKETS];
+int functionNum = 0;
+int functionDepth = 0;          //Number of function calls running.
+int loopDepth = 0;              //Number of loops running.
+int breakCount = 0;             //Number of loops left to break out of.
+int continueCount = 0;          //Number of loops left to leave, the last of which goes on with its next iteration.
+int returning = 0;              //Non-zero while the running function returns.
+unsigned long loopIterations = 0;
+
+/*
+ * Function to tell if the commands left in a list must be skipped: a break, continue or return is under way, or ^C was
+ * typed.
+ */
+int controlPending() {
+    return breakCount > 0 || continueCount > 0 || returning || interrupted;
+}
+
+/*
+ * Function to carry out break, continue and return.
+ * Returns 1 with the exit status stored in statusStore if the command is one of them, 0 else.
+ */
+int takeLoopControl(Command* command, int* statusStore) {
+    const char* name = command->argv[0];
+    if(strcmp(name, "return") == 0) {
+        if(functionDepth == 0) {
+            printf("ERROR: return outside of a function\n");
+            *statusStore = 1;
+            return 1;
+        }
+        returning = 1;
+        *statusStore = (command->argc > 1) ? atoi(command->argv[1]) & 255 : lastStatus;
+        return 1;
+    }
+    int isBreak = (strcmp(name, "break") == 0);
+    if(!isBreak && strcmp(name, "continue") != 0) return 0;
+
+    int count = (command->argc > 1) ? atoi(command->argv[1]) : 1;
+    *statusStore = 0;
+    if(count < 1) {
+        printf("ERROR: %s: loop count out of range\n", name);
+        *statusStore = 1;
+    } else if(isBreak) {
+        breakCount = (count < loopDepth) ? count : loopDepth;
+    } else {
+        continueCount = (count < loopDepth) ? count : loopDepth;
+    }
+    return 1;
+}
+
+/*
+ * Function to tell, after the condition or the body of a loop ran, whether the loop stops: after ^C, during a return,
+ * or for a break, of which it takes one level. A continue of an enclosing loop stops it too, one of the loop itself
+ * is taken and the loop goes on.
+ */
+int leaveLoop() {
+    //^C reaches the shell through the signal descriptor, which a loop of built-ins never waits on, so it is read here.
+    if(jobControl && ++loopIterations % LOOP_POLL_INTERVAL == 0) handleSignals(signalFd, EPOLLIN, NULL);
+    if(interrupted || returning) return 1;
+    if(breakCount > 0) {
+        breakCount--;
+        return 1;
+    }
+    if(continueCount > 1) {
+        continueCount--;
+        return 1;
+    }
+    continueCount = 0;
+    return 0;
+}
+
+/*
+ * Function to find a function by name.
+ * Returns the function, NULL if there is none of that name.
+ */
+Function* findFunction(const char* name) {
+    if(functionNum == 0) return NULL;
+    for(Function* function = functionTable[hashBytes(name, strlen(name)) % HASH_BUCKETS]; function != NULL;
+        function = function->next) {
+        if(strcmp(function->name, name) == 0) return function;
+    }
+    return NULL;
+}
+
+/*
+ * Function to free a function definition.
+ */
+void freeFunction(Function* function) {
+    ArenaChunk* chunk = function->arena.first;
+    while(chunk != NULL) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(function->name);
+    free(function->source);
+    free(function);
+}
+
+/*
+ * Function to define a function, replacing any function of the same name.
+ */
+void defineFunction(Node* node) {
+    Node* body = node->first;
+    Function* function = malloc(sizeof(Function));
+    function->name = strndup(node->name, node->nameLength);
+    function->source = malloc(body->length);
+    memcpy(function->source, body->text, body->length);
+    function->arena = (Arena) {NULL, NULL, 0};
+    ListParser parser = {function->source, function->source + body->length, &function->arena, 0, 0, 0, ""};
+    function->body = parseList(&parser, 1);
+    function->calls = 0;
+    function->replaced = 0;
+    function->next = NULL;
+
+    Function** slot = &functionTable[hashBytes(node->name, node->nameLength) % HASH_BUCKETS];
+    while(*slot != NULL && strcmp((*slot)->name, function->name) != 0) {
+        slot = &(*slot)->next;
+    }
+    if(*slot != NULL) {
+        //A function replacing itself while it runs is freed once it returns.
+        Function* old = *slot;
+        function->next = old->next;
+        if(old->calls > 0) {
+            old->replaced = 1;
+        } else {
+            freeFunction(old);
+        }
+    } else {
+        functionNum++;
+    }
+    *slot = function;
+}
+
+/*
+ * Function to apply the redirections of a command to the shell's own descriptors, for a compound command or a
+ * function call, whose commands all inherit them. The descriptors they replace are kept in saved, one per
+ * redirection, until restoreShellFds() puts them back.
+ * Returns 0 on success, -1 if a file could not be opened or a descriptor copied from is not open.
+ */
+int redirectShellFds(Command* command, int* saved) {
+    //Every copied descriptor is checked before any is replaced, so a failure leaves nothing to undo.
+    unsigned int openFds = userFds;
+    for(int i = 0; i < command->redirectNum; i++) {
+        Redirect* redirect = &command->redirects[i];
+        if(redirect->type == REDIRECT_DUP) {
+            int source = atoi(redirect->target);
+            if(source >= REDIRECT_FD_MAX || (source > STDERR_FILENO && !(openFds & (1u << source)))) {
+                printf("ERROR: %s: %s\n", redirect->target, strerror(EBADF));
+                return -1;
+            }
+        }
+        if(redirect->fd > STDERR_FILENO) openFds |= 1u << redirect->fd;
+    }
+    if(openRedirects(command) == -1) return -1;
+    //The files are moved out of the way first, so none is saved or replaced in place of the descriptor it landed on.
+    for(int i = 0; i < command->redirectNum; i++) {
+        command->redirects[i].openFd = keepFdHigh(command->redirects[i].openFd);
+    }
+    fflush(stdout);
+    for(int i = 0; i < command->redirectNum; i++) {
+        Redirect* redirect = &command->redirects[i];
+        int source = (redirect->type == REDIRECT_DUP) ? atoi(redirect->target) : redirect->openFd;
+        saved[i] = fcntl(redirect->fd, F_DUPFD_CLOEXEC, REDIRECT_FD_MAX);
+        dup2(source, redirect->fd);
+    }
+    userFds = openFds;
+    closeRedirects(command);
+    return 0;
+}
+
+/*
+ * Function to put back the descriptors replaced by redirectShellFds().
+ */
+void restoreShellFds(Command* command, int* saved) {
+    fflush(stdout);
+    for(int i = command->redirectNum - 1; i >= 0; i--) {
+        if(saved[i] != -1) {
+            dup2(saved[i], command->redirects[i].fd);
+            close(saved[i]);
+        } else {
+            close(command->redirects[i].fd);
+            userFds &= ~(1u << command->redirects[i].fd);
+        }
+    }
+}
+
+/*
+ * Function to run commands in a forked copy of the shell, as a process of a job: compound commands put in the
+ * background, and lists and compound commands sent to a server, which never waits for commands itself.
+ * Returns the PID of the child, -1 if it could not be started.
+ */
+pid_t forkCommands(Job* job, const char* text, size_t length) {
+    fflush(stdout);
+    spawnCount++;
+    uint64_t start = readTicks();
+    pid_t childID = fork();
+    if(childID == 0) {
+        sigset_t emptyMask;
+        sigemptyset(&emptyMask);
+        sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        resetEventLoop();
+        if(jobControl) setpgid(0, job->pgid);
+        //The commands stay in the process group of the job.
+        jobControl = 0;
+        runLine(text, length);
+        fflush(stdout);
+        _exit(lastStatus);
+    }
+    recordLatency(METRIC_SPAWN, readTicks() - start);
+    if(childID == -1) {
+        spawnFailures++;
+        printf("ERROR: Cannot start subshell: %s\n", strerror(errno));
+        return -1;
+    }
+    if(jobControl) setpgid(childID, (job->pgid != 0) ? job->pgid : childID);
+    addJobProcess(job, childID, start);
+    return childID;
+}
+
+/*
+ * Function to parse the redirections of a compound command into a command of the line arena.
+ * Returns the command, NULL on error.
+ */
+Command* parseCompoundRedirects(Node* node) {
+    Pipeline* pipeline = arenaAlloc(&lineArena, sizeof(Pipeline));
+    if(parseLine(node->redirects, node->redirectsLength, &lineArena, pipeline) == -1) return NULL;
+    Command* command = &pipeline->stages[0];
+    if(pipeline->stageNum != 1 || command->argc > 0 || command->assignNum > 0) {
+        printf("ERROR: Unexpected words after compound command\n");
+        return NULL;
+    }
+    return command;
+}
+
+/*
+ * Function to expand the word list of a for loop, into the line arena.
+ * Without "in", the words are the positional parameters and wordsStore is set to NULL.
+ * Returns 0 on success, -1 on error.
+ */
+int expandForWords(Node* node, char*** wordsStore, int* wordNumStore) {
+    *wordsStore = NULL;
+    *wordNumStore = positionalNum;
+    if(node->words == NULL) return 0;
+
+    Pipeline* pipeline = arenaAlloc(&lineArena, sizeof(Pipeline));
+    if(parseLine(node->words, node->wordsLength, &lineArena, pipeline) == -1) return -1;
+    Command* command = &pipeline->stages[0];
+    *wordNumStore = 0;
+    if(pipeline->stageNum == 0) return 0;
+    if(pipeline->stageNum > 1 || command->redirectNum > 0) {
+        printf("ERROR: Unexpected operator in the words of for\n");
+        return -1;
+    }
+    *wordsStore = command->assigns;
+    *wordNumStore = command->assignNum + command->argc;
+    return 0;
+}
+
+/*
+ * Function to get the value of a positional parameter, "" if it is not set.
+ */
+const char* positionalParameter(int index) {
+    char name[16];
+    int nameLength = snprintf(name, sizeof(name), "%d", index);
+    Variable* variable = getVar(&shellVars, name, nameLength);
+    return (variable != NULL) ? variable->entry + nameLength + 1 : "";
+}
+
+/*
+ * Function to set the positional parameters, leaving those after count empty up to clearNum.
+ */
+void setPositionalParameters(int count, char** values, int clearNum) {
+    char name[16];
+    for(int i = 1; i <= count || i <= clearNum; i++) {
+        int nameLength = snprintf(name, sizeof(name), "%d", i);
+        const char* value = (i <= count) ? values[i - 1] : "";
+        setVar(&shellVars, name, nameLength, value, strlen(value), 0);
+    }
+    positionalNum = count;
+}
+
+/*
+ * Function to run a simple command.
+ * Returns 0 if it asked the shell to exit, 1 else.
+ */
+int runCommandNode(Node* node) {
+    Pipeline pipeline;
+    if(parseLine(node->text, node->length, &lineArena, &pipeline) == -1) {
+        lastStatus = 2;
+        return 1;
+    }
+    int running = runPipeline(&pipeline, node->text, node->length);
+
+    //A command killed by ^C stops the lists and loops it is part of, like ^C typed while a built-in runs.
+    if(jobControl && lastStatus == 128 + SIGINT) interrupted = 1;
+    return running;
+}
+
+/*
+ * Function to run a node of a command list, with everything below it, and rewind the line arena to where it was.
+ * Returns 0 if a command asked the shell to exit, 1 else.
+ */
+int runNode(Node* node) {
+    if(node->background) {
+        Job* job = createJob(node->text, node->length, 1);
+        int savedFds[2];
+        int captureFd = beginCapture(savedFds);
+        if(forkCommands(job, node->text, node->length) == -1) {
+            endCapture(captureFd, savedFds, NULL);
+            removeJob(job);
+            lastStatus = 127;
+            return 1;
+        }
+        endCapture(captureFd, savedFds, job);
+        if(jobControl) printf("[%d] %d\n", job->id, job->pids[job->pidNum - 1]);
+        lastStatus = 0;
+        return 1;
+    }
+
+    Arena mark = lineArena;
+    Command* redirects = NULL;
+    int* savedFds = NULL;
+    if(node->redirects != NULL) {
+        redirects = parseCompoundRedirects(node);
+        if(redirects != NULL) {
+            savedFds = arenaAlloc(&lineArena, redirects->redirectNum * sizeof(int));
+            if(redirectShellFds(redirects, savedFds) == -1) {
+                arenaRewind(&lineArena, &mark);
+                lastStatus = 1;
+                return 1;
+            }
+        } else {
+            arenaRewind(&lineArena, &mark);
+            lastStatus = 2;
+            return 1;
+        }
+    }
+
+    int running = 1;
+    int status = 0;
+    switch(node->type) {
+        case NODE_COMMAND:
+            running = runCommandNode(node);
+            break;
+        case NODE_SEQUENCE:
+            for(Node* item = node; running && !controlPending(); item = item->second) {
+                if(item->type != NODE_SEQUENCE) {
+                    running = runNode(item);
+                    break;
+                }
+                running = runNode(item->first);
+            }
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            running = runNode(node->first);
+            if(running && !controlPending() && (lastStatus == 0) == (node->type == NODE_AND)) {
+                running = runNode(node->second);
+            }
+            break;
+        case NODE_NOT:
+            running = runNode(node->first);
+            lastStatus = (lastStatus == 0);
+            break;
+        case NODE_IF:
+            running = runNode(node->first);
+            if(!running || controlPending()) break;
+            if(lastStatus == 0) {
+                running = runNode(node->second);
+            } else if(node->third != NULL) {
+                running = runNode(node->third);
+            } else {
+                lastStatus = 0;
+            }
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            loopDepth++;
+            while(1) {
+                running = runNode(node->first);
+                if(!running || leaveLoop() || (lastStatus == 0) != (node->type == NODE_WHILE)) break;
+                running = runNode(node->second);
+                status = lastStatus;
+                if(!running || leaveLoop()) break;
+            }
+            loopDepth--;
+            lastStatus = interrupted ? 130 : status;
+            break;
+        case NODE_FOR: {
+            char** words = NULL;
+            int wordNum = 0;
+            if(expandForWords(node, &words, &wordNum) == -1) {
+                lastStatus = 2;
+                break;
+            }
+            loopDepth++;
+            for(int i = 0; i < wordNum; i++) {
+                const char* word = (words != NULL) ? words[i] : positionalParameter(i + 1);
+                setVar(&shellVars, node->name, node->nameLength, word, strlen(word), 0);
+                running = runNode(node->second);
+                status = lastStatus;
+                if(!running || leaveLoop()) break;
+            }
+            loopDepth--;
+            lastStatus = interrupted ? 130 : status;
+            break;
+        }
+        case NODE_GROUP:
+            running = runNode(node->first);
+            break;
+        case NODE_FUNCTION:
+            defineFunction(node);
+            lastStatus = 0;
+            break;
+    }
+
+    if(savedFds != NULL) restoreShellFds(redirects, savedFds);
+    arenaRewind(&lineArena, &mark);
+    return running;
+}
+
+/*
+ * Function to call a function with the arguments of command as its positional parameters, and its redirections
+ * applied to all of its commands. The positional parameters of the caller are put back once it returns.
+ * Returns 0 if a command of the function asked the shell to exit, 1 else.
+ */
+int callFunction(Function* function, Command* command) {
+    if(functionDepth == FUNCTION_DEPTH_MAX) {
+        printf("ERROR: %s: more than %d nested function calls\n", function->name, FUNCTION_DEPTH_MAX);
+        lastStatus = 1;
+        return 1;
+    }
+    int* savedFds = NULL;
+    if(command->redirectNum > 0) {
+        savedFds = malloc(command->redirectNum * sizeof(int));
+        if(redirectShellFds(command, savedFds) == -1) {
+            free(savedFds);
+            lastStatus = 1;
+            return 1;
+        }
+    }
+
+    int savedNum = positionalNum;
+    char** savedParameters = malloc((savedNum + 1) * sizeof(char*));
+    for(int i = 0; i < savedNum; i++) {
+        savedParameters[i] = strdup(positionalParameter(i + 1));
+    }
+    setPositionalParameters(command->argc - 1, command->argv + 1, 0);
+
+    function->calls++;
+    functionDepth++;
+    int running = runNode(function->body);
+    functionDepth--;
+    function->calls--;
+    returning = 0;
+
+    setPositionalParameters(savedNum, savedParameters, positionalNum);
+    for(int i = 0; i < savedNum; i++) {
+        free(savedParameters[i]);
+    }
+    free(savedParameters);
+    if(savedFds != NULL) {
+        restoreShellFds(command, savedFds);
+        free(savedFds);
+    }
+    if(function->replaced && function->calls == 0) freeFunction(function);
+    return running;
+}
+
+/*---------------------------------------------End of control flow section---------------------------------------------*/
+
+/*
+ * Function to run the pipeline parsed from a line, line being its text for the job table.
+ * External commands run as a job, which is waited for unless the line ends with '&'.
+ * A line starting with the time keyword reports the time taken once it completes.
+ * Returns 0 if the line asked the shell to exit, 1 else.
+ */
+int runPipeline(Pipeline* pipeline, const char* line, size_t length) {
+    int running = 1;
+    int status = 0;
+    Job* job = NULL;
+
+    //Skip blank lines and comments.
+    if(pipeline->stageNum == 0) return 1;
+
+    //Keep the command line for the job table, without leading blanks and the time keyword.
+    while(length > 0 && (*line == ' ' || *line == '\t')) {
+        line++;
+        length--;
+    }
+    while(length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t' || line[length - 1] == '\r')) {
+        length--;
+    }
+
+    int timed = 0;
+    struct timespec start;
+    struct rusage shellStart;
+    Command* first = &pipeline->stages[0];
+    if(first->argc > 0 && first->assignNum == 0 && strcmp(first->argv[0], "time") == 0) {
+        timed = 1;
+        first->argv++;
+        first->argc--;
+        if(length >= 4 && strncmp(line, "time", 4) == 0) {
+            line += 4;
+            length -= 4;
+        }
+        while(length > 0 && (*line == ' ' || *line == '\t')) {
+            line++;
+            length--;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        getrusage(RUSAGE_SELF, &shellStart);
+    }
+
+    Function* function = NULL;
+    if(pipeline->stageNum == 1 && first->argc > 0 && strcmp(first->argv[0], "exit") == 0) {
+        //"exit n" exits with status n, a bare exit with that of the last command.
+        status = (first->argc > 1) ? atoi(first->argv[1]) & 255 : lastStatus;
+        running = 0;
+    } else if(pipeline->stageNum == 1 && first->argc > 0 && !pipeline->background && takeLoopControl(first, &status)) {
+        //break, continue or return, which only change which commands run next.
+    } else if(pipeline->stageNum == 1 && first->argc > 0 && first->assignNum == 0 && !pipeline->background &&
+              (function = findFunction(first->argv[0])) != NULL) {
+        running = callFunction(function, first);
+        status = lastStatus;
+    } else {
+        int savedFds[2];
+        int captureFd = pipeline->background ? beginCapture(savedFds) : -1;
+        job = startPipeline(pipeline, line, length, &status);
+        endCapture(captureFd, savedFds, job);
+    }
+
+    if(job != NULL && job->background) {
+        if(jobControl) printf("[%d] %d\n", job->id, job->pids[job->pidNum - 1]);
+        status = 0;
+        job = NULL;
+    } else if(job != NULL) {
+        //A built-in run inside the shell at the end of a pipeline provides the status instead of the job.
+        int jobStatus = waitJob(job);
+        if(status == -1) status = jobStatus;
+    }
+    if(timed) printTimes(job, &start, &shellStart);
+    if(job != NULL && job->state == JOB_DONE) removeJob(job);
+    lastStatus = status;
+    return running;
+}
+
+/*
+ * Function to run a line of input, or a text of several lines, one command line at a time. A compound command
+ * spanning several lines is parsed whole before any of it runs.
+ * Commands are parsed into the line arena, which is reset before each command line, so nothing needs to be freed.
+ * Returns 0 if a command asked the shell to exit, 1 else.
+ */
+int runLine(const char* line, size_t length) {
+    ListParser parser = {line, line + length, &lineArena, 0, 0, 0, ""};
+    int running = 1;
+    while(running && parser.cursor < parser.end) {
+        arenaReset(&lineArena);
+        interrupted = 0;
+        Node* node = parseList(&parser, 1);
+        if(node != NULL) {
+            running = runNode(node);
+        } else if(parser.failed || parser.incomplete) {
+            printf("ERROR: %s\n", parser.message);
+            lastStatus = 2;
+            skipErrorLine(&parser);
+        }
+        logFlushIfFull();
+    }
+    return running;
+}
+
+/*
+ * Function to run every line of a block of text, without a prompt.
+ * The text is only read, lines are parsed where they lie.
+ * Returns the exit status of the last command, or the one given to exit.
+ */
+int runLines(const char* text, size_t size) {
+    runLine(text, size);
+    return lastStatus;
+}
+
+/*---------------------------------------------Beginning of command substitution section---------------------------------------------*/
+/*
+ * The output of "$(command)" and "`command`" is read into an arena, one per level of nesting, whose chunks are kept
+ * from one substitution to the next. A command that cannot change the shell's state, a single side-effect-free
+ * built-in such as echo, printf or pwd, or "$(<file)", is evaluated inside the shell without forking, its output
+ * going to a memory file that is read back. Anything else runs in a forked copy of the shell, like a subshell, and
+ * its output is read from a pipe while it runs.
+ * While a substitution is evaluated, the line arena is swapped for its arena, so the word of the enclosing line being
+ * built at the top of the line arena is left alone by the parser and the built-ins.
+ */
+
+Arena captureArenas[SUBSTITUTION_DEPTH_MAX];
+int captureDepth = 0;
+int captureFd = -1;             //Memory file receiving the output of built-ins evaluated in the shell.
+
+/*
+ * Function to read everything from a descriptor into a string at the top of an arena.
+ * Returns the string, which is not terminated, and stores its length in lengthStore.
+ */
+char* arenaRead(Arena* arena, int fd, size_t* lengthStore) {
+    char* string = arenaTop(arena);
+    size_t length = 0;
+    while(1) {
+        if(arena->current->size - arena->used < 4096) {
+            arenaNextChunk(arena, 2 * (length + 4096));
+            memcpy(arena->current->data, string, length);
+            string = arena->current->data;
+            arena->used = length;
+        }
+        ssize_t count = read(fd, arena->current->data + arena->used, arena->current->size - arena->used);
+        if(count == -1 && errno == EINTR) continue;
+        if(count <= 0) break;
+        arena->used += count;
+        length += count;
+    }
+    *lengthStore = length;
+    return string;
+}
+
+/*
+ * Function to tell if a built-in only writes output, so that evaluating it inside the shell is the same as in a
+ * subshell.
+ */
+int isPureBuiltIn(const BuiltIn* builtInCommand) {
+    BuiltInFunction function = builtInCommand->function;
+    return function == echo || function == printfBuiltIn || function == pwd || function == basenameBuiltIn ||
+           function == trueBuiltIn || function == falseBuiltIn || function == testBuiltIn;
+}
+
+/*
+ * Function to evaluate a parsed substitution inside the shell, if it can be.
+ * Returns 1 with the output stored in outputStore and lengthStore, 0 if it must run in a subshell.
+ */
+int captureInShell(Pipeline* pipeline, char** outputStore, size_t* lengthStore) {
+    Command* command = &pipeline->stages[0];
+    if(pipeline->stageNum != 1 || pipeline->background) return 0;
+
+    int fd = -1;
+    const BuiltIn* builtInCommand = NULL;
+    if(command->argc == 0 && command->assignNum == 0 && command->redirectNum == 1 &&
+       command->redirects[0].type == REDIRECT_IN && command->redirects[0].fd == STDIN_FILENO) {
+        //$(<file) is the content of the file.
+        fd = open(command->redirects[0].target, O_RDONLY | O_CLOEXEC);
+        if(fd == -1) {
+            handleOpenError(command->redirects[0].target);
+            lastStatus = 1;
+        } else {
+            lastStatus = 0;
+        }
+    } else {
+        if(command->argc == 0) return 0;
+        builtInCommand = resolveBuiltIn(command);
+        if(builtInCommand == NULL || !isPureBuiltIn(builtInCommand)) return 0;
+        if(captureFd == -1) captureFd = memfd_create("substitution", MFD_CLOEXEC);
+        if(captureFd == -1) return 0;
+
+        //Outputs are appended to the memory file, which is only emptied once it grows large.
+        off_t offset = lseek(captureFd, 0, SEEK_CUR);
+        if(offset > COPY_CHUNK) {
+            ftruncate(captureFd, 0);
+            offset = lseek(captureFd, 0, SEEK_SET);
+        }
+        lastStatus = runBuiltIn(builtInCommand, command, STDIN_FILENO, captureFd);
+        fd = captureFd;
+        lseek(fd, offset, SEEK_SET);
+    }
+
+    *lengthStore = 0;
+    *outputStore = arenaTop(&lineArena);
+    if(fd != -1) *outputStore = arenaRead(&lineArena, fd, lengthStore);
+    if(fd != -1 && fd != captureFd) close(fd);
+    return 1;
+}
+
+/*
+ * Function to run a substitution in a forked copy of the shell, reading its output from a pipe.
+ * Returns the output, whose length is stored in lengthStore, NULL if the subshell could not be started.
+ */
+char* captureInSubshell(const char* command, size_t length, size_t* lengthStore) {
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) == -1) {
+        printf("ERROR: Cannot create pipe: %s\n", strerror(errno));
+        return NULL;
+    }
+    //The job is not in the foreground, the subshell stays in the shell's process group and the terminal stays with it.
+    Job* job = createJob(command, length, 1);
+    fflush(stdout);
+    spawnCount++;
+    uint64_t start = readTicks();
+    pid_t childID = fork();
+    if(childID == 0) {
+        sigset_t emptyMask;
+        sigemptyset(&emptyMask);
+        sigprocmask(SIG_SETMASK, &emptyMask, NULL);
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        resetEventLoop();
+        jobControl = 0;
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        runLine(command, length);
+        fflush(stdout);
+        _exit(lastStatus);
+    }
+    recordLatency(METRIC_SPAWN, readTicks() - start);
+    close(fds[1]);
+    if(childID == -1) {
+        spawnFailures++;
+        printf("ERROR: Cannot start subshell: %s\n", strerror(errno));
+        close(fds[0]);
+        removeJob(job);
+        return NULL;
+    }
+    job->startTicks[0] = start;
+    job->pids[job->pidNum++] = childID;
+    job->runningNum++;
+
+    char* output = arenaRead(&lineArena, fds[0], lengthStore);
+    close(fds[0]);
+    lastStatus = waitJob(job);
+    removeJob(job);
+    return output;
+}
+
+/*
+ * Function to run the command of a substitution and capture its output.
+ * The output is left in the arena of the substitution's level, where it stays until the next substitution at that
+ * level, and the exit status of the command is stored in lastStatus.
+ * Returns the output, whose length is stored in lengthStore, NULL on error.
+ */
+char* captureOutput(const char* command, size_t length, size_t* lengthStore) {
+    if(captureDepth == SUBSTITUTION_DEPTH_MAX) {
+        printf("ERROR: More than %d nested command substitutions\n", SUBSTITUTION_DEPTH_MAX);
+        return NULL;
+    }
+    Arena outerArena = lineArena;
+    lineArena = captureArenas[captureDepth];
+    arenaReset(&lineArena);
+    captureDepth++;
+
+    char* output = NULL;
+    Pipeline pipeline;
+    int simple = isSimpleCommand(command, length, &lineArena);
+    if(simple == 0) {
+        //Lists and compound commands run in the subshell, whatever their commands are.
+        output = captureInSubshell(command, length, lengthStore);
+    } else if(simple == -1 || parseLine(command, length, &lineArena, &pipeline) == -1) {
+        lastStatus = 2;
+    } else if(pipeline.stageNum == 0) {
+        *lengthStore = 0;
+        output = "";
+    } else if(!captureInShell(&pipeline, &output, lengthStore)) {
+        output = captureInSubshell(command, length, lengthStore);
+    }
+
+    captureDepth--;
+    captureArenas[captureDepth] = lineArena;
+    lineArena = outerArena;
+    return output;
+}
+
+/*---------------------------------------------End of command substitution section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of script cache section---------------------------------------------*/
+/*
+ * A script (and ~/.oshellrc) is compiled into a cache file next to it, ".name.oshc", keyed by the XXH64 hash of its
+ * content. Blank lines and comments are dropped, command lines that are a single pipeline whose words do not depend
+ * on variables are stored already parsed, as flattened pipelines whose strings are used in place from the mapped
+ * cache, and the other command lines, lists and compound commands (whole, over all the lines they span) among them,
+ * are stored as text, parsed when they run. A script whose cache matches its content runs without being tokenized.
+ * The cache is made while the script runs for the first time, from the pipelines parsed to run it, and put in place
+ * with rename(), so a concurrent run never sees it half written. A cache owned by another user is not trusted.
+ *
+ * Cache layout: a CacheHeader, then records of 32-bit words and strings (a length word, the bytes and a NUL, padded
+ * to a word), CACHE_TEXT: kind, line; CACHE_PIPELINE: kind, line, background, stageNum, and for each stage argc,
+ * assignNum, redirectNum, the words (assignments first), and for each redirection its type, descriptor and target.
+ */
+
+#define CACHE_MAGIC "OSHCACHE"
+#define CACHE_VERSION 2
+
+typedef struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordNum;
+    uint64_t scriptSize;
+    uint64_t scriptHash;
+} CacheHeader;
+
+typedef enum CacheRecord {
+    CACHE_TEXT = 1,
+    CACHE_PIPELINE
+} CacheRecord;
+
+typedef struct CacheWriter {
+    char* data;
+    size_t size;
+    size_t capacity;
+    uint32_t recordNum;
+} CacheWriter;
+
+/*
+ * Function to append bytes to a cache being written, padded with zeros to a multiple of 4 bytes.
+ */
+void cacheAppend(CacheWriter* writer, const void* bytes, size_t count) {
+    size_t padded = (count + 3) & ~(size_t) 3;
+    if(writer->size + padded > writer->capacity) {
+        writer->capacity = (writer->size + padded > 2 * writer->capacity) ? writer->size + padded : 2 * writer->capacity;
+        writer->data = realloc(writer->data, writer->capacity);
+    }
+    memcpy(writer->data + writer->size, bytes, count);
+    memset(writer->data + writer->size + count, 0, padded - count);
+    writer->size += padded;
+}
+
+void cacheAppendWord(CacheWriter* writer, uint32_t word) {
+    cacheAppend(writer, &word, sizeof(word));
+}
+
+void cacheAppendString(CacheWriter* writer, const char* string, size_t length) {
+    cacheAppendWord(writer, length);
+    //The NUL is written by the padding when length is not a multiple of 4, else by a word of its own.
+    cacheAppend(writer, string, length);
+    if(length % 4 == 0) cacheAppendWord(writer, 0);
+}
+
+/*
+ * Function to add a line to a cache being written, parsed if its pipeline is given.
+ */
+void cacheAddLine(CacheWriter* writer, const char* line, size_t length, Pipeline* pipeline) {
+    writer->recordNum++;
+    if(pipeline == NULL) {
+        cacheAppendWord(writer, CACHE_TEXT);
+        cacheAppendString(writer, line, length);
+        return;
+    }
+    cacheAppendWord(writer, CACHE_PIPELINE);
+    cacheAppendString(writer, line, length);
+    cacheAppendWord(writer, pipeline->background);
+    cacheAppendWord(writer, pipeline->stageNum);
+    for(int i = 0; i < pipeline->stageNum; i++) {
+        Command* command = &pipeline->stages[i];
+        cacheAppendWord(writer, command->argc);
+        cacheAppendWord(writer, command->assignNum);
+        cacheAppendWord(writer, command->redirectNum);
+        for(int j = 0; j < command->assignNum + command->argc; j++) {
+            cacheAppendString(writer, command->assigns[j], strlen(command->assigns[j]));
+        }
+        for(int j = 0; j < command->redirectNum; j++) {
+            cacheAppendWord(writer, command->redirects[j].type);
+            cacheAppendWord(writer, command->redirects[j].fd);
+            cacheAppendString(writer, command->redirects[j].target, strlen(command->redirects[j].target));
+        }
+    }
+}
+
+/*
+ * Function to read a word of a cache record and move past it.
+ */
+uint32_t cacheReadWord(char** cursor) {
+    uint32_t word = *(uint32_t*) *cursor;
+    *cursor += sizeof(uint32_t);
+    return word;
+}
+
+/*
+ * Function to read a string of a cache record, used where it lies in the mapped cache, and move past it.
+ */
+char* cacheReadString(char** cursor, size_t* lengthStore) {
+    size_t length = cacheReadWord(cursor);
+    char* string = *cursor;
+    *cursor += (length + 4) & ~(size_t) 3;
+    if(lengthStore != NULL) *lengthStore = length;
+    return string;
+}
+
+/*
+ * Function to rebuild the pipeline of a CACHE_PIPELINE record, with its argument vectors in the line arena.
+ */
+void cacheReadPipeline(char** cursor, Pipeline* pipeline) {
+    pipeline->background = cacheReadWord(cursor);
+    pipeline->stageNum = cacheReadWord(cursor);
+    pipeline->expanded = 0;
+    pipeline->substituted = 0;
+    for(int i = 0; i < pipeline->stageNum; i++) {
+        Command* command = &pipeline->stages[i];
+        command->argc = cacheReadWord(cursor);
+        command->assignNum = cacheReadWord(cursor);
+        command->redirectNum = cacheReadWord(cursor);
+        int wordNum = command->assignNum + command->argc;
+        command->assigns = arenaAlloc(&lineArena, (wordNum + 1) * sizeof(char*));
+        for(int j = 0; j < wordNum; j++) {
+            command->assigns[j] = cacheReadString(cursor, NULL);
+        }
+        command->assigns[wordNum] = NULL;
+        command->argv = command->assigns + command->assignNum;
+        command->redirects = arenaAlloc(&lineArena, command->redirectNum * sizeof(Redirect));
+        command->cpus = NULL;
+        for(int j = 0; j < command->redirectNum; j++) {
+            command->redirects[j].type = cacheReadWord(cursor);
+            command->redirects[j].fd = cacheReadWord(cursor);
+            command->redirects[j].target = cacheReadString(cursor, NULL);
+            command->redirects[j].openFd = -1;
+        }
+    }
+}
+
+/*
+ * Function to check a string of a cache record against the end of the mapping and move past it: its length word,
+ * its bytes and their NUL must all lie before end.
+ * Returns 0 if the string is whole, -1 else.
+ */
+int cacheCheckString(char** cursor, char* end) {
+    if(end - *cursor < (ptrdiff_t) sizeof(uint32_t)) return -1;
+    size_t length = cacheReadWord(cursor);
+    size_t padded = (length + 4) & ~(size_t) 3;
+    if(padded > (size_t) (end - *cursor) || (*cursor)[length] != '\0') return -1;
+    *cursor += padded;
+    return 0;
+}
+
+/*
+ * Function to check every record of a mapped cache before any of it runs, so that a damaged or forged cache is never
+ * read past its end: record kinds, stage counts up to PIPELINE_MAX, word and redirection counts that the rest of the
+ * mapping can hold, redirections of descriptors the parser accepts, and every string.
+ * Returns 0 if the cache can be run, -1 else.
+ */
+int checkCache(char* cache, size_t size) {
+    CacheHeader* header = (CacheHeader*) cache;
+    char* cursor = cache + sizeof(CacheHeader);
+    char* end = cache + size;
+    for(uint32_t i = 0; i < header->recordNum; i++) {
+        if(end - cursor < (ptrdiff_t) sizeof(uint32_t)) return -1;
+        uint32_t kind = cacheReadWord(&cursor);
+        if((kind != CACHE_TEXT && kind != CACHE_PIPELINE) || cacheCheckString(&cursor, end) == -1) return -1;
+        if(kind == CACHE_TEXT) continue;
+
+        if(end - cursor < (ptrdiff_t) (2 * sizeof(uint32_t))) return -1;
+        cacheReadWord(&cursor);
+        uint32_t stageNum = cacheReadWord(&cursor);
+        if(stageNum > PIPELINE_MAX) return -1;
+        for(uint32_t j = 0; j < stageNum; j++) {
+            if(end - cursor < (ptrdiff_t) (3 * sizeof(uint32_t))) return -1;
+            uint64_t argc = cacheReadWord(&cursor);
+            uint64_t assignNum = cacheReadWord(&cursor);
+            uint64_t redirectNum = cacheReadWord(&cursor);
+            //A string takes at least two words and a redirection four, which bounds what is allocated for them.
+            if((argc + assignNum) * 2 * sizeof(uint32_t) + redirectNum * 4 * sizeof(uint32_t) > (uint64_t) (end - cursor)) {
+                return -1;
+            }
+            for(uint64_t k = 0; k < argc + assignNum; k++) {
+                if(cacheCheckString(&cursor, end) == -1) return -1;
+            }
+            for(uint64_t k = 0; k < redirectNum; k++) {
+                if(end - cursor < (ptrdiff_t) (2 * sizeof(uint32_t))) return -1;
+                uint32_t type = cacheReadWord(&cursor);
+                uint32_t fd = cacheReadWord(&cursor);
+                if(type > REDIRECT_DUP || fd >= REDIRECT_FD_MAX || cacheCheckString(&cursor, end) == -1) return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Function to run the lines of a script from its cache, once checkCache() accepted it.
+ */
+void runCache(char* cache) {
+    CacheHeader* header = (CacheHeader*) cache;
+    char* cursor = cache + sizeof(CacheHeader);
+    int running = 1;
+    for(uint32_t i = 0; running && i < header->recordNum; i++) {
+        uint32_t kind = cacheReadWord(&cursor);
+        size_t length = 0;
+        char* line = cacheReadString(&cursor, &length);
+        if(kind == CACHE_TEXT) {
+            running = runLine(line, length);
+        } else {
+            Pipeline pipeline;
+            arenaReset(&lineArena);
+            cacheReadPipeline(&cursor, &pipeline);
+            running = runPipeline(&pipeline, line, length);
+        }
+        logFlushIfFull();
+    }
+}
+
+/*
+ * Function to map the cache of a script if it exists and matches the script's content.
+ * The mapping is private and writable, so that the strings handed to commands can be changed like parsed ones.
+ * A cache whose records do not pass checkCache() is not used, the script runs from its text and the cache is written
+ * again.
+ * Returns the mapped cache, NULL if there is no usable cache.
+ */
+char* openCache(const char* cachePath, struct stat* scriptInfo, uint64_t hash, size_t* sizeStore) {
+    int fd = open(cachePath, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return NULL;
+    struct stat info;
+    if(fstat(fd, &info) == -1 || (size_t) info.st_size < sizeof(CacheHeader) ||
+       (info.st_uid != geteuid() && info.st_uid != scriptInfo->st_uid)) {
+        close(fd);
+        return NULL;
+    }
+    char* cache = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(cache == MAP_FAILED) return NULL;
+
+    CacheHeader* header = (CacheHeader*) cache;
+    if(memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != CACHE_VERSION ||
+       header->scriptSize != (uint64_t) scriptInfo->st_size || header->scriptHash != hash ||
+       checkCache(cache, info.st_size) == -1) {
+        munmap(cache, info.st_size);
+        return NULL;
+    }
+    *sizeStore = info.st_size;
+    return cache;
+}
+
+/*
+ * Function to write the cache of a script. Nothing is written if the directory of the script is not writable.
+ */
+void writeCache(const char* cachePath, CacheWriter* writer, size_t scriptSize, uint64_t hash) {
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.recordNum = writer->recordNum;
+    header.scriptSize = scriptSize;
+    header.scriptHash = hash;
+
+    char tempPath[DIR_MAX + 16];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", cachePath);
+    int fd = mkostemp(tempPath, O_CLOEXEC);
+    if(fd == -1) return;
+    struct iovec parts[2] = {{&header, sizeof(header)}, {writer->data, writer->size}};
+    if(writev(fd, parts, 2) != (ssize_t) (sizeof(header) + writer->size) || rename(tempPath, cachePath) == -1) {
+        unlink(tempPath);
+    }
+    close(fd);
+}
+
+/*
+ * Function to run the command lines of a script and compile them into its cache at the same time.
+ * Command lines after an exit are not run, they are stored as text.
+ */
+void runAndCache(const char* text, size_t size, const char* cachePath, uint64_t hash) {
+    CacheWriter writer = {NULL, 0, 0, 0};
+    ListParser parser = {text, text + size, &lineArena, 0, 0, 0, ""};
+    int running = 1;
+    while(1) {
+        arenaReset(&lineArena);
+        skipSeparators(&parser);
+        if(parser.cursor == parser.end) break;
+        const char* start = parser.cursor;
+        Node* node = parseList(&parser, 1);
+        if(node == NULL) {
+            //Parsed again when it runs, so that the error is reported each time.
+            if(running) {
+                printf("ERROR: %s\n", parser.message);
+                lastStatus = 2;
+            }
+            skipErrorLine(&parser);
+            cacheAddLine(&writer, start, parser.cursor - start, NULL);
+            continue;
+        }
+
+        size_t length = parser.cursor - start;
+        while(length > 0 && strchr(" \t\r\n", start[length - 1]) != NULL) {
+            length--;
+        }
+        if(!running || node->type != NODE_COMMAND) {
+            cacheAddLine(&writer, start, length, NULL);
+            if(running) running = runNode(node);
+        } else {
+            Pipeline pipeline;
+            if(parseLine(node->text, node->length, &lineArena, &pipeline) == -1) {
+                cacheAddLine(&writer, node->text, node->length, NULL);
+                lastStatus = 2;
+            } else {
+                //The pipeline is stored before it runs, which may change its argument vectors.
+                if(pipeline.stageNum > 0) {
+                    cacheAddLine(&writer, node->text, node->length, pipeline.expanded ? NULL : &pipeline);
+                }
+                running = runPipeline(&pipeline, node->text, node->length);
+            }
+        }
+        logFlushIfFull();
+    }
+    writeCache(cachePath, &writer, size, hash);
+    free(writer.data);
+}
+
+/*
+ * Function to run a script file (non-interactive batch mode).
+ * The script is mapped into memory and hashed, and runs from its cache if that matches, else its lines are parsed
+ * where they lie and the cache is written.
+ * Returns the exit status of the last command or the one given to exit, -1 if the script could not be loaded.
+ */
+int runScript(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        handleOpenError(path);
+        return -1;
+    }
+    struct stat info;
+    if(fstat(fd, &info) == -1 || info.st_size == 0) {
+        close(fd);
+        return lastStatus;
+    }
+    size_t size = info.st_size;
+
+    char* text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(text == MAP_FAILED) {
+        handleMmapError();
+        return -1;
+    }
+    madvise(text, size, MADV_SEQUENTIAL);
+
+    //The cache of dir/name is dir/.name.oshc.
+    char cachePath[DIR_MAX];
+    const char* name = strrchr(path, '/');
+    name = (name != NULL) ? name + 1 : path;
+    snprintf(cachePath, sizeof(cachePath), "%.*s.%s.oshc", (int) (name - path), path, name);
+
+    uint64_t hash = xxHash64(text, size);
+    size_t cacheSize = 0;
+    char* cache = openCache(cachePath, &info, hash, &cacheSize);
+    if(cache != NULL) {
+        runCache(cache);
+        munmap(cache, cacheSize);
+    } else {
+        runAndCache(text, size, cachePath, hash);
+    }
+    munmap(text, size);
+    return lastStatus;
+}
+
+/*---------------------------------------------End of script cache section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of server section---------------------------------------------*/
+/*
+ * With --serve the shell starts once and runs command lines sent by local clients over a Unix domain socket, sparing
+ * every task the start-up of a new shell. The socket is SOCK_SEQPACKET, so each message arrives whole:
+ *   client: a command line, optionally with a descriptor (SCM_RIGHTS) to use as its input, /dev/null else.
+ *   server: "STARTED\n" with the read ends of the line's stdout and stderr pipes (SCM_RIGHTS), which reach EOF once
+ *           every process of the line closed them, or "ERROR <reason>\n" if the line could not be run.
+ *   server: "EXIT <status> <user us> <sys us> <maxrss KB> <real us>\n" once the line completed.
+ * Every connection has its own working directory, variables and $?, copied from the server's when it connects, which
+ * are swapped in while one of its lines starts. A connection runs one line at a time, its next message is only read
+ * after the EXIT message, but any number of connections have lines running: processes are jobs whose completion
+ * callback answers the client, so the server only ever waits in the event loop.
+ * Built-ins run inside the server like in the shell, except those that may block (sleep, cat, parallel...), which run
+ * in a forked copy of it like external commands. Each connection only sees its own jobs. A line with a list or
+ * compound commands runs in a forked copy of the server, so its assignments and functions end with the line. A line
+ * ending with '&' is refused with status 2.
+ */
+
+typedef struct Connection {
+    int fd;                     //-1 once the client hung up.
+    char workDir[DIR_MAX];
+    VarTable vars;
+    int lastStatus;
+    int jobScope;               //Scope of the jobs of the connection's lines.
+    Job* job;                   //Job running the connection's line, NULL when it is waiting for the next one.
+    int status;                 //Exit status of a built-in ending the running line, -1 if the job provides it.
+    int closing;                //Non-zero once the client sent exit.
+    int references;             //Number of lines of the dispatcher using the connection, which keep it allocated.
+    struct timespec start;
+    struct Connection* nextDeferred;
+} Connection;
+
+int savedStdio[3] = {-1, -1, -1};   //The server's own standard descriptors, while those of a line are in place.
+int dispatching = 0;                //Non-zero while a line starts, during which other connections are deferred.
+int scopeNum = 0;                   //Number of job scopes given to connections.
+Connection* deferredConnections = NULL;
+
+/*
+ * Function to exchange the working directory, variables, $? and job scope of a connection with those of the shell.
+ * Called before a line of the connection starts and again after, which puts the shell's own back.
+ */
+void swapConnection(Connection* connection) {
+    //Cached command paths are only valid for the search path they were found with.
+    const char* shellPath = getVarValue(&shellVars, "PATH");
+    const char* connectionPath = getVarValue(&connection->vars, "PATH");
+    if((shellPath == NULL) != (connectionPath == NULL) || (shellPath != NULL && strcmp(shellPath, connectionPath) != 0)) {
+        clearCommandHash();
+    }
+
+    VarTable vars = shellVars;
+    shellVars = connection->vars;
+    connection->vars = vars;
+    int status = lastStatus;
+    lastStatus = connection->lastStatus;
+    connection->lastStatus = status;
+    int scope = jobScope;
+    jobScope = connection->jobScope;
+    connection->jobScope = scope;
+
+    char dir[DIR_MAX];
+    strcpy(dir, workDir);
+    strcpy(workDir, connection->workDir);
+    strcpy(connection->workDir, dir);
+    if(strcmp(workDir, connection->workDir) != 0 && chdir(workDir) == -1) handleChDirError();
+}
+
+/*
+ * Function to free a connection once its client hung up, unless a line of it is running or starting.
+ */
+void releaseConnection(Connection* connection) {
+    if(connection->fd != -1 || connection->job != NULL || connection->references > 0) return;
+    freeVarTable(&connection->vars);
+    free(connection);
+}
+
+/*
+ * Function to stop serving a connection, when the client hung up or after it sent exit.
+ */
+void closeConnection(Connection* connection) {
+    if(connection->fd == -1) return;
+    eventLoopRemove(connection->fd);
+    close(connection->fd);
+    connection->fd = -1;
+    releaseConnection(connection);
+}
+
+/*
+ * Function to send a message to the client of a connection, with descriptors if fdNum is not 0.
+ * Returns 0 on success, -1 if the client cannot be reached.
+ */
+int sendMessage(Connection* connection, const char* message, int* fds, int fdNum) {
+    struct iovec vector = {(void*) message, strlen(message)};
+    struct msghdr header;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    if(fdNum > 0) {
+        memset(control, 0, sizeof(control));
+        header.msg_control = control;
+        header.msg_controllen = CMSG_SPACE(fdNum * sizeof(int));
+        struct cmsghdr* controlHeader = CMSG_FIRSTHDR(&header);
+        controlHeader->cmsg_level = SOL_SOCKET;
+        controlHeader->cmsg_type = SCM_RIGHTS;
+        controlHeader->cmsg_len = CMSG_LEN(fdNum * sizeof(int));
+        memcpy(CMSG_DATA(controlHeader), fds, fdNum * sizeof(int));
+    }
+    return (sendmsg(connection->fd, &header, MSG_NOSIGNAL) == -1) ? -1 : 0;
+}
+
+/*
+ * Function to answer the line of a connection with its exit status and resource usage (that of the job's processes,
+ * none for a line that completed inside the server), then read the connection's next line.
+ */
+void finishConnectionLine(Connection* connection, int status, Job* job) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long long real = (end.tv_sec - connection->start.tv_sec) * 1000000LL + (end.tv_nsec - connection->start.tv_nsec) / 1000;
+    struct rusage usage;
+    if(job != NULL) {
+        usage = job->usage;
+    } else {
+        memset(&usage, 0, sizeof(usage));
+    }
+    connection->lastStatus = status;
+    connection->job = NULL;
+    if(connection->fd == -1) {
+        releaseConnection(connection);
+        return;
+    }
+
+    char message[128];
+    snprintf(message, sizeof(message), "EXIT %d %lld %lld %ld %lld\n", status,
+             usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec,
+             usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec, usage.ru_maxrss, real);
+    if(sendMessage(connection, message, NULL, 0) == -1 || connection->closing) {
+        closeConnection(connection);
+    } else {
+        eventLoopModify(connection->fd, EPOLLIN);
+    }
+}
+
+/*
+ * Function called when every process of a connection's line terminated.
+ */
+void connectionJobDone(Job* job, void* data) {
+    Connection* connection = data;
+    int status = (connection->status != -1) ? connection->status : jobExitStatus(job);
+    finishConnectionLine(connection, status, job);
+    removeJob(job);
+}
+
+/*
+ * Function to start a line of a connection with inFd (-1 for /dev/null) as its input and pipes to the client as its
+ * output and error output. While the line starts, those are the shell's standard descriptors, so its commands and
+ * built-ins use them exactly as they use the terminal in the interactive shell.
+ */
+void startConnectionLine(Connection* connection, char* line, size_t length, int inFd) {
+    int outPipe[2];
+    int errorPipe[2];
+    if(pipe2(outPipe, O_CLOEXEC) == -1) {
+        sendMessage(connection, "ERROR cannot create pipe\n", NULL, 0);
+        if(inFd != -1) close(inFd);
+        return;
+    }
+    if(pipe2(errorPipe, O_CLOEXEC) == -1) {
+        sendMessage(connection, "ERROR cannot create pipe\n", NULL, 0);
+        close(outPipe[0]);
+        close(outPipe[1]);
+        if(inFd != -1) close(inFd);
+        return;
+    }
+    if(inFd == -1) inFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    //The client gets the read ends before anything is written, so a line with more output than a pipe holds does not
+    //wait on a client that is waiting for the pipes.
+    int readEnds[2] = {outPipe[0], errorPipe[0]};
+    sendMessage(connection, "STARTED\n", readEnds, 2);
+    close(outPipe[0]);
+    close(errorPipe[0]);
+
+    fflush(stdout);
+    dup2(inFd, STDIN_FILENO);
+    dup2(outPipe[1], STDOUT_FILENO);
+    dup2(errorPipe[1], STDERR_FILENO);
+    close(inFd);
+    close(outPipe[1]);
+    close(errorPipe[1]);
+    swapConnection(connection);
+
+    clock_gettime(CLOCK_MONOTONIC, &connection->start);
+    Pipeline pipeline;
+    int status = 0;
+    Job* job = NULL;
+    arenaReset(&lineArena);
+    int simple = isSimpleCommand(line, length, &lineArena);
+    if(simple == 0) {
+        //Lists and compound commands run in a forked copy of the server, which never waits for commands itself.
+        job = createJob(line, length, 0);
+        status = -1;
+        if(forkCommands(job, line, length) == -1) {
+            removeJob(job);
+            job = NULL;
+            status = 127;
+        }
+    } else if(simple == -1 || parseLine(line, length, &lineArena, &pipeline) == -1) {
+        status = 2;
+    } else if(pipeline.background) {
+        //The EXIT message would only follow the job, which keeps the client's pipes open anyway.
+        printf("ERROR: background jobs cannot be run by the server\n");
+        status = 2;
+    } else if(pipeline.stageNum == 1 && pipeline.stages[0].argc > 0 && strcmp(pipeline.stages[0].argv[0], "exit") == 0) {
+        connection->closing = 1;
+        status = (pipeline.stages[0].argc > 1) ? atoi(pipeline.stages[0].argv[1]) & 255 : lastStatus;
+    } else if(pipeline.stageNum > 0) {
+        job = startPipeline(&pipeline, line, length, &status);
+    }
+
+    fflush(stdout);
+    swapConnection(connection);
+    for(int i = 0; i < 3; i++) {
+        dup2(savedStdio[i], i);
+    }
+
+    if(job == NULL) {
+        finishConnectionLine(connection, status, NULL);
+        return;
+    }
+    //The next message of the connection is only read once the line completed.
+    if(connection->fd != -1) eventLoopModify(connection->fd, 0);
+    connection->job = job;
+    connection->status = status;
+    job->onDone = connectionJobDone;
+    job->callbackData = connection;
+
+    //A built-in of the line may have waited in the event loop, during which the job may have been reaped.
+    if(job->state == JOB_DONE) connectionJobDone(job, connection);
+}
+
+/*
+ * Function to read a line sent on a connection and start it.
+ */
+void handleConnection(int fd, uint32_t events, void* data) {
+    Connection* connection = data;
+
+    //Lines do not start while another one is starting (e.g. inside a built-in waiting in the event loop), as the
+    //standard descriptors are that line's. The connection is read again once the other line has started.
+    if(dispatching) {
+        if(events & (EPOLLHUP | EPOLLERR)) {
+            closeConnection(connection);
+            return;
+        }
+        eventLoopModify(fd, 0);
+        connection->references++;
+        connection->nextDeferred = deferredConnections;
+        deferredConnections = connection;
+        return;
+    }
+
+    char line[SERVE_MESSAGE_MAX];
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec vector = {line, sizeof(line)};
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    ssize_t length = recvmsg(fd, &header, MSG_CMSG_CLOEXEC);
+    if(length == -1 && (errno == EAGAIN || errno == EINTR)) return;
+    if(length <= 0) {
+        closeConnection(connection);
+        return;
+    }
+
+    int inFd = -1;
+    for(struct cmsghdr* controlHeader = CMSG_FIRSTHDR(&header); controlHeader != NULL;
+        controlHeader = CMSG_NXTHDR(&header, controlHeader)) {
+        if(controlHeader->cmsg_level == SOL_SOCKET && controlHeader->cmsg_type == SCM_RIGHTS) {
+            int fdNum = (controlHeader->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int* fds = (int*) CMSG_DATA(controlHeader);
+            for(int i = 0; i < fdNum; i++) {
+                if(inFd == -1) {
+                    inFd = fds[i];
+                } else {
+                    close(fds[i]);
+                }
+            }
+        }
+    }
+    if(header.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+        sendMessage(connection, "ERROR line too long\n", NULL, 0);
+        if(inFd != -1) close(inFd);
+        return;
+    }
+    if(length > 0 && line[length - 1] == '\n') length--;
+
+    dispatching = 1;
+    connection->references++;
+    startConnectionLine(connection, line, length, inFd);
+    connection->references--;
+    dispatching = 0;
+
+    while(deferredConnections != NULL) {
+        Connection* deferred = deferredConnections;
+        deferredConnections = deferred->nextDeferred;
+        deferred->references--;
+        if(deferred->fd != -1 && deferred->job == NULL) eventLoopModify(deferred->fd, EPOLLIN);
+        releaseConnection(deferred);
+    }
+    releaseConnection(connection);
+}
+
+/*
+ * Function to accept new connections, each starting with the server's working directory and variables.
+ */
+void handleServerSocket(int fd, uint32_t events, void* data) {
+    int clientFd = -1;
+    while((clientFd = keepFdHigh(accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC))) != -1) {
+        Connection* connection = calloc(1, sizeof(Connection));
+        connection->fd = clientFd;
+        strcpy(connection->workDir, workDir);
+        loadVarTable(&connection->vars, varEnvironment(&shellVars));
+        connection->lastStatus = 0;
+        connection->jobScope = ++scopeNum;
+        if(eventLoopAdd(clientFd, EPOLLIN, handleConnection, connection) == -1) {
+            handleEpollError();
+            close(clientFd);
+            freeVarTable(&connection->vars);
+            free(connection);
+        }
+    }
+}
+
+/*
+ * Function to run the shell as a server for command lines sent to a Unix domain socket at path, until SIGTERM.
+ * A socket left at path by a previous server is replaced.
+ * Returns 0 once stopped, -1 if the socket could not be set up.
+ */
+int serve(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        handleSocketError(path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    struct stat info;
+    if(lstat(path, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path);
+    int serverFd = keepFdHigh(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    if(serverFd == -1 || bind(serverFd, (struct sockaddr*) &address, sizeof(address)) == -1 ||
+       listen(serverFd, SERVE_BACKLOG) == -1) {
+        handleSocketError(path);
+        if(serverFd != -1) close(serverFd);
+        return -1;
+    }
+    if(eventLoopAdd(serverFd, EPOLLIN, handleServerSocket, NULL) == -1) {
+        handleEpollError();
+        close(serverFd);
+        unlink(path);
+        return -1;
+    }
+
+    //SIGTERM stops the server through the event loop, so that the socket is removed.
+    sigaddset(&shellSignals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &shellSignals, NULL);
+    signalfd(signalFd, &shellSignals, 0);
+    serving = 1;
+
+    //A server started without standard descriptors (e.g. by a supervisor) gets /dev/null for them.
+    for(int i = 0; i < 3; i++) {
+        savedStdio[i] = fcntl(i, F_DUPFD_CLOEXEC, REDIRECT_FD_MAX);
+        if(savedStdio[i] == -1) savedStdio[i] = open("/dev/null", O_RDWR | O_CLOEXEC);
+    }
+    while(!terminated) {
+        eventLoopWait(-1);
+    }
+
+    eventLoopRemove(serverFd);
+    close(serverFd);
+    unlink(path);
+    return 0;
+}
+
+/*---------------------------------------------End of server section---------------------------------------------*/
+
+/*
+ * Function to set up the shell before it runs any command.
+ */
+void initShell() {
+    initMetrics();
+
+    //Receive SIGCHLD through the event loop.
+    initEventLoop();
+
+    //Writes to a closed pipe fail with EPIPE instead of terminating the shell.
+    signal(SIGPIPE, SIG_IGN);
+
+    initEnvironment();
+    initParser();
+    initBuiltIns();
+}
+
+/*
+ * Function to take a command line from the user, with the lines that follow it as long as it is incomplete (a
+ * compound command not closed yet, open quotes, or an operator at the end of the line).
+ * The command stays valid until the next call.
+ * Returns 0 once the end of the input has been reached, 1 else.
+ */
+int takeCommand(const char** commandStore, size_t* lengthStore) {
+    const char* line = NULL;
+    size_t length = 0;
+    if(!takeInput(0, &line, &length)) return 0;
+    if(!needsMoreInput(line, length)) {
+        *commandStore = line;
+        *lengthStore = length;
+        return 1;
+    }
+
+    size_t commandLength = 0;
+    while(1) {
+        if(commandLength + length + 1 > commandSize) {
+            commandSize = 2 * (commandLength + length + 1);
+            commandBuffer = realloc(commandBuffer, commandSize);
+        }
+        memcpy(commandBuffer + commandLength, line, length);
+        commandLength += length;
+        if(!needsMoreInput(commandBuffer, commandLength) || !takeInput(1, &line, &length)) break;
+        commandBuffer[commandLength++] = '\n';
+    }
+    *commandStore = commandBuffer;
+    *lengthStore = commandLength;
+    return 1;
+}
+
+/*
+ * Function to run the interactive shell, reading lines from stdin until it ends or exit is entered.
+ * Returns the exit status of the last command, or the one given to exit.
+ */
+int shell() {
+    const char* line = NULL;
+    size_t length = 0;
+
+    initJobControl();
+    initLineEditor();
+    watchStdin();
+
+    //Run ~/.oshellrc, through the script cache like any script.
+    char rcPath[DIR_MAX];
+    const char* homeDir = getVarValue(&shellVars, "HOME");
+    snprintf(rcPath, sizeof(rcPath), "%s/%s", (homeDir != NULL) ? homeDir : home, RC_FILE);
+    if(access(rcPath, R_OK) == 0) runScript(rcPath);
+
+    int running = 1;
+    do {
+        notifyJobs();
+        if(!takeCommand(&line, &length)) break;
+        running = runLine(line, length);
+    } while (running);
+    return lastStatus;
+}
@@ -0,0 +1,249 @@
+/*
+ * OShell library interface: the shell itself lives in shell.c, the Shell executable (main.c) and the benchmarks
+ * (bench/shell_bench.c) are thin programs on top of it.
+ */
+
+#ifndef OSHELL_SHELL_H
+#define OSHELL_SHELL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <sched.h>
+
+/*---------------------------------------------Beginning of constant declaration section---------------------------------------------*/
+/*
+ * The following constants are initialized to default values, the values can be changed at user discretion
+ * but any non-default values have not been tested and may cause unexpected behaviour.
+ */
+
+#define DIR_MAX 2048        //Max size of a string containing directory.
+#define HOME_MAX 256        //Max size of string containing home directory.
+#define INPUT_MAX 2048      //Initial size of the input buffer, which grows to hold longer lines.
+#define LOG_RING_SIZE 4096  //Number of records buffered before they are written to the log file, a power of 2.
+#define LOG_ROTATE_SIZE 4194304 //Size at which the log file is rotated.
+#define LOG_ROTATE_KEEP 3   //Number of rotated log files kept.
+#define LOG_IDLE_MS 1000    //Time without events after which buffered log records are written.
+#define EVENT_BATCH 32      //Max number of events handled per call to epoll_wait().
+#define HASH_BUCKETS 64     //Number of buckets in the command hash table.
+#define PIPELINE_MAX 16     //Max number of commands chained with '|'.
+#define REDIRECT_FD_MAX 10  //Descriptors 0 to 9 can be redirected, the shell keeps its own descriptors above.
+#define PIPE_SIZE 1048576   //Capacity requested for pipes between pipeline stages (default pipe-max-size).
+#define COPY_CHUNK 1048576  //Max number of bytes moved by a single splice() or read() call.
+#define ARENA_CHUNK 65536   //Size of the chunks the parser allocates words and argument vectors from.
+#define BUILTIN_TABLE_BITS 6 //log2 of the size of the built-in dispatch table, which must be larger than the number of built-ins.
+#define SERVE_MESSAGE_MAX 65536 //Max length of a command line sent to a server (--serve).
+#define SERVE_BACKLOG 128   //Max number of connections waiting to be accepted by a server.
+#define HISTORY_FILE ".oshell_history" //History file in the home directory, unless $HISTFILE is set.
+#define RC_FILE ".oshellrc"  //Startup script in the home directory, run by the interactive shell.
+#define HISTORY_BLOCK 64    //Number of history entries per block of the reverse search index.
+#define INDEX_CHUNK 4096    //Number of history entries indexed at a time while the shell waits for keys.
+#define SEARCH_MAX 256      //Max length of a reverse search query.
+#define COMPLETE_DIR_MAX 32 //Number of visited directories, besides those of $PATH, kept in the completion index.
+#define COMPLETE_LIST_MAX 200 //Max number of completions listed for a word.
+#define ESCAPE_WAIT_MS 50   //Time to wait for the rest of an escape sequence before taking ESC as a key.
+#define SUBSTITUTION_DEPTH_MAX 16 //Max nesting of command substitutions.
+#define HISTOGRAM_SUB_BITS 4 //log2 of the number of buckets per power of two in latency histograms (about 6% precision).
+#define LOAD_SAMPLE_MS 100  //Min time between two samples of the CPU load by the leastloaded placement policy.
+#define FUNCTION_DEPTH_MAX 1000 //Max nesting of function calls.
+#define LOOP_POLL_INTERVAL 64 //Iterations of a loop between two checks for ^C in the interactive shell.
+#define GLOB_READ_SIZE 1048576 //Bytes of directory entries read by a single getdents64() call while globbing.
+#define GLOB_THREADS_MAX 64 //Max number of threads reading directories for "**" (set -o globthreads=N).
+#define TIMER_TICK_MS 10    //Resolution of the timer wheel.
+#define TIMER_LEVELS 4      //Levels of 64 slots of the timer wheel, which places deadlines up to 64^4 ticks away directly.
+#define TIMEOUT_GRACE_MS 5000 //Time a job past its deadline has between SIGTERM and SIGKILL, unless timeout -k says otherwise.
+#define RESULT_CACHE_DIR ".cache/oshell" //Store of the cache command in the home directory, unless $XDG_CACHE_HOME is set.
+#define JOB_OUTPUT_INITIAL 4096 //Initial size of the ring holding the captured output of a background job.
+#define JOB_OUTPUT_MAX 1048576 //Max size of the ring of a job, beyond which its oldest output is spilled or dropped.
+#define CAPTURE_MEMORY_MAX 16777216 //Max size of the rings of all the jobs together.
+#define RESULT_CACHE_LIMIT 268435456 //Size the store of the cache command is kept under, unless "cache limit SIZE" says otherwise.
+
+/*---------------------------------------------End of constant declaration section---------------------------------------------*/
+
+/*---------------------------------------------Beginning of type declaration section---------------------------------------------*/
+
+//Variable store (see the variable store section of shell.c).
+typedef struct Variable {
+    char* entry;                //"NAME=value", NULL for an empty slot.
+    size_t nameLength;
+    unsigned int hash;
+    int exported;
+} Variable;
+
+typedef struct VarTable {
+    Variable* slots;            //Linear probing, capacity is a power of 2.
+    size_t capacity;
+    size_t count;
+    char** envp;                //Entries of the exported variables, NULL terminated.
+    size_t envpSize;
+    int envpStale;              //Non-zero when envp must be rebuilt before it is used.
+} VarTable;
+
+//Job table (see the job table section of shell.c).
+typedef enum JobState {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+//Timer wheel (see the timer wheel section of shell.c).
+typedef struct Timer Timer;
+
+//Function called when a timer expires.
+typedef void (*TimerCallback)(Timer* timer, void* data);
+
+typedef struct Timer {
+    uint64_t expiry;            //Tick at which the timer expires.
+    TimerCallback callback;
+    void* data;
+    int pending;                //Non-zero while the timer is in the wheel.
+    int level;
+    int slot;
+    struct Timer* next;
+    struct Timer* previous;
+} Timer;
+
+typedef struct Job Job;
+
+//Function called when every process of a job has terminated.
+typedef void (*JobCallback)(Job* job, void* data);
+
+typedef struct Job {
+    int id;                     //Number used to refer to the job as %id.
+    pid_t pgid;                 //Process group of the job, 0 without job control.
+    pid_t pids[PIPELINE_MAX];
+    int pidNum;
+    int runningNum;             //Number of processes not terminated yet.
+    int status;                 //Wait status of the last process of the pipeline.
+    JobState state;
+    int background;
+    char* command;
+    struct timespec start;      //CLOCK_MONOTONIC time at which the job started.
+    struct timespec end;        //CLOCK_MONOTONIC time at which its last process terminated.
+    struct rusage usage;        //Resource usage summed over the processes (maximum for ru_maxrss).
+    cpu_set_t cpus;             //CPUs its processes were placed on, empty if they were left to the scheduler.
+    uint64_t startTicks[PIPELINE_MAX]; //Time each process was started, for the child duration histogram.
+    unsigned int reaped;        //Bit n set once process n terminated.
+    long timeoutMs;             //Deadline given by the timeout prefix, 0 for none, -1 if the shell's default applies.
+    long graceMs;               //Time between SIGTERM and SIGKILL once the deadline passed.
+    int deadlineSignal;         //Last signal sent because the deadline passed, 0 if it did not pass.
+    Timer deadline;
+    int scope;                  //Connection of a server the job belongs to, 0 for the shell's own jobs.
+    JobCallback onDone;         //Set for jobs managed by a built-in, which removes them, instead of the user.
+    void* callbackData;
+    struct Job* next;
+} Job;
+
+typedef struct JobLog {
+    int id;                     //Number of the job.
+    char* command;
+    int fd;                     //Read end of the pipe the job writes to, -1 once it was closed.
+    char* ring;                 //Most recent output of the job.
+    size_t capacity;
+    size_t start;               //Offset of the oldest byte in the ring.
+    size_t length;
+    uint64_t total;             //Bytes written by the job.
+    uint64_t spilled;           //Oldest bytes moved to the spill file.
+    uint64_t dropped;           //Oldest bytes lost, without a spill file.
+    int spillFd;
+    char* spillPath;            //Spill file, removed with the log.
+    int followFd;               //Output of fg, which gets the output too while the job is in the foreground, -1 else.
+    struct JobLog* next;
+} JobLog;
+
+//Parser (see the parser section of shell.c).
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    size_t size;
+    char data[];
+} ArenaChunk;
+
+typedef struct Arena {
+    ArenaChunk* first;
+    ArenaChunk* current;
+    size_t used;                //Bytes used in the current chunk.
+} Arena;
+
+typedef enum RedirectType {
+    REDIRECT_IN,                //[n]<file
+    REDIRECT_OUT,               //[n]>file
+    REDIRECT_APPEND,            //[n]>>file
+    REDIRECT_DUP                //[n]>&m
+} RedirectType;
+
+typedef struct Redirect {
+    RedirectType type;
+    int fd;                     //Descriptor of the command that is redirected.
+    char* target;               //File name, or descriptor number for REDIRECT_DUP.
+    int openFd;                 //Descriptor of the open file while the command starts, -1 else.
+} Redirect;
+
+typedef struct Command {
+    int argc;
+    char** argv;                //NULL terminated.
+    int assignNum;
+    char** assigns;             //NAME=value words before the command name.
+    int redirectNum;
+    Redirect* redirects;        //In the order they were written, which is the order they are applied in.
+    cpu_set_t* cpus;            //CPUs given by an @cpu= prefix, NULL if none.
+} Command;
+
+typedef struct Pipeline {
+    int stageNum;
+    int background;             //Non-zero if the line ended with '&'.
+    int expanded;               //Non-zero if variables were expanded, so parsing the line again may give other words.
+    int substituted;            //Non-zero if it contains command substitutions.
+    Command stages[PIPELINE_MAX];
+} Pipeline;
+
+//Built-in registry (see the built-in registry section of shell.c).
+typedef int (*BuiltInFunction)(int argc, char** argv, int inFd, int outFd);
+
+typedef struct BuiltIn {
+    const char* name;
+    BuiltInFunction function;
+    int mayBlock;               //Non-zero if it can wait on its input, on time or on other processes.
+} BuiltIn;
+
+/*---------------------------------------------End of type declaration section---------------------------------------------*/
+
+extern VarTable shellVars;
+extern Job* jobs;
+extern int lastStatus;
+extern Arena lineArena;
+extern const BuiltIn builtIns[];
+extern const size_t builtInNum;
+
+//Event log
+void logInit(const char* fileName);
+void logFlush();
+
+//Variable store
+Variable* setVar(VarTable* table, const char* name, size_t nameLength, const char* value, size_t valueLength, int export);
+const char* getVarValue(VarTable* table, const char* name);
+
+//Job table
+Job* createJob(const char* command, size_t length, int background);
+void removeJob(Job* job);
+int waitJob(Job* job);
+
+//Parser
+void arenaReset(Arena* arena);
+int parseLine(const char* line, size_t length, Arena* arena, Pipeline* pipeline);
+
+//Execution
+const BuiltIn* findBuiltIn(const char* name);
+int builtIn(const BuiltIn* command, int argc, char** argv, int inFd, int outFd);
+pid_t spawnCommand(Job* job, Command* command, int inFd, int outFd);
+int runLine(const char* line, size_t length);
+int runPipeline(Pipeline* pipeline, const char* line, size_t length);
+int runLines(const char* text, size_t size);
+char* captureOutput(const char* command, size_t length, size_t* lengthStore);
+int runScript(const char* path);
+int serve(const char* path);
+void initShell();
+int shell();
+
+#endif
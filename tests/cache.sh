@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runs commands through the result cache and checks that a stored result is replayed with its output, error output
+# and exit status, and that changing a file named with -i or -c runs the command again.
+# Usage: cache.sh path/to/Shell
+shell="$1"
+status=0
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export XDG_CACHE_HOME="$dir/cache"
+cd "$dir" || exit 1
+
+check() {
+    if [ "$1" != "$2" ]; then
+        echo "$3: $1"
+        status=1
+    fi
+}
+
+echo one > input
+command='cache -i input sh -c "cat input; echo run >> runs; echo err >&2; exit 3"'
+for i in 1 2; do
+    output=$("$shell" -c "$command" 2>stderr)
+    check "$?" 3 "status of run $i"
+    check "$output" one "output of run $i"
+    check "$(cat stderr)" err "error output of run $i"
+done
+check "$(wc -l < runs)" 1 "runs before the input changed"
+
+echo two > input
+output=$("$shell" -c "$command" 2>/dev/null)
+check "$output" two "output after the input changed"
+check "$(wc -l < runs)" 2 "runs after the input changed"
+
+output=$("$shell" -c 'cache stats' | grep -E '^(hits|misses)' | cut -d ' ' -f 1 | tr '\t\n' '  ')
+check "$output" "hits 0 misses 0 " "stats of a new shell"
+
+echo a > config
+"$shell" -c 'cache -c config sh -c "echo run >> runs2"'
+echo b > config
+"$shell" -c 'cache -c config sh -c "echo run >> runs2"'
+check "$(wc -l < runs2)" 2 "runs after the file given with -c changed"
+
+exit $status
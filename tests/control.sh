@@ -0,0 +1,23 @@
+#!/bin/sh
+# Runs loops with break and continue, nested functions with return, and lists joined by && and ||, and checks what
+# they print and their exit status.
+# Usage: control.sh path/to/Shell
+shell="$1"
+status=0
+
+check() {
+    output=$("$shell" -c "$1" | tr '\n' ' ')
+    if [ "$output" != "$2" ]; then
+        echo "$1 printed: $output"
+        status=1
+    fi
+}
+
+check 'for i in 1 2 3 4 5; do if [ $i = 2 ]; then continue; fi; if [ $i = 4 ]; then break; fi; echo $i; done' '1 3 '
+check 'for i in a b; do for j in 1 2 3; do if [ $j = 2 ]; then continue 2; fi; echo $i$j; done; done' 'a1 b1 '
+check 'i=0; while true; do i=x$i; if [ $i = xx0 ]; then break; fi; done; echo $i' 'xx0 '
+check 'inner() { echo in $1; return 3; echo never; }; outer() { inner $1; echo got $?; }; outer a' 'in a got 3 '
+check 'true && echo and; false && echo never; false || echo or; true || echo never' 'and or '
+check 'false && true; echo $?; false || false; echo $?; true && false || echo fell' '1 1 fell '
+
+exit $status
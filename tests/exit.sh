@@ -0,0 +1,27 @@
+#!/bin/sh
+# Checks that the shell exits with the status of its last command, or the one given to exit.
+# Usage: exit.sh path/to/Shell
+shell="$1"
+status=0
+
+check() {
+    "$shell" -c "$1" >/dev/null
+    result=$?
+    if [ "$result" != "$2" ]; then
+        echo "$1 exited with $result instead of $2"
+        status=1
+    fi
+}
+
+check 'false' 1
+check 'true' 0
+check 'exit 3' 3
+check 'false
+exit' 1
+check 'exit 4
+echo no' 4
+check 'echo a | false' 1
+check 'false; exit' 1
+check 'if true; then exit 4; fi; echo no' 4
+
+exit $status
@@ -0,0 +1,30 @@
+#!/bin/sh
+# Expands patterns in a directory of known files: quoting, bracket expressions, patterns matching nothing, hidden
+# files and "**" read by several threads.
+# Usage: glob.sh path/to/Shell
+shell="$1"
+status=0
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+mkdir -p "$dir/sub/deep"
+touch "$dir/a.c" "$dir/b.c" "$dir/x.c" "$dir/.hidden.c" "$dir/sub/s.c" "$dir/sub/deep/d.c"
+cd "$dir" || exit 1
+
+check() {
+    output=$("$shell" -c "$1")
+    if [ "$output" != "$2" ]; then
+        echo "$1 printed: $output"
+        status=1
+    fi
+}
+
+check 'echo *.c' 'a.c b.c x.c'
+check "echo '*.c' \"*.c\" \\*.c" '*.c *.c *.c'
+check 'echo [!x].c' 'a.c b.c'
+check 'echo [ab].c ?.c' 'a.c b.c a.c b.c x.c'
+check 'echo *.none' '*.none'
+check 'echo .*.c' '.hidden.c'
+check 'echo **/*.c' 'a.c b.c sub/deep/d.c sub/s.c x.c'
+check 'set -o globthreads=4; echo **/*.c' 'a.c b.c sub/deep/d.c sub/s.c x.c'
+
+exit $status
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Captures the output of background jobs and checks that joblog shows the output of each of them, also once the job
+# table emptied and a new job started, and that fg shows it on its own output.
+# Usage: joblog.sh path/to/Shell
+shell="$1"
+status=0
+
+check() {
+    if [ "$1" != "$2" ]; then
+        echo "$3: $1"
+        status=1
+    fi
+}
+
+output=$("$shell" -c 'set -o capture=on
+echo a &
+wait
+echo b &
+wait
+joblog -l' | wc -l)
+check "$output" 2 "logs listed after two jobs"
+
+output=$("$shell" -c 'set -o capture=on
+echo a &
+wait
+echo b &
+wait
+joblog %1
+joblog %2' | tr '\n' ' ')
+check "$output" "a b " "output of the two jobs"
+
+rm -f joblog.out
+"$shell" -c "set -o capture=on
+sh -c 'echo early; sleep 0.2; echo late' &
+fg %1 > joblog.out" > /dev/null
+check "$(cat joblog.out | tr '\n' ' ')" "early late " "output of fg redirected to a file"
+rm -f joblog.out
+
+exit $status
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Runs parallel with its arguments after ::: and read from the input as it arrives, and checks the output of the commands.
+# Usage: parallel.sh path/to/Shell
+shell="$1"
+status=0
+
+output=$("$shell" -c 'parallel -j 3 -g echo x{} ::: 1 2 3' | sort | tr '\n' ' ')
+if [ "$output" != "x1 x2 x3 " ]; then
+    echo "parallel with ::: printed: $output"
+    status=1
+fi
+
+output=$("$shell" -c 'printf "1\n2\n3\n" | parallel -j 3 -g echo y{}' | sort | tr '\n' ' ')
+if [ "$output" != "y1 y2 y3 " ]; then
+    echo "parallel reading its input printed: $output"
+    status=1
+fi
+
+output=$("$shell" -c 'printf "1\n\n\n2\n\n3" | parallel -j 2 -g echo z{}' | sort | tr '\n' ' ')
+if [ "$output" != "z1 z2 z3 " ]; then
+    echo "parallel with empty lines and no final newline printed: $output"
+    status=1
+fi
+
+# The second line is only written once the command for the first one ran, so the input must not be read to its end
+# before the first command starts.
+rm -f parallel.marker
+output=$("$shell" -c "sh -c 'echo parallel.marker; i=0; while [ ! -e parallel.marker ] && [ \$i -lt 50 ]; do sleep 0.1; i=\$((i + 1)); done; echo \$i' | parallel -j 1 touch" 2>&1)
+if [ -e 50 ] || [ ! -e parallel.marker ]; then
+    echo "parallel waited for the end of its input: $output"
+    status=1
+fi
+rm -f parallel.marker [0-9] [0-9][0-9]
+
+exit $status
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Swaps the output and error output of a built-in and of an executable, and checks that descriptors the command line
+# did not open cannot be copied.
+# Usage: redirect.sh path/to/Shell
+shell="$1"
+status=0
+
+for command in echo /bin/echo; do
+    output=$("$shell" -c "$command hi 3>&1 1>&2 2>&3" 2>&1 >/dev/null)
+    if [ "$output" != "hi" ]; then
+        echo "$command with its outputs swapped printed on stderr: $output"
+        status=1
+    fi
+done
+
+output=$("$shell" -c 'echo JUNK >&3
+/bin/echo JUNK >&4')
+if [ "$output" != "ERROR: 3: Bad file descriptor
+ERROR: 4: Bad file descriptor" ]; then
+    echo "copying descriptors that are not open printed: $output"
+    status=1
+fi
+
+output=$("$shell" -c '{ echo a >&3; /bin/echo b >&3; } 3>&1')
+if [ "$output" != "a
+b" ]; then
+    echo "copying a descriptor opened by a group printed: $output"
+    status=1
+fi
+
+exit $status
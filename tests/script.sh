@@ -0,0 +1,50 @@
+#!/bin/sh
+# Runs a script without and then with its cache and checks that both print the same, then that a cache which is
+# stale or damaged is not used.
+# Usage: script.sh path/to/Shell
+shell="$1"
+status=0
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+check() {
+    if [ "$1" != "$2" ]; then
+        echo "$3: $1"
+        status=1
+    fi
+}
+
+cat > test.osh <<'SCRIPT'
+# A comment and a blank line are dropped from the cache.
+
+echo plain words > out.txt
+cat out.txt | cat
+X=value
+echo $X
+false
+echo status $?
+SCRIPT
+expected="plain words
+value
+status 1"
+
+check "$("$shell" test.osh)" "$expected" "first run"
+if [ ! -f .test.osh.oshc ]; then
+    echo "no cache was written"
+    status=1
+fi
+check "$("$shell" test.osh)" "$expected" "run from the cache"
+
+echo 'echo added' >> test.osh
+check "$("$shell" test.osh)" "$expected
+added" "run after the script changed"
+
+size=$(wc -c < .test.osh.oshc)
+head -c $((size / 2)) .test.osh.oshc > truncated
+mv truncated .test.osh.oshc
+check "$("$shell" test.osh)" "$expected
+added" "run with a truncated cache"
+check "$(wc -c < .test.osh.oshc)" "$size" "size of the cache written again"
+
+exit $status
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Gives commands deadlines with the timeout prefix and "set -o timeout", and checks their exit status: 124 once
+# SIGTERM ended them, 137 when SIGKILL was needed after the grace time, 125 for a malformed duration. "timeout 0" lifts
+# the deadline.
+# Usage: timeout.sh path/to/Shell
+shell="$1"
+status=0
+
+check() {
+    "$shell" -c "$1" >/dev/null 2>&1
+    result=$?
+    if [ "$result" != "$2" ]; then
+        echo "$1 exited with $result instead of $2"
+        status=1
+    fi
+}
+
+check 'timeout 0.2 /bin/sleep 5' 124
+check 'timeout 5 /bin/sleep 0.1' 0
+check 'timeout 0.2 sleep 5' 124
+check "timeout -k 0.2 0.2 sh -c 'trap \"\" TERM; /bin/sleep 5'" 137
+check 'set -o timeout=0.2
+/bin/sleep 5' 124
+check 'set -o timeout=0.2
+timeout 5 /bin/sleep 0.5' 0
+check 'set -o timeout=0.2
+timeout 0 /bin/sleep 0.5' 0
+check 'timeout 0.0001 /bin/sleep 5' 124
+check 'timeout nan /bin/sleep 0.1' 125
+check 'timeout inf /bin/sleep 0.1' 125
+
+exit $status
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "eventlog.h"
+
+/*
+ * oshell-logdump: renders the binary event log written by the shell as text.
+ * Usage: oshell-logdump [log file...]   (defaults to shell_log.bin)
+ */
+
+#define SESSION_MAX 64      //Max number of shell sessions whose clock anchors are remembered per file.
+
+/*
+ * Descriptions of the errors each system call can report, taken from the man pages.
+ */
+typedef struct ErrorMessage {
+    EventCall call;
+    int code;
+    const char* message;
+} ErrorMessage;
+
+const ErrorMessage errorMessages[] = {
+    {CALL_GETCWD, EACCES, "Permission denied while setting up working directory (EACCES)"},
+    {CALL_GETCWD, EFAULT, "Cannot write to buffer specified at bad memory address (EFAULT)"},
+    {CALL_GETCWD, EINVAL, "Buffer provided is null (EINVAL)"},
+    {CALL_GETCWD, ENAMETOOLONG, "Current working directory path is too long (ENAMETOOLONG)"},
+    {CALL_GETCWD, ENOENT, "The current working directory has been unlinked (ENOENT)"},
+    {CALL_GETCWD, ENOMEM, "Out of memory (ENOMEM)"},
+    {CALL_GETCWD, ERANGE, "Provided size argument is less than length of path (ERANGE)"},
+    {CALL_CHDIR, EACCES, "Permission denied while accessing directory (EACCES)"},
+    {CALL_CHDIR, EFAULT, "Provided path is outside specified address space (EFAULT)"},
+    {CALL_CHDIR, EIO, "An I/O error has occurred (EIO)"},
+    {CALL_CHDIR, ELOOP, "Too many symbolic links in provided path (ELOOP)"},
+    {CALL_CHDIR, ENAMETOOLONG, "Path is too long (ENAMETOOLONG)"},
+    {CALL_CHDIR, ENOENT, "The specified path does not exist (ENOENT)"},
+    {CALL_CHDIR, ENOMEM, "Out of memory (ENOMEM)"},
+    {CALL_CHDIR, ENOTDIR, "One of the components of the path provided is invalid (ENOTDIR)"},
+    {CALL_GETLOGIN, EMFILE, "Max number of file descriptors are currently open in process (EMFILE)"},
+    {CALL_GETLOGIN, ENFILE, "Max allowable number of files currently open in system (ENFILE)"},
+    {CALL_SETENV, EINVAL, "Provided variable name is null, of length 0 or contains '=' (EINVAL)"},
+    {CALL_SETENV, ENOMEM, "Not enough memory to add variable to environment (ENOMEM)"},
+    {CALL_POSIX_SPAWN, E2BIG, "The total number of bytes in the argument list is too large (E2BIG)"},
+    {CALL_POSIX_SPAWN, EACCES, "Permissions denied for file (EACCES)"},
+    {CALL_POSIX_SPAWN, EFAULT, "File path is outside of accessible address space (EFAULT)"},
+    {CALL_POSIX_SPAWN, EINVAL, "An ELF executable tried to name more than one interpreter (EINVAL)"},
+    {CALL_POSIX_SPAWN, EIO, "An I/O Error has occurred. (EIO)"},
+    {CALL_POSIX_SPAWN, EISDIR, "An ELF interpreter was a directory (EISDIR)"},
+    {CALL_POSIX_SPAWN, ELIBBAD, "An ELF interpreter was not in a recognized format (ELIBBAD)"},
+    {CALL_POSIX_SPAWN, ELOOP, "Too many symbolic links were encountered in resolving name of executable (ELOOP)"},
+    {CALL_POSIX_SPAWN, EMFILE, "The process has the maximum number of files open (EMFILE)"},
+    {CALL_POSIX_SPAWN, ENAMETOOLONG, "Provided file name is too long (ENAMETOOLONG)"},
+    {CALL_POSIX_SPAWN, ENFILE, "System limit on total number of open files has been reached (ENFILE)"},
+    {CALL_POSIX_SPAWN, ENOENT, "The executable does not exist, or a shared library required cannot be found (ENOENT)"},
+    {CALL_POSIX_SPAWN, ENOEXEC, "The executable is not in a recognized format, is for the wrong architecture, or has other format errors (ENOEXEC)"},
+    {CALL_POSIX_SPAWN, ENOMEM, "Not enough memory to execute (ENOMEM)"},
+    {CALL_POSIX_SPAWN, ENOTDIR, "A component of the provided file path is not a directory (ENOTDIR)"},
+    {CALL_POSIX_SPAWN, EPERM, "The process is being traced, the user is not the superuser and the file has the set-user-ID or set-group-ID bit set (EPERM)"},
+    {CALL_POSIX_SPAWN, ETXTBSY, "Executable was open for writing by one or more processes (ETXTBSY)"},
+    {CALL_OPEN, EACCES, "Permission denied for file (EACCES)"},
+    {CALL_OPEN, EISDIR, "The file is a directory (EISDIR)"},
+    {CALL_OPEN, ELOOP, "Too many symbolic links were encountered in resolving the path (ELOOP)"},
+    {CALL_OPEN, EMFILE, "The process has the maximum number of files open (EMFILE)"},
+    {CALL_OPEN, ENAMETOOLONG, "Provided file name is too long (ENAMETOOLONG)"},
+    {CALL_OPEN, ENFILE, "System limit on total number of open files has been reached (ENFILE)"},
+    {CALL_OPEN, ENOENT, "The file does not exist (ENOENT)"},
+    {CALL_OPEN, ENOTDIR, "A component of the provided file path is not a directory (ENOTDIR)"},
+    {CALL_MMAP, EACCES, "The file is not a regular file or was not opened for reading (EACCES)"},
+    {CALL_MMAP, ENODEV, "The file system of the file does not support memory mapping (ENODEV)"},
+    {CALL_MMAP, ENOMEM, "Not enough memory to map the file (ENOMEM)"},
+    {CALL_SOCKET, EACCES, "Permission denied for the socket path or its directory (EACCES)"},
+    {CALL_SOCKET, EADDRINUSE, "Another process is already listening on the socket path (EADDRINUSE)"},
+    {CALL_SOCKET, ENAMETOOLONG, "The socket path is longer than a Unix socket address can hold (ENAMETOOLONG)"},
+    {CALL_SOCKET, ENOENT, "A directory in the socket path does not exist (ENOENT)"},
+    {CALL_SCHED_SETAFFINITY, EINVAL, "None of the CPUs given is online or allowed to the shell (EINVAL)"},
+    {CALL_SCHED_SETAFFINITY, EPERM, "Not permitted to set the CPU affinity (EPERM)"},
+};
+
+const char* callNames[CALL_MAX] = {"", "getcwd", "chdir", "fgets", "getlogin", "setenv", "posix_spawn", "open", "mmap", "read", "epoll",
+                                  "signalfd", "socket", "sched_setaffinity"};
+
+typedef struct Session {
+    uint32_t pid;
+    uint64_t monotonic;     //Timestamp of the EVENT_SESSION record.
+    uint64_t realtime;      //Wall-clock time at that timestamp.
+} Session;
+
+Session sessions[SESSION_MAX];
+int sessionNum = 0;
+
+/*
+ * Function to print the wall-clock time of a record, or its raw monotonic time if its session is unknown.
+ */
+void printTimestamp(const LogRecord* record) {
+    for(int i = sessionNum - 1; i >= 0; i--) {
+        if(sessions[i].pid == record->session) {
+            uint64_t wallClock = sessions[i].realtime + (record->timestamp - sessions[i].monotonic);
+            time_t seconds = wallClock / 1000000000;
+            struct tm local;
+            char text[64];
+            localtime_r(&seconds, &local);
+            strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+            printf("%s.%06lu ", text, (unsigned long) (wallClock % 1000000000 / 1000));
+            return;
+        }
+    }
+    printf("[monotonic %lu.%09lu] ", (unsigned long) (record->timestamp / 1000000000), (unsigned long) (record->timestamp % 1000000000));
+}
+
+/*
+ * Function to print the description of an error reported by a system call.
+ */
+void printError(const LogRecord* record) {
+    const char* name = (record->call < CALL_MAX) ? callNames[record->call] : "unknown";
+    printf("Error occurred when calling %s():", name);
+    for(size_t i = 0; i < sizeof(errorMessages) / sizeof(errorMessages[0]); i++) {
+        if(errorMessages[i].call == record->call && errorMessages[i].code == record->code) {
+            printf(" %s\n", errorMessages[i].message);
+            return;
+        }
+    }
+    if(record->code != 0) {
+        const char* errorName = strerrorname_np(record->code);
+        printf(" %s (%s)\n", strerror(record->code), (errorName != NULL) ? errorName : "?");
+    } else {
+        printf("\n");
+    }
+}
+
+/*
+ * Function to print one record.
+ */
+void printRecord(const LogRecord* record) {
+    if(record->type == EVENT_SESSION) {
+        if(sessionNum == SESSION_MAX) {
+            memmove(sessions, sessions + 1, (SESSION_MAX - 1) * sizeof(Session));
+            sessionNum--;
+        }
+        sessions[sessionNum].pid = record->session;
+        sessions[sessionNum].monotonic = record->timestamp;
+        sessions[sessionNum].realtime = record->arg;
+        sessionNum++;
+    }
+    printTimestamp(record);
+    printf("[%u] ", record->session);
+
+    switch(record->type) {
+        case EVENT_SESSION:
+            printf("Shell session started\n");
+            break;
+        case EVENT_ERROR:
+            printError(record);
+            break;
+        case EVENT_REAP:
+            if(WIFEXITED(record->code)) {
+                printf("child process with PID %i has terminated (exit status %i)\n", record->pid, WEXITSTATUS(record->code));
+            } else if(WIFSIGNALED(record->code)) {
+                printf("child process with PID %i has terminated (signal %s)\n", record->pid, sigabbrev_np(WTERMSIG(record->code)));
+            } else {
+                printf("child process with PID %i has terminated\n", record->pid);
+            }
+            break;
+        case EVENT_PLACE: {
+            char cpus[200] = "";
+            size_t used = 0;
+            for(int cpu = 0; cpu < 64; cpu++) {
+                if(record->arg & (1ULL << cpu)) used += snprintf(cpus + used, sizeof(cpus) - used, (used > 0) ? ",%d" : "%d", cpu);
+            }
+            printf("child process with PID %i placed on CPUs %s", record->pid, cpus);
+            if(record->code != -1) printf(", memory on NUMA node %i", record->code);
+            printf("\n");
+            break;
+        }
+        case EVENT_TIMEOUT:
+            if(record->code == SIGKILL) {
+                printf("job of PID %i still running after its grace period, sent %s\n", record->pid,
+                       sigabbrev_np(record->code));
+            } else {
+                printf("job of PID %i passed its deadline of %lu ms, sent %s\n", record->pid,
+                       (unsigned long) record->arg, sigabbrev_np(record->code));
+            }
+            break;
+        case EVENT_DROPPED:
+            printf("%lu records dropped, log buffer was full\n", (unsigned long) record->arg);
+            break;
+        default:
+            printf("unknown record type %u\n", record->type);
+            break;
+    }
+}
+
+/*
+ * Function to print every record of a log file.
+ * Returns 0 on success, -1 if the file cannot be read or is not an event log.
+ */
+int dumpFile(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        fprintf(stderr, "oshell-logdump: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    LogFileHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "oshell-logdump: %s: not an OShell event log\n", path);
+        fclose(file);
+        return -1;
+    }
+    if(header.version != LOG_VERSION || header.recordSize != sizeof(LogRecord)) {
+        fprintf(stderr, "oshell-logdump: %s: unsupported log version %u\n", path, header.version);
+        fclose(file);
+        return -1;
+    }
+
+    LogRecord record;
+    sessionNum = 0;
+    while(fread(&record, sizeof(record), 1, file) == 1) {
+        printRecord(&record);
+    }
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int result = EXIT_SUCCESS;
+    if(argc < 2) {
+        return (dumpFile("shell_log.bin") == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    for(int i = 1; i < argc; i++) {
+        if(argc > 2) printf("==> %s <==\n", argv[i]);
+        if(dumpFile(argv[i]) == -1) result = EXIT_FAILURE;
+    }
+    return result;
+}